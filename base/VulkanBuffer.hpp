@@ -14,6 +14,7 @@
 
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
+#include "VulkanMemoryAllocator.hpp"
 
 namespace vks
 {	
@@ -26,6 +27,8 @@ namespace vks
 		VkDevice device;
 		VkBuffer buffer = VK_NULL_HANDLE;
 		VkDeviceMemory memory = VK_NULL_HANDLE;
+		/** @brief Range of memory the buffer is bound to if it has been placed by a DeviceMemoryAllocator, otherwise memory is owned by the buffer */
+		vks::Allocation allocation;
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
 		VkDeviceSize alignment = 0;
@@ -46,6 +49,16 @@ namespace vks
 		*/
 		VkResult map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
 		{
+			if (allocation.allocator)
+			{
+				// Memory blocks are shared and stay mapped, so mapping only hands out a pointer
+				if (!allocation.mapped)
+				{
+					return VK_ERROR_MEMORY_MAP_FAILED;
+				}
+				mapped = static_cast<uint8_t*>(allocation.mapped) + offset;
+				return VK_SUCCESS;
+			}
 			return vkMapMemory(device, memory, offset, size, 0, &mapped);
 		}
 
@@ -58,7 +71,10 @@ namespace vks
 		{
 			if (mapped)
 			{
-				vkUnmapMemory(device, memory);
+				if (!allocation.allocator)
+				{
+					vkUnmapMemory(device, memory);
+				}
 				mapped = nullptr;
 			}
 		}
@@ -72,7 +88,7 @@ namespace vks
 		*/
 		VkResult bind(VkDeviceSize offset = 0)
 		{
-			return vkBindBufferMemory(device, buffer, memory, offset);
+			return vkBindBufferMemory(device, buffer, memory, allocation.offset + offset);
 		}
 
 		/**
@@ -114,6 +130,10 @@ namespace vks
 		*/
 		VkResult flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
 		{
+			if (allocation.allocator)
+			{
+				return allocation.allocator->flush(allocation, size, offset);
+			}
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
@@ -134,6 +154,10 @@ namespace vks
 		*/
 		VkResult invalidate(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
 		{
+			if (allocation.allocator)
+			{
+				return allocation.allocator->invalidate(allocation, size, offset);
+			}
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
 			mappedRange.memory = memory;
@@ -151,10 +175,17 @@ namespace vks
 			{
 				vkDestroyBuffer(device, buffer, nullptr);
 			}
-			if (memory)
+			if (allocation.allocator)
+			{
+				allocation.allocator->free(allocation);
+			}
+			else if (memory)
 			{
 				vkFreeMemory(device, memory, nullptr);
 			}
+			buffer = VK_NULL_HANDLE;
+			memory = VK_NULL_HANDLE;
+			mapped = nullptr;
 		}
 
 	};
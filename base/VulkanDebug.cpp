@@ -93,6 +93,8 @@ namespace vks
 	namespace debugmarker
 	{
 		bool active = false;
+		std::function<void(VkCommandBuffer, const char*)> beginRegionCallback;
+		std::function<void(VkCommandBuffer)> endRegionCallback;
 
 		PFN_vkDebugMarkerSetObjectTagEXT pfnDebugMarkerSetObjectTag = VK_NULL_HANDLE;
 		PFN_vkDebugMarkerSetObjectNameEXT pfnDebugMarkerSetObjectName = VK_NULL_HANDLE;
@@ -153,6 +155,10 @@ namespace vks
 				markerInfo.pMarkerName = pMarkerName;
 				pfnCmdDebugMarkerBegin(cmdbuffer, &markerInfo);
 			}
+			if (beginRegionCallback)
+			{
+				beginRegionCallback(cmdbuffer, pMarkerName);
+			}
 		}
 
 		void insert(VkCommandBuffer cmdbuffer, std::string markerName, glm::vec4 color)
@@ -171,6 +177,10 @@ namespace vks
 		void endRegion(VkCommandBuffer cmdBuffer)
 		{
 			// Check for valid function (may not be present if not runnin in a debugging application)
+			if (endRegionCallback)
+			{
+				endRegionCallback(cmdBuffer);
+			}
 			if (pfnCmdDebugMarkerEnd)
 			{
 				pfnCmdDebugMarkerEnd(cmdBuffer);
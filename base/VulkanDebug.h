@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <vector>
 #include <sstream>
+#include <functional>
 #ifdef _WIN32
 #include <windows.h>
 #include <fcntl.h>
@@ -61,6 +62,11 @@ namespace vks
 		// Set to true if function pointer for the debug marker are available
 		extern bool active;
 
+		// Optional functions called by beginRegion and endRegion, independent of the extension being present
+		// Used to attach additional work to the marker regions (e.g. timestamps for the GPU profiler)
+		extern std::function<void(VkCommandBuffer, const char*)> beginRegionCallback;
+		extern std::function<void(VkCommandBuffer)> endRegionCallback;
+
 		// Get function pointers for the debug report extensions from the device
 		void setup(VkDevice device);
 
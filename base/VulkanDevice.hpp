@@ -16,9 +16,12 @@
 #include "vulkan/vulkan.h"
 #include "VulkanTools.h"
 #include "VulkanBuffer.hpp"
+#include "VulkanMemoryAllocator.hpp"
 
 namespace vks
 {	
+	class UploadManager;
+
 	struct VulkanDevice
 	{
 		/** @brief Physical device representation */
@@ -40,6 +43,10 @@ namespace vks
 
 		/** @brief Default command pool for the graphics queue family index */
 		VkCommandPool commandPool = VK_NULL_HANDLE;
+		/** @brief Places buffers and textures in shared blocks of device memory, available once the logical device has been created */
+		vks::DeviceMemoryAllocator memoryAllocator;
+		/** @brief (Optional) Batches texture uploads on the transfer queue, if not set each texture is uploaded with a staging buffer of its own */
+		vks::UploadManager *uploadManager = nullptr;
 
 		/** @brief Set to true when the debug marker extension is detected */
 		bool enableDebugMarkers = false;
@@ -106,6 +113,7 @@ namespace vks
 			{
 				vkDestroyCommandPool(logicalDevice, commandPool, nullptr);
 			}
+			memoryAllocator.destroy();
 			if (logicalDevice)
 			{
 				vkDestroyDevice(logicalDevice, nullptr);
@@ -328,6 +336,7 @@ namespace vks
 			{
 				// Create a default command pool for graphics command buffers
 				commandPool = createCommandPool(queueFamilyIndices.graphics);
+				memoryAllocator.prepare(physicalDevice, logicalDevice);
 			}
 
 			this->enabledFeatures = enabledFeatures;
@@ -346,6 +355,8 @@ namespace vks
 		* @param data Pointer to the data that should be copied to the buffer after creation (optional, if not set, no data is copied over)
 		*
 		* @return VK_SUCCESS if buffer handle and memory have been created and (optionally passed) data has been copied
+		*
+		* @note The memory is allocated for this buffer alone and has to be freed by the caller, vks::Buffer objects share blocks of memory instead
 		*/
 		VkResult createBuffer(VkBufferUsageFlags usageFlags, VkMemoryPropertyFlags memoryPropertyFlags, VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory, void *data = nullptr)
 		{
@@ -406,14 +417,11 @@ namespace vks
 			VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(usageFlags, size);
 			VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferCreateInfo, nullptr, &buffer->buffer));
 
-			// Create the memory backing up the buffer handle
+			// Place the buffer in a block of memory shared with other resources
 			VkMemoryRequirements memReqs;
-			VkMemoryAllocateInfo memAlloc = vks::initializers::memoryAllocateInfo();
 			vkGetBufferMemoryRequirements(logicalDevice, buffer->buffer, &memReqs);
-			memAlloc.allocationSize = memReqs.size;
-			// Find a memory type index that fits the properties of the buffer
-			memAlloc.memoryTypeIndex = getMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags);
-			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, &buffer->memory));
+			VK_CHECK_RESULT(memoryAllocator.allocate(memReqs, memoryPropertyFlags, false, &buffer->allocation));
+			buffer->memory = buffer->allocation.memory;
 
 			buffer->alignment = memReqs.alignment;
 			buffer->size = size;
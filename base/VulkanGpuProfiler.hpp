@@ -0,0 +1,405 @@
+/*
+* GPU profiler
+*
+* Measures the GPU time of named scopes recorded into command buffers using timestamp queries
+* Results are read back without waiting, once the frame that submitted a command buffer has finished on the GPU
+* Command buffers that are reused by another frame before that (e.g. per swap chain image) are read back right before they are recorded or submitted again
+* GPU timestamps are converted to the time base of the CPU profiler, so both can be shown in one trace
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <iostream>
+#include <limits>
+#include <algorithm>
+#include <mutex>
+#include "vulkan/vulkan.h"
+#include "VulkanDevice.hpp"
+#include "VulkanTools.h"
+#include "cpuprofiler.hpp"
+
+namespace vks
+{
+	class GpuProfiler
+	{
+	public:
+		/** @brief A single execution of a scope on the GPU */
+		struct Event
+		{
+			std::string name;
+			uint32_t queueFamily;
+			uint32_t depth;
+			uint64_t frame;
+			// Relative to the CPU profiler's epoch, in milliseconds
+			double start;
+			double end;
+		};
+
+		/** @brief Accumulated GPU times of all executions of a scope, in milliseconds */
+		struct ScopeStatistics
+		{
+			uint32_t count = 0;
+			double total = 0.0;
+			double min = std::numeric_limits<double>::max();
+			double max = 0.0;
+		};
+
+	private:
+		struct Scope
+		{
+			std::string name;
+			uint32_t depth;
+		};
+
+		// Query range and scopes recorded into a single command buffer
+		struct CommandBufferQueries
+		{
+			uint32_t firstQuery;
+			uint32_t queueFamily;
+			// Scopes in the order they were begun, scope i uses queries firstQuery + 2 * i and firstQuery + 2 * i + 1
+			std::vector<Scope> scopes;
+			// Indices of the scopes that have been begun but not ended yet
+			std::vector<uint32_t> openScopes;
+			// Frame in flight whose results haven't been read back yet
+			uint32_t pendingFrame = notPending;
+		};
+
+		// GPU time of a frame in flight, summed up from its command buffers as they are read back
+		struct FrameTime
+		{
+			double time = 0.0;
+			bool valid = false;
+		};
+
+		static const uint32_t notPending = UINT32_MAX;
+
+		vks::VulkanDevice *vulkanDevice = nullptr;
+		VkQueryPool queryPool = VK_NULL_HANDLE;
+		std::unordered_map<VkCommandBuffer, CommandBufferQueries> commandBuffers;
+		// Query ranges of command buffers that have been removed
+		std::vector<uint32_t> freeQueryRanges;
+		uint32_t nextQueryRange = 0;
+		// Command buffers submitted by each frame in flight and the number of that frame
+		std::vector<std::vector<VkCommandBuffer>> submittedCommandBuffers;
+		std::vector<uint64_t> submittedFrames;
+		std::vector<FrameTime> submittedFrameTimes;
+		uint64_t frameCounter = 0;
+		// Frames with a lower number were submitted before the statistics were reset, their results are discarded
+		uint64_t resetFrame = 0;
+		std::vector<uint64_t> results;
+		// Command buffers are recorded and submitted from multiple threads (e.g. by the nodes of a frame graph)
+		std::mutex mutex;
+		// GPU timestamp and CPU profiler time (in nanoseconds) taken at about the same moment, used to convert between both time bases
+		uint64_t calibrationTimestamp = 0;
+		uint64_t calibrationCpuTime = 0;
+
+		/** @brief Write a single timestamp on the given queue and wait for it, to relate GPU timestamps to CPU time */
+		void calibrate(VkQueue queue)
+		{
+			VkCommandBuffer commandBuffer = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			vkCmdResetQueryPool(commandBuffer, queryPool, 0, 1);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, 0);
+			uint64_t cpuBefore = vks::cpuprofiler::now();
+			vulkanDevice->flushCommandBuffer(commandBuffer, queue);
+			uint64_t cpuAfter = vks::cpuprofiler::now();
+			VK_CHECK_RESULT(vkGetQueryPoolResults(vulkanDevice->logicalDevice, queryPool, 0, 1, sizeof(uint64_t), &calibrationTimestamp, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+			calibrationTimestamp &= timestampMask(vulkanDevice->queueFamilyIndices.graphics);
+			// The timestamp was written somewhere between submission and the fence wait returning, so the error is at most half of that round trip
+			calibrationCpuTime = cpuBefore + (cpuAfter - cpuBefore) / 2;
+		}
+
+		/** @brief Convert a GPU timestamp to milliseconds since the CPU profiler's epoch */
+		double toCpuTime(uint64_t timestamp) const
+		{
+			double period = vulkanDevice->properties.limits.timestampPeriod;
+			return ((double)calibrationCpuTime + ((double)timestamp - (double)calibrationTimestamp) * period) / 1000000.0;
+		}
+
+		uint64_t timestampMask(uint32_t queueFamily) const
+		{
+			uint32_t validBits = vulkanDevice->queueFamilyProperties[queueFamily].timestampValidBits;
+			return (validBits >= 64) ? ~0ULL : ((1ULL << validBits) - 1);
+		}
+
+		/** @brief Read back the results of a command buffer for the frame in flight that submitted it, the command buffer must no longer be executing */
+		void readBack(CommandBufferQueries &queries)
+		{
+			uint32_t frameIndex = queries.pendingFrame;
+			if (frameIndex == notPending) {
+				return;
+			}
+			queries.pendingFrame = notPending;
+			if (queries.scopes.empty() || (submittedFrames[frameIndex] < resetFrame)) {
+				return;
+			}
+			uint32_t queryCount = static_cast<uint32_t>(queries.scopes.size()) * 2;
+			// Each query returns its value followed by its availability
+			results.resize(queryCount * 2);
+			VkResult result = vkGetQueryPoolResults(vulkanDevice->logicalDevice, queryPool, queries.firstQuery, queryCount, results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+			if ((result != VK_SUCCESS) && (result != VK_NOT_READY)) {
+				return;
+			}
+			uint64_t mask = timestampMask(queries.queueFamily);
+			double period = vulkanDevice->properties.limits.timestampPeriod;
+			FrameTime &frameTime = submittedFrameTimes[frameIndex];
+			for (size_t i = 0; i < queries.scopes.size(); i++) {
+				uint64_t begin = results[i * 4] & mask;
+				uint64_t end = results[i * 4 + 2] & mask;
+				bool available = (results[i * 4 + 1] != 0) && (results[i * 4 + 3] != 0);
+				if (!available || (end < begin)) {
+					continue;
+				}
+				double duration = (double)(end - begin) * period / 1000000.0;
+				if (queries.scopes[i].depth == 0) {
+					frameTime.time += duration;
+					frameTime.valid = true;
+				}
+				ScopeStatistics &scopeStatistics = statistics[queries.scopes[i].name];
+				scopeStatistics.count++;
+				scopeStatistics.total += duration;
+				scopeStatistics.min = std::min(scopeStatistics.min, duration);
+				scopeStatistics.max = std::max(scopeStatistics.max, duration);
+				if (events.size() < maxEvents) {
+					Event event;
+					event.name = queries.scopes[i].name;
+					event.queueFamily = queries.queueFamily;
+					event.depth = queries.scopes[i].depth;
+					event.frame = submittedFrames[frameIndex];
+					event.start = toCpuTime(begin);
+					event.end = toCpuTime(end);
+					events.push_back(event);
+				}
+			}
+		}
+
+	public:
+		bool enabled = false;
+		/** @brief Number of scopes that can be recorded into a single command buffer */
+		uint32_t maxScopesPerCommandBuffer = 32;
+		/** @brief Number of command buffers that can contain scopes at the same time */
+		uint32_t maxCommandBuffers = 32;
+		/** @brief Upper limit for the number of events kept for the trace export */
+		size_t maxEvents = 1 << 20;
+
+		std::vector<Event> events;
+		std::map<std::string, ScopeStatistics> statistics;
+		/** @brief GPU time of each frame that has been read back, the sum of its outermost scopes in milliseconds */
+		std::vector<double> frameTimes;
+
+		/**
+		* Create the query pool and per-frame data
+		*
+		* @param vulkanDevice Device the profiled command buffers are executed on
+		* @param queue Graphics queue used to relate GPU timestamps to CPU time (timestamps of all queues of a device share the same time base)
+		* @param framesInFlight Number of frames that may be in flight, results are collected per frame
+		*/
+		void prepare(vks::VulkanDevice *vulkanDevice, VkQueue queue, uint32_t framesInFlight)
+		{
+			this->vulkanDevice = vulkanDevice;
+			if (!enabled) {
+				return;
+			}
+			if (vulkanDevice->properties.limits.timestampPeriod == 0.0f) {
+				std::cerr << "GPU profiler: device does not support timestamp queries, profiling is disabled" << std::endl;
+				enabled = false;
+				return;
+			}
+			VkQueryPoolCreateInfo queryPoolInfo = {};
+			queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+			queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+			queryPoolInfo.queryCount = maxCommandBuffers * maxScopesPerCommandBuffer * 2;
+			VK_CHECK_RESULT(vkCreateQueryPool(vulkanDevice->logicalDevice, &queryPoolInfo, nullptr, &queryPool));
+			submittedCommandBuffers.resize(framesInFlight);
+			submittedFrames.resize(framesInFlight);
+			submittedFrameTimes.resize(framesInFlight);
+			calibrate(queue);
+		}
+
+		void destroy()
+		{
+			if (queryPool != VK_NULL_HANDLE) {
+				vkDestroyQueryPool(vulkanDevice->logicalDevice, queryPool, nullptr);
+				queryPool = VK_NULL_HANDLE;
+			}
+		}
+
+		/**
+		* Prepare a command buffer for recording scopes, must be called right after vkBeginCommandBuffer (outside of a render pass)
+		* Results of an earlier submission that haven't been read back yet are read back first, as recording replaces its scopes
+		*
+		* @param commandBuffer Command buffer that is being recorded
+		* @param queueFamily Queue family the command buffer will be submitted to
+		*/
+		void beginCommandBuffer(VkCommandBuffer commandBuffer, uint32_t queueFamily)
+		{
+			if (!enabled) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = commandBuffers.find(commandBuffer);
+			if (it == commandBuffers.end()) {
+				if (vulkanDevice->queueFamilyProperties[queueFamily].timestampValidBits == 0) {
+					return;
+				}
+				uint32_t queryRange;
+				if (!freeQueryRanges.empty()) {
+					queryRange = freeQueryRanges.back();
+					freeQueryRanges.pop_back();
+				} else if (nextQueryRange < maxCommandBuffers) {
+					queryRange = nextQueryRange++;
+				} else {
+					// Out of queries, this command buffer won't be profiled
+					return;
+				}
+				CommandBufferQueries queries;
+				queries.firstQuery = queryRange * maxScopesPerCommandBuffer * 2;
+				queries.queueFamily = queueFamily;
+				it = commandBuffers.insert(std::make_pair(commandBuffer, queries)).first;
+			}
+			readBack(it->second);
+			it->second.scopes.clear();
+			it->second.openScopes.clear();
+			// Queries need to be reset before each use, the reset is part of the command buffer so it's executed with every submission
+			vkCmdResetQueryPool(commandBuffer, queryPool, it->second.firstQuery, maxScopesPerCommandBuffer * 2);
+		}
+
+		/** @brief Begin a named scope, scopes can be nested */
+		void beginScope(VkCommandBuffer commandBuffer, const char *name)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = commandBuffers.find(commandBuffer);
+			if (it == commandBuffers.end() || (it->second.scopes.size() >= maxScopesPerCommandBuffer)) {
+				return;
+			}
+			CommandBufferQueries &queries = it->second;
+			uint32_t scopeIndex = static_cast<uint32_t>(queries.scopes.size());
+			queries.scopes.push_back({ name, static_cast<uint32_t>(queries.openScopes.size()) });
+			queries.openScopes.push_back(scopeIndex);
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, queries.firstQuery + scopeIndex * 2);
+		}
+
+		/** @brief End the innermost open scope */
+		void endScope(VkCommandBuffer commandBuffer)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = commandBuffers.find(commandBuffer);
+			if (it == commandBuffers.end() || it->second.openScopes.empty()) {
+				return;
+			}
+			CommandBufferQueries &queries = it->second;
+			uint32_t scopeIndex = queries.openScopes.back();
+			queries.openScopes.pop_back();
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, queries.firstQuery + scopeIndex * 2 + 1);
+		}
+
+		/** @brief Read back the results of command buffers that are about to be freed and release their queries */
+		void removeCommandBuffers(const std::vector<VkCommandBuffer> &commandBuffersToRemove)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto commandBuffer : commandBuffersToRemove) {
+				auto it = commandBuffers.find(commandBuffer);
+				if (it != commandBuffers.end()) {
+					readBack(it->second);
+					freeQueryRanges.push_back(it->second.firstQuery / (maxScopesPerCommandBuffer * 2));
+					commandBuffers.erase(it);
+				}
+				for (auto &submitted : submittedCommandBuffers) {
+					submitted.erase(std::remove(submitted.begin(), submitted.end(), commandBuffer), submitted.end());
+				}
+			}
+		}
+
+		/**
+		* Read back the results of the command buffers submitted by a frame in flight, and start a new frame with its slot
+		*
+		* @note Must only be called once the frame's fence has been signaled, results that aren't available (yet) are skipped instead of waited for
+		*/
+		void beginFrame(uint32_t frameIndex)
+		{
+			if (!enabled) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto commandBuffer : submittedCommandBuffers[frameIndex]) {
+				auto it = commandBuffers.find(commandBuffer);
+				// Skips command buffers that have already been read back because they were reused by another frame
+				if ((it != commandBuffers.end()) && (it->second.pendingFrame == frameIndex)) {
+					readBack(it->second);
+				}
+			}
+			if (submittedFrameTimes[frameIndex].valid) {
+				frameTimes.push_back(submittedFrameTimes[frameIndex].time);
+			}
+			submittedFrameTimes[frameIndex] = FrameTime();
+			submittedCommandBuffers[frameIndex].clear();
+			submittedFrames[frameIndex] = frameCounter++;
+		}
+
+		/**
+		* Register a command buffer submitted by the given frame in flight, so its results are read back once that frame has finished
+		*
+		* @note Must be called before the command buffer is passed to vkQueueSubmit, as results of an earlier submission by another frame that haven't been read back yet are read back here
+		*/
+		void submit(uint32_t frameIndex, VkCommandBuffer commandBuffer)
+		{
+			if (!enabled) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = commandBuffers.find(commandBuffer);
+			if (it == commandBuffers.end()) {
+				return;
+			}
+			// The command buffer can only be submitted again once its earlier submission has finished, so its results are available
+			readBack(it->second);
+			it->second.pendingFrame = frameIndex;
+			submittedCommandBuffers[frameIndex].push_back(commandBuffer);
+		}
+
+		/** @brief Discard all results gathered so far (e.g. after warming up), including those of frames still in flight */
+		void resetStatistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			resetFrame = frameCounter;
+			for (auto &frameTime : submittedFrameTimes) {
+				frameTime = FrameTime();
+			}
+			statistics.clear();
+			events.clear();
+			frameTimes.clear();
+		}
+
+		/**
+		* Write the events as Chrome trace events, each queue family is shown as a separate track of the "GPU" process
+		*
+		* @param trace Stream the events are appended to
+		* @param first True if no event has been written to the stream yet (events are comma separated), updated accordingly
+		*/
+		void writeTraceEvents(std::ostream &trace, bool &first)
+		{
+			const uint32_t pid = 1;
+			trace << (first ? "" : ",\n") << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"GPU\"}}";
+			first = false;
+			std::vector<uint32_t> queueFamilies;
+			for (auto &event : events) {
+				if (std::find(queueFamilies.begin(), queueFamilies.end(), event.queueFamily) == queueFamilies.end()) {
+					queueFamilies.push_back(event.queueFamily);
+				}
+			}
+			for (auto queueFamily : queueFamilies) {
+				trace << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << queueFamily << ",\"args\":{\"name\":\"Queue family " << queueFamily << "\"}}";
+			}
+			for (auto &event : events) {
+				// Timestamps are in microseconds
+				trace << ",\n{\"name\":\"" << vks::cpuprofiler::escapeJson(event.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << event.queueFamily
+					<< ",\"ts\":" << event.start * 1000.0 << ",\"dur\":" << (event.end - event.start) * 1000.0 << ",\"args\":{\"frame\":" << event.frame << "}}";
+			}
+		}
+	};
+}
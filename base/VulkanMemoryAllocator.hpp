@@ -0,0 +1,460 @@
+/*
+* Device memory sub-allocator
+*
+* Places buffers and images in large blocks of device memory instead of allocating memory for every single resource
+* vkAllocateMemory is slow and the number of allocations is limited by maxMemoryAllocationCount (as low as 4096 on some implementations)
+*
+* Blocks are split with a buddy allocator: every allocation occupies a power of two sized range that is aligned to its size,
+* so the (power of two) alignment requirements of buffers and images are met without any padding
+* Linear resources (buffers, linear images) and optimal tiling images are placed in separate blocks, so they can never
+* share a page of bufferImageGranularity size
+* Allocations larger than half a block (e.g. big images) get memory of their own
+* Host visible blocks are mapped once when they're allocated, as memory can't be mapped multiple times
+*
+* The placement (BuddyAllocator) doesn't call Vulkan at all, and the memory allocator only needs a physical and logical device,
+* so both can be tested in isolation, e.g. against a software implementation like lavapipe (see tests/)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cassert>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+namespace vks
+{
+	/** @brief Buddy allocator placing power of two sized ranges in a power of two sized space */
+	class BuddyAllocator
+	{
+	private:
+		uint64_t size = 0;
+		uint64_t minNodeSize = 0;
+		// Offsets of the free nodes per order, a node of order n has a size of minNodeSize << n
+		std::vector<std::set<uint64_t>> freeNodes;
+		// Order of every allocated node by its offset
+		std::unordered_map<uint64_t, uint32_t> allocatedNodes;
+		uint64_t usedSize = 0;
+
+		uint32_t getOrder(uint64_t nodeSize) const
+		{
+			uint32_t order = 0;
+			while ((minNodeSize << order) < nodeSize) {
+				order++;
+			}
+			return order;
+		}
+
+	public:
+		/**
+		* Reset the allocator to a single free node
+		*
+		* @param size Size of the space to place ranges in, must be a power of two
+		* @param minNodeSize Size of the smallest range handed out, must be a power of two
+		*/
+		void init(uint64_t size, uint64_t minNodeSize)
+		{
+			assert((size > 0) && ((size & (size - 1)) == 0) && "Size must be a power of two");
+			assert((minNodeSize > 0) && ((minNodeSize & (minNodeSize - 1)) == 0) && (minNodeSize <= size) && "Minimum node size must be a power of two not larger than the size");
+			this->size = size;
+			this->minNodeSize = minNodeSize;
+			freeNodes.assign(getOrder(size) + 1, std::set<uint64_t>());
+			freeNodes.back().insert(0);
+			allocatedNodes.clear();
+			usedSize = 0;
+		}
+
+		/**
+		* Place a range
+		*
+		* @param requestedSize Number of bytes required
+		* @param alignment Required alignment of the offset, must be a power of two
+		* @param offset Receives the offset of the range
+		* @param nodeSize (Optional) Receives the size of the range actually reserved
+		*
+		* @return False if there is no free range that is large enough
+		*/
+		bool allocate(uint64_t requestedSize, uint64_t alignment, uint64_t *offset, uint64_t *nodeSize = nullptr)
+		{
+			// Nodes are aligned to their size, so a node at least as large as the alignment is always aligned
+			uint64_t requiredSize = std::max(std::max(requestedSize, alignment), minNodeSize);
+			if (requiredSize > size) {
+				return false;
+			}
+			uint32_t order = getOrder(requiredSize);
+			uint32_t freeOrder = order;
+			while ((freeOrder < freeNodes.size()) && freeNodes[freeOrder].empty()) {
+				freeOrder++;
+			}
+			if (freeOrder == freeNodes.size()) {
+				return false;
+			}
+			// Split the smallest free node that is large enough until it has the required size, keeping the upper halves free
+			uint64_t nodeOffset = *freeNodes[freeOrder].begin();
+			freeNodes[freeOrder].erase(freeNodes[freeOrder].begin());
+			while (freeOrder > order) {
+				freeOrder--;
+				freeNodes[freeOrder].insert(nodeOffset + (minNodeSize << freeOrder));
+			}
+			allocatedNodes[nodeOffset] = order;
+			usedSize += minNodeSize << order;
+			*offset = nodeOffset;
+			if (nodeSize) {
+				*nodeSize = minNodeSize << order;
+			}
+			return true;
+		}
+
+		/** @brief Release a range, merging it with its buddy as long as that is free too */
+		void free(uint64_t offset)
+		{
+			auto node = allocatedNodes.find(offset);
+			assert((node != allocatedNodes.end()) && "Offset has not been allocated");
+			uint32_t order = node->second;
+			allocatedNodes.erase(node);
+			usedSize -= minNodeSize << order;
+			while (order + 1 < freeNodes.size()) {
+				uint64_t buddy = offset ^ (minNodeSize << order);
+				auto freeBuddy = freeNodes[order].find(buddy);
+				if (freeBuddy == freeNodes[order].end()) {
+					break;
+				}
+				freeNodes[order].erase(freeBuddy);
+				offset = std::min(offset, buddy);
+				order++;
+			}
+			freeNodes[order].insert(offset);
+		}
+
+		bool empty() const { return allocatedNodes.empty(); }
+		uint64_t getSize() const { return size; }
+		/** @brief Bytes reserved by allocated ranges, including the rounding to powers of two */
+		uint64_t getUsedSize() const { return usedSize; }
+		uint64_t getFreeSize() const { return size - usedSize; }
+		uint32_t getAllocationCount() const { return static_cast<uint32_t>(allocatedNodes.size()); }
+
+		/** @brief Size of the largest range that can currently be allocated */
+		uint64_t getLargestFreeSize() const
+		{
+			for (uint32_t order = static_cast<uint32_t>(freeNodes.size()); order > 0; order--) {
+				if (!freeNodes[order - 1].empty()) {
+					return minNodeSize << (order - 1);
+				}
+			}
+			return 0;
+		}
+	};
+
+	class DeviceMemoryAllocator;
+
+	/** @brief Block of device memory, either split into many allocations or holding a single dedicated one */
+	struct MemoryBlock
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t memoryTypeIndex = 0;
+		bool optimalImages = false;
+		bool dedicated = false;
+		// Persistent mapping of the whole block for host visible memory
+		void *mapped = nullptr;
+		BuddyAllocator placement;
+		// Sum of the requested sizes of the block's allocations, the difference to the used size is lost to rounding
+		VkDeviceSize requestedSize = 0;
+	};
+
+	/** @brief Range of device memory a resource is bound to */
+	struct Allocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		// Size of the reserved range, may be larger than requested
+		VkDeviceSize size = 0;
+		VkDeviceSize requestedSize = 0;
+		// Points to the start of the range if the memory is host visible
+		void *mapped = nullptr;
+		DeviceMemoryAllocator *allocator = nullptr;
+		MemoryBlock *block = nullptr;
+	};
+
+	class DeviceMemoryAllocator
+	{
+	public:
+		/** @brief Memory usage and fragmentation over all blocks */
+		struct Statistics
+		{
+			// Number of vkAllocateMemory allocations (blocks and dedicated allocations)
+			uint32_t deviceMemoryCount = 0;
+			uint32_t blockCount = 0;
+			uint32_t dedicatedCount = 0;
+			// Number of resources placed in blocks
+			uint32_t allocationCount = 0;
+			VkDeviceSize blockBytes = 0;
+			VkDeviceSize dedicatedBytes = 0;
+			VkDeviceSize requestedBytes = 0;
+			VkDeviceSize usedBytes = 0;
+			VkDeviceSize freeBytes = 0;
+			VkDeviceSize largestFreeBytes = 0;
+
+			/** @brief Share of the used bytes lost to rounding allocations up to powers of two */
+			float internalFragmentation() const
+			{
+				return (usedBytes > 0) ? 1.0f - (float)requestedBytes / (float)usedBytes : 0.0f;
+			}
+
+			/** @brief Share of the free bytes that can't be used for an allocation as large as all free bytes (0 = all free space is one range) */
+			float externalFragmentation() const
+			{
+				return (freeBytes > 0) ? 1.0f - (float)largestFreeBytes / (float)freeBytes : 0.0f;
+			}
+		};
+
+	private:
+		VkDevice device = VK_NULL_HANDLE;
+		VkPhysicalDeviceMemoryProperties memoryProperties;
+		VkDeviceSize nonCoherentAtomSize = 1;
+		VkDeviceSize preferredBlockSize = 0;
+		std::vector<std::unique_ptr<MemoryBlock>> blocks;
+		std::mutex mutex;
+
+		// Blocks are at most an eighth of small heaps, so a few of them don't exhaust the heap
+		VkDeviceSize getBlockSize(uint32_t memoryTypeIndex) const
+		{
+			VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+			VkDeviceSize blockSize = preferredBlockSize;
+			while ((blockSize > minNodeSize) && (blockSize > heapSize / 8)) {
+				blockSize /= 2;
+			}
+			return blockSize;
+		}
+
+		MemoryBlock *createBlock(VkDeviceSize size, uint32_t memoryTypeIndex, bool optimalImages, bool dedicated, VkResult *result)
+		{
+			VkMemoryAllocateInfo memAlloc = {};
+			memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			memAlloc.allocationSize = size;
+			memAlloc.memoryTypeIndex = memoryTypeIndex;
+			VkDeviceMemory memory;
+			*result = vkAllocateMemory(device, &memAlloc, nullptr, &memory);
+			if (*result != VK_SUCCESS) {
+				return nullptr;
+			}
+			std::unique_ptr<MemoryBlock> block(new MemoryBlock());
+			block->memory = memory;
+			block->size = size;
+			block->memoryTypeIndex = memoryTypeIndex;
+			block->optimalImages = optimalImages;
+			block->dedicated = dedicated;
+			if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+				VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &block->mapped));
+			}
+			if (!dedicated) {
+				block->placement.init(size, minNodeSize);
+			}
+			blocks.push_back(std::move(block));
+			return blocks.back().get();
+		}
+
+		void destroyBlock(MemoryBlock *block)
+		{
+			// Freeing memory implicitly unmaps it
+			vkFreeMemory(device, block->memory, nullptr);
+			blocks.erase(std::find_if(blocks.begin(), blocks.end(), [block](const std::unique_ptr<MemoryBlock> &b) { return b.get() == block; }));
+		}
+
+		VkResult flushOrInvalidate(const Allocation &allocation, VkDeviceSize size, VkDeviceSize offset, bool flush)
+		{
+			if (memoryProperties.memoryTypes[allocation.block->memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+				return VK_SUCCESS;
+			}
+			// Ranges of non coherent memory must be aligned to the atom size, allocations start and end at atom boundaries (or the end of the memory)
+			VkDeviceSize allocationEnd = allocation.offset + allocation.size;
+			VkDeviceSize begin = allocation.offset + offset;
+			VkDeviceSize end = (size == VK_WHOLE_SIZE) ? allocationEnd : begin + size;
+			begin = begin / nonCoherentAtomSize * nonCoherentAtomSize;
+			end = std::min((end + nonCoherentAtomSize - 1) / nonCoherentAtomSize * nonCoherentAtomSize, allocationEnd);
+			VkMappedMemoryRange mappedRange = {};
+			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			mappedRange.memory = allocation.memory;
+			mappedRange.offset = begin;
+			mappedRange.size = end - begin;
+			return flush ? vkFlushMappedMemoryRanges(device, 1, &mappedRange) : vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
+		}
+
+	public:
+		/** @brief Size of the smallest range handed out, at least the largest possible nonCoherentAtomSize */
+		static const VkDeviceSize minNodeSize = 256;
+
+		~DeviceMemoryAllocator()
+		{
+			destroy();
+		}
+
+		/**
+		* Prepare the allocator for a device, blocks are only allocated once they're needed
+		*
+		* @param preferredBlockSize (Optional) Size of the memory blocks, must be a power of two, smaller blocks are used for small heaps
+		*/
+		void prepare(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = 64 * 1024 * 1024)
+		{
+			assert(((preferredBlockSize & (preferredBlockSize - 1)) == 0) && (preferredBlockSize >= minNodeSize));
+			this->device = device;
+			this->preferredBlockSize = preferredBlockSize;
+			vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+			VkPhysicalDeviceProperties properties;
+			vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+			nonCoherentAtomSize = std::max(properties.limits.nonCoherentAtomSize, (VkDeviceSize)1);
+			assert(nonCoherentAtomSize <= minNodeSize);
+		}
+
+		/** @brief Free all blocks, all resources placed in them must have been destroyed */
+		void destroy()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto &block : blocks) {
+				vkFreeMemory(device, block->memory, nullptr);
+			}
+			blocks.clear();
+		}
+
+		/**
+		* Allocate memory for a resource
+		*
+		* @param memReqs Memory requirements of the buffer or image
+		* @param memoryPropertyFlags Properties the memory type must have
+		* @param optimalImage True for images with optimal tiling, false for buffers and linear images
+		* @param allocation Receives the memory and offset to bind the resource to
+		*
+		* @return VK_SUCCESS or the error of the memory allocation
+		*
+		* @throw Throws an exception if no memory type supports the requested properties
+		*/
+		VkResult allocate(const VkMemoryRequirements &memReqs, VkMemoryPropertyFlags memoryPropertyFlags, bool optimalImage, Allocation *allocation)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			uint32_t memoryTypeIndex = UINT32_MAX;
+			for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+				if ((memReqs.memoryTypeBits & (1u << i)) && ((memoryProperties.memoryTypes[i].propertyFlags & memoryPropertyFlags) == memoryPropertyFlags)) {
+					memoryTypeIndex = i;
+					break;
+				}
+			}
+			if (memoryTypeIndex == UINT32_MAX) {
+				throw std::runtime_error("Could not find a matching memory type");
+			}
+
+			*allocation = Allocation();
+			allocation->allocator = this;
+			allocation->requestedSize = memReqs.size;
+
+			VkResult result = VK_SUCCESS;
+			VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+			if (memReqs.size > blockSize / 2) {
+				// Large resources would leave most of a block unused
+				MemoryBlock *block = createBlock(memReqs.size, memoryTypeIndex, optimalImage, true, &result);
+				if (!block) {
+					return result;
+				}
+				block->requestedSize = memReqs.size;
+				allocation->block = block;
+				allocation->memory = block->memory;
+				allocation->size = memReqs.size;
+				allocation->mapped = block->mapped;
+				return VK_SUCCESS;
+			}
+
+			uint64_t offset = 0;
+			uint64_t nodeSize = 0;
+			MemoryBlock *target = nullptr;
+			for (auto &block : blocks) {
+				if (!block->dedicated && (block->memoryTypeIndex == memoryTypeIndex) && (block->optimalImages == optimalImage) && block->placement.allocate(memReqs.size, memReqs.alignment, &offset, &nodeSize)) {
+					target = block.get();
+					break;
+				}
+			}
+			if (!target) {
+				target = createBlock(blockSize, memoryTypeIndex, optimalImage, false, &result);
+				if (!target) {
+					return result;
+				}
+				bool placed = target->placement.allocate(memReqs.size, memReqs.alignment, &offset, &nodeSize);
+				assert(placed);
+			}
+			target->requestedSize += memReqs.size;
+			allocation->block = target;
+			allocation->memory = target->memory;
+			allocation->offset = offset;
+			allocation->size = nodeSize;
+			allocation->mapped = target->mapped ? static_cast<uint8_t*>(target->mapped) + offset : nullptr;
+			return VK_SUCCESS;
+		}
+
+		/** @brief Release an allocation, the resource bound to it must not be in use anymore */
+		void free(Allocation &allocation)
+		{
+			if (!allocation.block) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			MemoryBlock *block = allocation.block;
+			if (block->dedicated) {
+				destroyBlock(block);
+			} else {
+				block->placement.free(allocation.offset);
+				block->requestedSize -= allocation.requestedSize;
+				// Keep one block per memory type and tiling, so freeing and allocating a resource doesn't allocate device memory every time
+				if (block->placement.empty()) {
+					for (auto &other : blocks) {
+						if ((other.get() != block) && !other->dedicated && (other->memoryTypeIndex == block->memoryTypeIndex) && (other->optimalImages == block->optimalImages)) {
+							destroyBlock(block);
+							break;
+						}
+					}
+				}
+			}
+			allocation = Allocation();
+		}
+
+		/** @brief Make host writes to a range of a host visible allocation visible to the device (no-op for coherent memory) */
+		VkResult flush(const Allocation &allocation, VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
+		{
+			return flushOrInvalidate(allocation, size, offset, true);
+		}
+
+		/** @brief Make device writes to a range of a host visible allocation visible to the host (no-op for coherent memory) */
+		VkResult invalidate(const Allocation &allocation, VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0)
+		{
+			return flushOrInvalidate(allocation, size, offset, false);
+		}
+
+		Statistics getStatistics()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Statistics statistics;
+			for (auto &block : blocks) {
+				statistics.deviceMemoryCount++;
+				if (block->dedicated) {
+					statistics.dedicatedCount++;
+					statistics.dedicatedBytes += block->size;
+					continue;
+				}
+				statistics.blockCount++;
+				statistics.blockBytes += block->size;
+				statistics.allocationCount += block->placement.getAllocationCount();
+				statistics.requestedBytes += block->requestedSize;
+				statistics.usedBytes += block->placement.getUsedSize();
+				statistics.freeBytes += block->placement.getFreeSize();
+				statistics.largestFreeBytes = std::max(statistics.largestFreeBytes, (VkDeviceSize)block->placement.getLargestFreeSize());
+			}
+			return statistics;
+		}
+	};
+}
@@ -0,0 +1,140 @@
+/*
+* Parallel secondary command buffer recording
+*
+* Records secondary command buffers on the threads of a task scheduler, they are then executed from a primary command buffer (vkCmdExecuteCommands)
+* Command pools must not be used by multiple threads at the same time, so every thread records into command buffers of its own pool
+* There is one set of pools per slot (e.g. per frame in flight), resetting a slot's pools recycles all of its command buffers at once
+* Command buffers are allocated on first use and reused after each reset
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "taskscheduler.hpp"
+
+namespace vks
+{
+	class ParallelCommandRecorder
+	{
+	private:
+		struct ThreadCommandPool
+		{
+			VkCommandPool commandPool = VK_NULL_HANDLE;
+			std::vector<VkCommandBuffer> commandBuffers;
+			// Command buffers handed out since the last reset
+			uint32_t used = 0;
+		};
+
+		VkDevice device = VK_NULL_HANDLE;
+		uint32_t threadCount = 0;
+		// Pools of slot s are at s * threadCount .. (s + 1) * threadCount - 1, only the thread with the matching index uses a pool
+		std::vector<ThreadCommandPool> pools;
+
+		VkCommandBuffer acquire(uint32_t slot, uint32_t thread)
+		{
+			ThreadCommandPool &pool = pools[slot * threadCount + thread];
+			if (pool.used == pool.commandBuffers.size()) {
+				VkCommandBufferAllocateInfo allocateInfo = {};
+				allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+				allocateInfo.commandPool = pool.commandPool;
+				allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+				allocateInfo.commandBufferCount = 1;
+				VkCommandBuffer commandBuffer;
+				VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocateInfo, &commandBuffer));
+				pool.commandBuffers.push_back(commandBuffer);
+			}
+			return pool.commandBuffers[pool.used++];
+		}
+
+	public:
+		/**
+		* Create the command pools
+		*
+		* @param queueFamilyIndex Queue family of the primary command buffers the secondary ones are executed in
+		* @param slotCount Number of sets of command buffers that can be in use at the same time, e.g. the number of frames in flight
+		* @param threadCount Number of threads recording, at least the thread count of the scheduler passed to record
+		*/
+		void prepare(VkDevice device, uint32_t queueFamilyIndex, uint32_t slotCount, uint32_t threadCount)
+		{
+			this->device = device;
+			this->threadCount = threadCount;
+			pools.resize(slotCount * threadCount);
+			VkCommandPoolCreateInfo commandPoolInfo = {};
+			commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			commandPoolInfo.queueFamilyIndex = queueFamilyIndex;
+			// Command buffers are only reset as a whole with their pool
+			commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			for (auto &pool : pools) {
+				VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolInfo, nullptr, &pool.commandPool));
+			}
+		}
+
+		void destroy()
+		{
+			for (auto &pool : pools) {
+				vkDestroyCommandPool(device, pool.commandPool, nullptr);
+			}
+			pools.clear();
+		}
+
+		/** @brief Recycle all command buffers of a slot, none of them may be in use by the GPU (e.g. after waiting on the frame's fence) */
+		void reset(uint32_t slot)
+		{
+			for (uint32_t thread = 0; thread < threadCount; thread++) {
+				ThreadCommandPool &pool = pools[slot * threadCount + thread];
+				if (pool.used > 0) {
+					VK_CHECK_RESULT(vkResetCommandPool(device, pool.commandPool, 0));
+					pool.used = 0;
+				}
+			}
+		}
+
+		/**
+		* Record secondary command buffers in parallel, returns once all of them have been recorded
+		*
+		* @param slot Slot the command buffers are taken from, they stay valid until the slot is reset
+		* @param inheritanceInfo Render pass state the command buffers are executed in, renderPass may be VK_NULL_HANDLE for command buffers executed outside of a render pass
+		* @param count Number of command buffers to record
+		* @param function Called as function(commandBuffer, index) for every index below count on any of the scheduler's threads, the command buffer has already been begun
+		* @param commandBuffers Receives the recorded command buffers in index order, to be passed to vkCmdExecuteCommands
+		*
+		* @note Debug marker regions are forwarded to the (not thread safe) GPU profiler, so they should be recorded into the primary command buffer
+		*/
+		template<typename F>
+		void record(TaskScheduler &scheduler, uint32_t slot, const VkCommandBufferInheritanceInfo &inheritanceInfo, uint32_t count, const F &function, std::vector<VkCommandBuffer> &commandBuffers)
+		{
+			assert((scheduler.getThreadCount() <= threadCount) && "Recorder has fewer pools than the scheduler has threads");
+			commandBuffers.resize(count);
+			VkCommandBufferBeginInfo beginInfo = {};
+			beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			beginInfo.flags = (inheritanceInfo.renderPass != VK_NULL_HANDLE) ? VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT : 0;
+			beginInfo.pInheritanceInfo = &inheritanceInfo;
+			// Each command buffer is a job of its own, as their recording costs may differ a lot
+			scheduler.parallelFor(count, [&](uint32_t first, uint32_t last) {
+				uint32_t thread = scheduler.getCurrentThreadIndex();
+				for (uint32_t i = first; i < last; i++) {
+					VkCommandBuffer commandBuffer = acquire(slot, thread);
+					VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+					function(commandBuffer, i);
+					VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+					commandBuffers[i] = commandBuffer;
+				}
+			}, 1);
+		}
+
+		/** @brief Number of secondary command buffers allocated so far, over all slots and threads */
+		uint32_t getAllocatedCount() const
+		{
+			uint32_t count = 0;
+			for (auto &pool : pools) {
+				count += static_cast<uint32_t>(pool.commandBuffers.size());
+			}
+			return count;
+		}
+	};
+}
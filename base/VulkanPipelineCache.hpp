@@ -0,0 +1,192 @@
+/*
+* Persistent pipeline cache
+*
+* Stores the contents of a VkPipelineCache on disk so pipelines don't need to be recompiled by the driver on every run
+* The data is prefixed with a header that ties it to the device and driver it was created with
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace vks
+{
+	namespace pipelinecache
+	{
+		enum LoadResult {
+			Loaded,
+			NotFound,
+			// Created with a different device or driver (version)
+			Mismatch,
+			// Truncated or corrupted data
+			Invalid
+		};
+
+		/** @brief Header written in front of the driver's pipeline cache data, has no padding so every byte written to the file is initialized */
+		struct FileHeader
+		{
+			uint32_t magic;
+			uint32_t version;
+			uint32_t vendorID;
+			uint32_t deviceID;
+			// The driver version is not part of the Vulkan pipeline cache header, but a driver update may change the compiled code
+			uint32_t driverVersion;
+			// Keeps the 64 bit members aligned without implicit padding, always zero
+			uint32_t reserved;
+			uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+			uint64_t dataSize;
+			uint64_t dataHash;
+		};
+		static_assert(sizeof(FileHeader) == 6 * sizeof(uint32_t) + VK_UUID_SIZE + 2 * sizeof(uint64_t), "FileHeader must not contain padding");
+
+		/** @brief Header the driver puts in front of its pipeline cache data (VkPipelineCacheHeaderVersionOne in newer Vulkan headers) */
+		struct DriverHeader
+		{
+			uint32_t headerSize;
+			uint32_t headerVersion;
+			uint32_t vendorID;
+			uint32_t deviceID;
+			uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		};
+
+		const uint32_t fileMagic = 0x43505356; // "VSPC"
+		// Version 2 added the reserved member, files written with the padded version 1 header are rejected
+		const uint32_t fileVersion = 2;
+
+		inline bool matchesDevice(const FileHeader &header, const VkPhysicalDeviceProperties &properties)
+		{
+			return (header.vendorID == properties.vendorID) &&
+				(header.deviceID == properties.deviceID) &&
+				(header.driverVersion == properties.driverVersion) &&
+				(memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0);
+		}
+
+		/**
+		* Load pipeline cache data previously stored with save
+		*
+		* @param filename Name of the cache file
+		* @param properties Properties of the physical device the cache will be created for
+		* @param data Receives the pipeline cache data to be passed to vkCreatePipelineCache (only if the result is Loaded)
+		*
+		* @return Loaded if the data can be used with the given device
+		*/
+		inline LoadResult load(const std::string &filename, const VkPhysicalDeviceProperties &properties, std::vector<char> &data)
+		{
+			std::ifstream is(filename, std::ios::binary | std::ios::in | std::ios::ate);
+			if (!is.is_open()) {
+				return NotFound;
+			}
+			size_t fileSize = (size_t)is.tellg();
+			if (fileSize < sizeof(FileHeader)) {
+				return Invalid;
+			}
+			is.seekg(0, std::ios::beg);
+			FileHeader header;
+			is.read((char*)&header, sizeof(FileHeader));
+			if (!is.good() || (header.magic != fileMagic) || (header.version != fileVersion) || (header.dataSize != fileSize - sizeof(FileHeader))) {
+				return Invalid;
+			}
+			if (!matchesDevice(header, properties)) {
+				return Mismatch;
+			}
+			std::vector<char> fileData((size_t)header.dataSize);
+			is.read(fileData.data(), fileData.size());
+			if (!is.good() || (vks::tools::hash(fileData.data(), fileData.size()) != header.dataHash)) {
+				return Invalid;
+			}
+			// Also check the header the driver puts in front of its data, it must match the device too
+			DriverHeader vkHeader;
+			if (fileData.size() < sizeof(vkHeader)) {
+				return Invalid;
+			}
+			memcpy(&vkHeader, fileData.data(), sizeof(vkHeader));
+			if ((vkHeader.headerVersion != (uint32_t)VK_PIPELINE_CACHE_HEADER_VERSION_ONE) ||
+				(vkHeader.vendorID != properties.vendorID) ||
+				(vkHeader.deviceID != properties.deviceID) ||
+				(memcmp(vkHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)) {
+				return Mismatch;
+			}
+			data.swap(fileData);
+			return Loaded;
+		}
+
+		/**
+		* Store the contents of a pipeline cache to disk
+		*
+		* The file is written to a temporary file that is then renamed, so the cache file is always replaced as a whole
+		* This makes it safe for several processes to load and save the same cache file at the same time
+		*
+		* @param filename Name of the cache file
+		* @param properties Properties of the physical device the cache has been created for
+		* @param device Logical device that owns the pipeline cache
+		* @param pipelineCache Pipeline cache to store
+		*
+		* @return True if the cache file has been written
+		*/
+		inline bool save(const std::string &filename, const VkPhysicalDeviceProperties &properties, VkDevice device, VkPipelineCache pipelineCache)
+		{
+			size_t dataSize = 0;
+			if ((vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS) || (dataSize == 0)) {
+				return false;
+			}
+			std::vector<char> data(dataSize);
+			if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+				return false;
+			}
+
+			FileHeader header = {};
+			header.magic = fileMagic;
+			header.version = fileVersion;
+			header.vendorID = properties.vendorID;
+			header.deviceID = properties.deviceID;
+			header.driverVersion = properties.driverVersion;
+			header.reserved = 0;
+			memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+			header.dataSize = dataSize;
+			header.dataHash = vks::tools::hash(data.data(), dataSize);
+
+			// The temporary file name is unique per process
+#if defined(_WIN32)
+			std::string tempFilename = filename + "." + std::to_string(_getpid()) + ".tmp";
+#else
+			std::string tempFilename = filename + "." + std::to_string(getpid()) + ".tmp";
+#endif
+			{
+				std::ofstream os(tempFilename, std::ios::binary | std::ios::out | std::ios::trunc);
+				if (!os.is_open()) {
+					return false;
+				}
+				os.write((const char*)&header, sizeof(FileHeader));
+				os.write(data.data(), dataSize);
+				os.close();
+				if (os.fail()) {
+					std::remove(tempFilename.c_str());
+					return false;
+				}
+			}
+#if defined(_WIN32)
+			bool renamed = MoveFileExA(tempFilename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+			bool renamed = std::rename(tempFilename.c_str(), filename.c_str()) == 0;
+#endif
+			if (!renamed) {
+				std::remove(tempFilename.c_str());
+			}
+			return renamed;
+		}
+	}
+}
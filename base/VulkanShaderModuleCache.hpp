@@ -0,0 +1,223 @@
+/*
+* Shader module cache
+*
+* Loads SPIR-V files through memory mapping and keeps the created shader modules, so each file is only read once
+* and identical SPIR-V (e.g. the same shader stored in several files) shares a single shader module
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <iostream>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__ANDROID__)
+#include <android/asset_manager.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace vks
+{
+	/**
+	* @brief Read-only view of a SPIR-V file mapped into memory
+	*/
+	class MappedShaderFile
+	{
+	private:
+#if defined(_WIN32)
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = NULL;
+#elif defined(__ANDROID__)
+		AAsset *asset = nullptr;
+#endif
+	public:
+		const void *data = nullptr;
+		size_t size = 0;
+
+#if defined(__ANDROID__)
+		MappedShaderFile(AAssetManager *assetManager, const std::string &fileName)
+		{
+			// Uncompressed assets are mapped directly from the apk
+			asset = AAssetManager_open(assetManager, fileName.c_str(), AASSET_MODE_BUFFER);
+			if (asset) {
+				data = AAsset_getBuffer(asset);
+				size = (size_t)AAsset_getLength(asset);
+			}
+		}
+#else
+		MappedShaderFile(const std::string &fileName)
+		{
+#if defined(_WIN32)
+			file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (file == INVALID_HANDLE_VALUE) {
+				return;
+			}
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart == 0)) {
+				return;
+			}
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping == NULL) {
+				return;
+			}
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			size = data ? (size_t)fileSize.QuadPart : 0;
+#else
+			int fd = open(fileName.c_str(), O_RDONLY);
+			if (fd < 0) {
+				return;
+			}
+			struct stat fileStat;
+			if ((fstat(fd, &fileStat) == 0) && (fileStat.st_size > 0)) {
+				void *mapped = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				if (mapped != MAP_FAILED) {
+					data = mapped;
+					size = (size_t)fileStat.st_size;
+				}
+			}
+			// The mapping stays valid after the descriptor has been closed
+			close(fd);
+#endif
+		}
+#endif
+
+		~MappedShaderFile()
+		{
+#if defined(_WIN32)
+			if (data) {
+				UnmapViewOfFile(data);
+			}
+			if (mapping != NULL) {
+				CloseHandle(mapping);
+			}
+			if (file != INVALID_HANDLE_VALUE) {
+				CloseHandle(file);
+			}
+#elif defined(__ANDROID__)
+			if (asset) {
+				AAsset_close(asset);
+			}
+#else
+			if (data) {
+				munmap((void*)data, size);
+			}
+#endif
+		}
+	};
+
+	/**
+	* @brief Creates shader modules from SPIR-V files and keeps them for reuse until destroyed
+	*
+	* @note Not thread safe, shader modules should be requested from a single thread
+	*/
+	class ShaderModuleCache
+	{
+	private:
+		VkDevice device = VK_NULL_HANDLE;
+		// Modules by file name, repeated requests for a file (e.g. when rebuilding pipelines) don't touch the file system
+		std::unordered_map<std::string, VkShaderModule> fileModules;
+		struct CodeModule
+		{
+			// Copy of the SPIR-V code, compared against files with the same hash as the mapped file is closed after loading
+			std::vector<uint32_t> code;
+			VkShaderModule module;
+		};
+		// Modules by hash of their SPIR-V code, files with identical contents share a module
+		std::unordered_multimap<uint64_t, CodeModule> codeModules;
+
+		VkShaderModule createModule(const MappedShaderFile &shaderFile)
+		{
+			uint64_t codeHash = vks::tools::hash(shaderFile.data, shaderFile.size);
+			// A matching hash doesn't guarantee identical code, so the code is compared as well
+			auto range = codeModules.equal_range(codeHash);
+			for (auto it = range.first; it != range.second; ++it) {
+				const std::vector<uint32_t> &code = it->second.code;
+				if ((code.size() * sizeof(uint32_t) == shaderFile.size) && (memcmp(code.data(), shaderFile.data, shaderFile.size) == 0)) {
+					deduplicatedCount++;
+					return it->second.module;
+				}
+			}
+			// The copy also provides the 4 byte alignment Vulkan expects, which the platform may not (e.g. compressed Android assets)
+			CodeModule codeModule;
+			codeModule.code.resize(shaderFile.size / sizeof(uint32_t));
+			memcpy(codeModule.code.data(), shaderFile.data, shaderFile.size);
+			VkShaderModuleCreateInfo moduleCreateInfo{};
+			moduleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+			moduleCreateInfo.codeSize = shaderFile.size;
+			moduleCreateInfo.pCode = codeModule.code.data();
+			VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleCreateInfo, nullptr, &codeModule.module));
+			VkShaderModule shaderModule = codeModule.module;
+			codeModules.insert(std::make_pair(codeHash, std::move(codeModule)));
+			return shaderModule;
+		}
+
+	public:
+		/** @brief Number of requests served without loading the file again */
+		uint32_t reusedCount = 0;
+		/** @brief Number of loaded files whose SPIR-V matched an existing module */
+		uint32_t deduplicatedCount = 0;
+
+		void setDevice(VkDevice device)
+		{
+			this->device = device;
+		}
+
+		/** @brief Number of distinct shader modules that have been created */
+		uint32_t getModuleCount() const
+		{
+			return static_cast<uint32_t>(codeModules.size());
+		}
+
+		/**
+		* Get the shader module for a SPIR-V file, loading the file if it has not been requested before
+		*
+		* @return Shader module owned by the cache or VK_NULL_HANDLE if the file could not be loaded
+		*/
+#if defined(__ANDROID__)
+		VkShaderModule get(AAssetManager *assetManager, const std::string &fileName)
+#else
+		VkShaderModule get(const std::string &fileName)
+#endif
+		{
+			auto cached = fileModules.find(fileName);
+			if (cached != fileModules.end()) {
+				reusedCount++;
+				return cached->second;
+			}
+#if defined(__ANDROID__)
+			MappedShaderFile shaderFile(assetManager, fileName);
+#else
+			MappedShaderFile shaderFile(fileName);
+#endif
+			if ((shaderFile.data == nullptr) || (shaderFile.size % 4 != 0)) {
+				std::cerr << "Error: Could not load SPIR-V shader file \"" << fileName << "\"" << std::endl;
+				return VK_NULL_HANDLE;
+			}
+			VkShaderModule shaderModule = createModule(shaderFile);
+			fileModules[fileName] = shaderModule;
+			return shaderModule;
+		}
+
+		/** @brief Destroy all shader modules owned by the cache */
+		void destroy()
+		{
+			for (auto& codeModule : codeModules) {
+				vkDestroyShaderModule(device, codeModule.second.module, nullptr);
+			}
+			codeModules.clear();
+			fileModules.clear();
+		}
+	};
+}
@@ -378,5 +378,16 @@ namespace vks
 			std::ifstream f(filename.c_str());
 			return !f.fail();
 		}
+
+		uint64_t hash(const void *data, size_t size)
+		{
+			const uint8_t *bytes = (const uint8_t*)data;
+			uint64_t value = 0xcbf29ce484222325ULL;
+			for (size_t i = 0; i < size; i++) {
+				value ^= bytes[i];
+				value *= 0x100000001b3ULL;
+			}
+			return value;
+		}
 	}
 }
\ No newline at end of file
@@ -125,5 +125,8 @@ namespace vks
 
 		/** @brief Checks if a file exists */
 		bool fileExists(const std::string &filename);
+
+		/** @brief 64 bit FNV-1a hash of a block of memory, used to identify file contents */
+		uint64_t hash(const void *data, size_t size);
 	}
 }
@@ -290,47 +290,163 @@ namespace vks
 	}
 
 	/** Update vertex and index buffer containing the imGui elements when required */
+	/**
+	* Set the number of slots of the geometry ring buffers and how many frames may be in flight at once
+	*
+	* @param slotCount Number of command buffers that may reference the overlay geometry at the same time (e.g. one per swap chain image)
+	* @param framesInFlight Maximum number of frames the GPU may be working on, replaced buffers are kept alive for that many updates
+	*
+	* @note If the slot count changes while buffers exist they are recreated, so the device must be idle
+	*/
+	void UIOverlay::setSlotCount(uint32_t slotCount, uint32_t framesInFlight)
+	{
+		this->framesInFlight = framesInFlight;
+		if ((slotCount == this->slotCount) && (slotGenerations.size() == slotCount)) {
+			return;
+		}
+		this->slotCount = slotCount;
+		slotGenerations.assign(slotCount, 0);
+		if (vertexBuffer.buffer != VK_NULL_HANDLE) {
+			releaseRetiredBuffers(true);
+			vertexBuffer.destroy();
+			indexBuffer.destroy();
+			createBuffers();
+		}
+	}
+
+	void UIOverlay::createBuffers()
+	{
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexBuffer, vertexSlotSize * slotCount));
+		VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &indexBuffer, indexSlotSize * slotCount));
+		// Buffers stay mapped for their whole lifetime
+		VK_CHECK_RESULT(vertexBuffer.map());
+		VK_CHECK_RESULT(indexBuffer.map());
+	}
+
+	// Replace a buffer with one that has at least twice the slot size, so a growing overlay only causes a logarithmic number of allocations
+	void UIOverlay::growBuffer(vks::Buffer &buffer, VkDeviceSize &slotSize, VkDeviceSize requiredSize, VkBufferUsageFlags usage)
+	{
+		const VkDeviceSize minSlotSize = 16 * 1024;
+		// Slot offsets must be aligned to the atom size for flushing single slots of the non coherent memory
+		const VkDeviceSize atomSize = device->properties.limits.nonCoherentAtomSize;
+		VkDeviceSize newSlotSize = std::max(std::max(slotSize * 2, requiredSize), minSlotSize);
+		newSlotSize = (newSlotSize + atomSize - 1) / atomSize * atomSize;
+		if (buffer.buffer != VK_NULL_HANDLE) {
+			// Frames in flight may still be reading from the old buffer, so it's only released after enough updates have passed
+			retiredBuffers.push_back({ buffer, framesInFlight + 1 });
+			buffer = vks::Buffer();
+		}
+		slotSize = newSlotSize;
+		VK_CHECK_RESULT(device->createBuffer(usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &buffer, slotSize * slotCount));
+		VK_CHECK_RESULT(buffer.map());
+		// None of the slots of the new buffer contain any data yet
+		std::fill(slotGenerations.begin(), slotGenerations.end(), 0);
+	}
+
+	void UIOverlay::releaseRetiredBuffers(bool all)
+	{
+		for (auto it = retiredBuffers.begin(); it != retiredBuffers.end();) {
+			if (all || (--it->updatesLeft == 0)) {
+				it->buffer.destroy();
+				it = retiredBuffers.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	/**
+	* Prepare the buffers for the current ImGui draw data, the data itself is written per slot by upload
+	*
+	* @return True if command buffers drawing the overlay need to be rebuilt (buffers have been replaced or the draw commands changed)
+	*
+	* @note Doesn't wait on the device, buffers that have been replaced are destroyed once no frame in flight can use them anymore
+	*/
 	bool UIOverlay::update()
 	{
 		ImDrawData* imDrawData = ImGui::GetDrawData();
 		bool updateCmdBuffers = false;
 
+		// Called once per frame at most, so after framesInFlight updates no frame can be using a retired buffer anymore
+		releaseRetiredBuffers(false);
+
 		if (!imDrawData) { return false; };
 
-		// Note: Alignment is done inside buffer creation
-		VkDeviceSize vertexBufferSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
-		VkDeviceSize indexBufferSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
+		VkDeviceSize vertexDataSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
+		VkDeviceSize indexDataSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
 
-		// Update buffers only if vertex or index count has been changed compared to current buffer size
-		if ((vertexBufferSize == 0) || (indexBufferSize == 0)) {
+		if ((vertexDataSize == 0) || (indexDataSize == 0)) {
 			return false;
 		}
 
-		// Vertex buffer
-		if ((vertexBuffer.buffer == VK_NULL_HANDLE) || (vertexCount != imDrawData->TotalVtxCount)) {
-			vertexBuffer.unmap();
-			vertexBuffer.destroy();
-			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &vertexBuffer, vertexBufferSize));
-			vertexCount = imDrawData->TotalVtxCount;
-			vertexBuffer.unmap();
-			vertexBuffer.map();
+		if (slotGenerations.size() != slotCount) {
+			slotGenerations.assign(slotCount, 0);
+		}
+
+		// Buffers only grow, so once they're large enough steady state updates don't allocate anything
+		if (vertexDataSize > vertexSlotSize) {
+			growBuffer(vertexBuffer, vertexSlotSize, vertexDataSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+			updateCmdBuffers = true;
+		}
+		if (indexDataSize > indexSlotSize) {
+			growBuffer(indexBuffer, indexSlotSize, indexDataSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 			updateCmdBuffers = true;
 		}
 
-		// Index buffer
-		VkDeviceSize indexSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
-		if ((indexBuffer.buffer == VK_NULL_HANDLE) || (indexCount < imDrawData->TotalIdxCount)) {
-			indexBuffer.unmap();
-			indexBuffer.destroy();
-			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &indexBuffer, indexBufferSize));
-			indexCount = imDrawData->TotalIdxCount;
-			indexBuffer.map();
+		// Command buffers contain the draw calls and scissors, but not the geometry, so they only need to be rebuilt if those change (FNV-1a)
+		uint64_t hash = 14695981039346656037ull;
+		auto hashValue = [&hash](uint64_t value) {
+			hash = (hash ^ value) * 1099511628211ull;
+		};
+		hashValue(imDrawData->CmdListsCount);
+		for (int32_t i = 0; i < imDrawData->CmdListsCount; i++) {
+			const ImDrawList* cmd_list = imDrawData->CmdLists[i];
+			hashValue(cmd_list->VtxBuffer.Size);
+			for (int32_t j = 0; j < cmd_list->CmdBuffer.Size; j++) {
+				const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[j];
+				hashValue(pcmd->ElemCount);
+				hashValue((int32_t)pcmd->ClipRect.x);
+				hashValue((int32_t)pcmd->ClipRect.y);
+				hashValue((int32_t)pcmd->ClipRect.z);
+				hashValue((int32_t)pcmd->ClipRect.w);
+			}
+		}
+		if (hash != layoutHash) {
+			layoutHash = hash;
 			updateCmdBuffers = true;
 		}
 
-		// Upload data
-		ImDrawVert* vtxDst = (ImDrawVert*)vertexBuffer.mapped;
-		ImDrawIdx* idxDst = (ImDrawIdx*)indexBuffer.mapped;
+		vertexCount = imDrawData->TotalVtxCount;
+		indexCount = imDrawData->TotalIdxCount;
+		dataGeneration++;
+
+		return updateCmdBuffers;
+	}
+
+	/**
+	* Write the current draw data to a slot of the ring buffers
+	*
+	* @param slot Slot of the command buffer about to be submitted, the GPU must have finished all earlier work using this slot (e.g. after waiting on the image's fence)
+	*/
+	void UIOverlay::upload(uint32_t slot)
+	{
+		ImDrawData* imDrawData = ImGui::GetDrawData();
+
+		if ((!imDrawData) || (vertexBuffer.mapped == nullptr) || (indexBuffer.mapped == nullptr)) {
+			return;
+		}
+		assert(slot < slotCount);
+		// Slot already contains the current data
+		if (slotGenerations[slot] == dataGeneration) {
+			return;
+		}
+		// Draw data changed without an update, the buffers may be too small
+		if ((imDrawData->TotalVtxCount != vertexCount) || (imDrawData->TotalIdxCount != indexCount)) {
+			return;
+		}
+
+		ImDrawVert* vtxDst = (ImDrawVert*)((uint8_t*)vertexBuffer.mapped + slot * vertexSlotSize);
+		ImDrawIdx* idxDst = (ImDrawIdx*)((uint8_t*)indexBuffer.mapped + slot * indexSlotSize);
 
 		for (int n = 0; n < imDrawData->CmdListsCount; n++) {
 			const ImDrawList* cmd_list = imDrawData->CmdLists[n];
@@ -340,22 +456,24 @@ namespace vks
 			idxDst += cmd_list->IdxBuffer.Size;
 		}
 
-		// Flush to make writes visible to GPU
-		vertexBuffer.flush();
-		indexBuffer.flush();
+		// Flush only this slot to make the writes visible to the GPU
+		VK_CHECK_RESULT(vertexBuffer.flush(vertexSlotSize, slot * vertexSlotSize));
+		VK_CHECK_RESULT(indexBuffer.flush(indexSlotSize, slot * indexSlotSize));
 
-		return updateCmdBuffers;
+		slotGenerations[slot] = dataGeneration;
 	}
 
-	void UIOverlay::draw(const VkCommandBuffer commandBuffer)
+	/** @brief Record the overlay's draw calls, reading the geometry from the given slot of the ring buffers */
+	void UIOverlay::draw(const VkCommandBuffer commandBuffer, uint32_t slot)
 	{
 		ImDrawData* imDrawData = ImGui::GetDrawData();
 		int32_t vertexOffset = 0;
 		int32_t indexOffset = 0;
 
-		if ((!imDrawData) || (imDrawData->CmdListsCount == 0)) {
+		if ((!imDrawData) || (imDrawData->CmdListsCount == 0) || (vertexBuffer.buffer == VK_NULL_HANDLE) || (indexBuffer.buffer == VK_NULL_HANDLE)) {
 			return;
 		}
+		assert(slot < slotCount);
 
 		ImGuiIO& io = ImGui::GetIO();
 
@@ -366,9 +484,9 @@ namespace vks
 		pushConstBlock.translate = glm::vec2(-1.0f);
 		vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstBlock), &pushConstBlock);
 
-		VkDeviceSize offsets[1] = { 0 };
+		VkDeviceSize offsets[1] = { slot * vertexSlotSize };
 		vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer.buffer, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT16);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer.buffer, slot * indexSlotSize, VK_INDEX_TYPE_UINT16);
 
 		for (int32_t i = 0; i < imDrawData->CmdListsCount; i++)
 		{
@@ -400,6 +518,7 @@ namespace vks
 		ImGui::DestroyContext();
 		vertexBuffer.destroy();
 		indexBuffer.destroy();
+		releaseRetiredBuffers(true);
 		vkDestroyImageView(device->logicalDevice, fontView, nullptr);
 		vkDestroyImage(device->logicalDevice, fontImage, nullptr);
 		vkFreeMemory(device->logicalDevice, fontMemory, nullptr);
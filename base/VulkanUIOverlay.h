@@ -39,8 +39,16 @@ namespace vks
 		VkSampleCountFlagBits rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 		uint32_t subpass = 0;
 
+		// Persistently mapped ring buffers, split into one slot per command buffer that may be in flight (see setSlotCount)
+		// Each slot holds a complete copy of the geometry, so writing a slot never touches data an in flight frame reads
 		vks::Buffer vertexBuffer;
 		vks::Buffer indexBuffer;
+		// Capacity of a single slot in bytes, multiples of nonCoherentAtomSize
+		VkDeviceSize vertexSlotSize = 0;
+		VkDeviceSize indexSlotSize = 0;
+		uint32_t slotCount = 1;
+		uint32_t framesInFlight = 1;
+		// Vertex and index count of the current draw data
 		int32_t vertexCount = 0;
 		int32_t indexCount = 0;
 
@@ -66,14 +74,34 @@ namespace vks
 		bool updated = false;
 		float scale = 1.0f;
 
+	private:
+		// Buffers replaced by a larger one, destroyed once no frame in flight can be reading them anymore
+		struct RetiredBuffer {
+			vks::Buffer buffer;
+			uint32_t updatesLeft;
+		};
+		std::vector<RetiredBuffer> retiredBuffers;
+		// Incremented on every update with new draw data, a slot only needs to be written if its copy is older
+		uint64_t dataGeneration = 0;
+		std::vector<uint64_t> slotGenerations;
+		// Hash of everything recorded into command buffers besides the buffer contents (draw counts, scissors)
+		uint64_t layoutHash = 0;
+
+		void createBuffers();
+		void growBuffer(vks::Buffer &buffer, VkDeviceSize &slotSize, VkDeviceSize requiredSize, VkBufferUsageFlags usage);
+		void releaseRetiredBuffers(bool all);
+
+	public:
 		UIOverlay();
 		~UIOverlay();
 
 		void preparePipeline(const VkPipelineCache pipelineCache, const VkRenderPass renderPass);
 		void prepareResources();
 
+		void setSlotCount(uint32_t slotCount, uint32_t framesInFlight);
 		bool update();
-		void draw(const VkCommandBuffer commandBuffer);
+		void upload(uint32_t slot);
+		void draw(const VkCommandBuffer commandBuffer, uint32_t slot = 0);
 		void resize(uint32_t width, uint32_t height);
 
 		void freeResources();
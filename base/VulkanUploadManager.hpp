@@ -0,0 +1,531 @@
+/*
+* Batched upload manager
+*
+* Copies data to device local buffers and images through a persistently mapped staging ring buffer
+* Uploads are recorded into batches that are submitted at once, instead of using a staging buffer, a submission and a fence wait per resource
+*
+* If the device has a dedicated transfer queue, the copies run on it in parallel to rendering. The ownership of the uploaded resources
+* is then released on the transfer queue and acquired on the destination queue, the acquire waits on a semaphore signaled by the transfer
+* Completion is tracked with fences (timeline semaphores would require Vulkan 1.2, while the examples target Vulkan 1.0)
+*
+* Usage:
+*   uploads.uploadBuffer(...) / uploads.uploadImage(...) record uploads into the current batch
+*   uploads.update() has to be called regularly (e.g. once per frame) by the thread submitting to the destination queue,
+*   it submits the current batch and the ownership acquires and releases the staging space of finished batches
+*   Resources may be used by work submitted to the destination queue once their ticket is available (i.e. after the update that submitted their batch)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <cassert>
+#include "vulkan/vulkan.h"
+#include "VulkanTools.h"
+#include "VulkanDevice.hpp"
+#include "VulkanBuffer.hpp"
+
+namespace vks
+{
+	class UploadManager
+	{
+	public:
+		/** @brief Identifies the batch an upload has been recorded into, batches are numbered in submission order starting at 1 */
+		typedef uint64_t Ticket;
+
+	private:
+		struct Batch
+		{
+			Ticket ticket = 0;
+			VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE;
+			VkCommandBuffer acquireCommandBuffer = VK_NULL_HANDLE;
+			VkFence transferFence = VK_NULL_HANDLE;
+			VkFence acquireFence = VK_NULL_HANDLE;
+			// Signaled by the transfer submission and waited on by the acquire submission (only if transfer and destination queue differ)
+			VkSemaphore semaphore = VK_NULL_HANDLE;
+			// Barriers making the uploaded resources available to the destination queue, recorded at the end of the batch
+			// With an ownership transfer they're the release barriers, the matching acquire barriers are derived from them
+			std::vector<VkBufferMemoryBarrier> bufferBarriers;
+			std::vector<VkImageMemoryBarrier> imageBarriers;
+			// Staging ring bytes used by the batch (including padding), released once the transfer has finished
+			VkDeviceSize ringBytes = 0;
+			bool ringReleased = false;
+			bool acquireSubmitted = false;
+			// Staging buffers of uploads that don't fit into the ring
+			std::vector<vks::Buffer> dedicatedStagingBuffers;
+			uint32_t uploadCount = 0;
+		};
+
+		vks::VulkanDevice *device = nullptr;
+		VkQueue transferQueue = VK_NULL_HANDLE;
+		VkQueue dstQueue = VK_NULL_HANDLE;
+		uint32_t transferQueueFamily = 0;
+		uint32_t dstQueueFamily = 0;
+		VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+		VkCommandPool acquireCommandPool = VK_NULL_HANDLE;
+
+		vks::Buffer ring;
+		VkDeviceSize ringHead = 0;
+		VkDeviceSize ringUsed = 0;
+		// Alignment of the staging offsets of image copies
+		VkDeviceSize imageCopyAlignment = 16;
+
+		// Batch currently being recorded
+		std::unique_ptr<Batch> current;
+		// Submitted batches in submission order
+		std::deque<std::unique_ptr<Batch>> submitted;
+		std::vector<std::unique_ptr<Batch>> freeBatches;
+		Ticket nextTicket = 1;
+		Ticket availableTicket = 0;
+		// Nesting depth of beginBatch/endBatch
+		uint32_t batchDepth = 0;
+		Ticket completedTicket = 0;
+
+		uint64_t submissionCount = 0;
+		uint64_t uploadCount = 0;
+		uint64_t uploadedBytes = 0;
+
+		std::mutex mutex;
+
+		bool ownershipTransfer() const { return transferQueueFamily != dstQueueFamily; }
+		bool separateQueues() const { return transferQueue != dstQueue; }
+
+		Batch &getBatch()
+		{
+			if (!current) {
+				if (!freeBatches.empty()) {
+					current = std::move(freeBatches.back());
+					freeBatches.pop_back();
+				} else {
+					current.reset(new Batch());
+					current->transferCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, transferCommandPool);
+					VkFenceCreateInfo fenceInfo = vks::initializers::fenceCreateInfo();
+					VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceInfo, nullptr, &current->transferFence));
+					if (separateQueues()) {
+						current->acquireCommandBuffer = device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, acquireCommandPool);
+						VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceInfo, nullptr, &current->acquireFence));
+						VkSemaphoreCreateInfo semaphoreInfo = vks::initializers::semaphoreCreateInfo();
+						VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreInfo, nullptr, &current->semaphore));
+					}
+				}
+				current->ticket = nextTicket++;
+				VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+				VK_CHECK_RESULT(vkBeginCommandBuffer(current->transferCommandBuffer, &beginInfo));
+			}
+			return *current;
+		}
+
+		// Barriers at the end of a batch: release to the destination queue family, or a plain dependency on the copies if no ownership transfer is needed
+		void recordBatchBarriers(Batch &batch)
+		{
+			if (batch.bufferBarriers.empty() && batch.imageBarriers.empty()) {
+				return;
+			}
+			for (auto &barrier : batch.bufferBarriers) {
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = ownershipTransfer() ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+				barrier.srcQueueFamilyIndex = ownershipTransfer() ? transferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = ownershipTransfer() ? dstQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+			}
+			for (auto &barrier : batch.imageBarriers) {
+				barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+				barrier.dstAccessMask = ownershipTransfer() ? 0 : VK_ACCESS_MEMORY_READ_BIT;
+				barrier.srcQueueFamilyIndex = ownershipTransfer() ? transferQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = ownershipTransfer() ? dstQueueFamily : VK_QUEUE_FAMILY_IGNORED;
+			}
+			vkCmdPipelineBarrier(
+				batch.transferCommandBuffer,
+				VK_PIPELINE_STAGE_TRANSFER_BIT,
+				ownershipTransfer() ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+				0,
+				0, nullptr,
+				static_cast<uint32_t>(batch.bufferBarriers.size()), batch.bufferBarriers.data(),
+				static_cast<uint32_t>(batch.imageBarriers.size()), batch.imageBarriers.data());
+		}
+
+		void submitCurrent()
+		{
+			if (!current || (current->uploadCount == 0)) {
+				return;
+			}
+			Batch &batch = *current;
+			recordBatchBarriers(batch);
+			VK_CHECK_RESULT(vkEndCommandBuffer(batch.transferCommandBuffer));
+			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+			if (separateQueues()) {
+				submitInfo.signalSemaphoreCount = 1;
+				submitInfo.pSignalSemaphores = &batch.semaphore;
+			} else {
+				// Later submissions to the same queue are ordered by the batch's barriers
+				availableTicket = batch.ticket;
+			}
+			VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, batch.transferFence));
+			submissionCount++;
+			submitted.push_back(std::move(current));
+		}
+
+		// Make the resources of a batch available on the destination queue once the transfer has finished
+		void submitAcquire(Batch &batch)
+		{
+			VkCommandBufferBeginInfo beginInfo = vks::initializers::commandBufferBeginInfo();
+			beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			VK_CHECK_RESULT(vkBeginCommandBuffer(batch.acquireCommandBuffer, &beginInfo));
+			if (ownershipTransfer() && (!batch.bufferBarriers.empty() || !batch.imageBarriers.empty())) {
+				// Acquire barriers must match the release barriers except for the access masks
+				for (auto &barrier : batch.bufferBarriers) {
+					barrier.srcAccessMask = 0;
+					barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+				}
+				for (auto &barrier : batch.imageBarriers) {
+					barrier.srcAccessMask = 0;
+					barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+				}
+				vkCmdPipelineBarrier(
+					batch.acquireCommandBuffer,
+					VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+					VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+					0,
+					0, nullptr,
+					static_cast<uint32_t>(batch.bufferBarriers.size()), batch.bufferBarriers.data(),
+					static_cast<uint32_t>(batch.imageBarriers.size()), batch.imageBarriers.data());
+			}
+			VK_CHECK_RESULT(vkEndCommandBuffer(batch.acquireCommandBuffer));
+			VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+			VkSubmitInfo submitInfo = vks::initializers::submitInfo();
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &batch.semaphore;
+			submitInfo.pWaitDstStageMask = &waitStageMask;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &batch.acquireCommandBuffer;
+			VK_CHECK_RESULT(vkQueueSubmit(dstQueue, 1, &submitInfo, batch.acquireFence));
+			submissionCount++;
+			batch.acquireSubmitted = true;
+			availableTicket = batch.ticket;
+		}
+
+		// Release the staging space of finished transfers and recycle finished batches, both in submission order
+		void retireBatches(bool waitForOldest)
+		{
+			for (auto &batch : submitted) {
+				if (batch->ringReleased) {
+					continue;
+				}
+				if (waitForOldest) {
+					VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &batch->transferFence, VK_TRUE, UINT64_MAX));
+					waitForOldest = false;
+				} else if (vkGetFenceStatus(device->logicalDevice, batch->transferFence) != VK_SUCCESS) {
+					break;
+				}
+				ringUsed -= batch->ringBytes;
+				batch->ringReleased = true;
+				for (auto &stagingBuffer : batch->dedicatedStagingBuffers) {
+					stagingBuffer.destroy();
+				}
+				batch->dedicatedStagingBuffers.clear();
+			}
+			while (!submitted.empty()) {
+				Batch &batch = *submitted.front();
+				if (!batch.ringReleased) {
+					break;
+				}
+				if (separateQueues()) {
+					if (!batch.acquireSubmitted || (vkGetFenceStatus(device->logicalDevice, batch.acquireFence) != VK_SUCCESS)) {
+						break;
+					}
+					VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &batch.acquireFence));
+				}
+				VK_CHECK_RESULT(vkResetFences(device->logicalDevice, 1, &batch.transferFence));
+				completedTicket = batch.ticket;
+				batch.bufferBarriers.clear();
+				batch.imageBarriers.clear();
+				batch.ringBytes = 0;
+				batch.ringReleased = false;
+				batch.acquireSubmitted = false;
+				batch.uploadCount = 0;
+				freeBatches.push_back(std::move(submitted.front()));
+				submitted.pop_front();
+			}
+		}
+
+		// Reserve staging memory for an upload, returns the host pointer to write the data to
+		void *reserve(VkDeviceSize size, VkDeviceSize alignment, VkBuffer *stagingBuffer, VkDeviceSize *stagingOffset)
+		{
+			if (size > ring.size) {
+				// Too large for the ring, gets a staging buffer of its own that is destroyed with the batch
+				vks::Buffer dedicatedStagingBuffer;
+				VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &dedicatedStagingBuffer, size));
+				VK_CHECK_RESULT(dedicatedStagingBuffer.map());
+				getBatch().dedicatedStagingBuffers.push_back(dedicatedStagingBuffer);
+				*stagingBuffer = dedicatedStagingBuffer.buffer;
+				*stagingOffset = 0;
+				return dedicatedStagingBuffer.mapped;
+			}
+			while (true) {
+				if (ringUsed == 0) {
+					ringHead = 0;
+				}
+				VkDeviceSize offset = (ringHead + alignment - 1) / alignment * alignment;
+				VkDeviceSize required = offset + size - ringHead;
+				if (offset + size > ring.size) {
+					// Doesn't fit in front of the end of the ring, skip the rest and start over at the beginning
+					offset = 0;
+					required = ring.size - ringHead + size;
+				}
+				if (ringUsed + required <= ring.size) {
+					ringHead = offset + size;
+					ringUsed += required;
+					getBatch().ringBytes += required;
+					*stagingBuffer = ring.buffer;
+					*stagingOffset = offset;
+					return static_cast<uint8_t*>(ring.mapped) + offset;
+				}
+				// Ring is full, wait for the oldest transfer that is still using it
+				submitCurrent();
+				retireBatches(true);
+			}
+		}
+
+	public:
+		~UploadManager()
+		{
+			destroy();
+		}
+
+		/**
+		* Prepare the upload manager
+		*
+		* @param device Device the resources are uploaded to
+		* @param transferQueue Queue the copies are submitted to
+		* @param transferQueueFamily Queue family of the transfer queue
+		* @param dstQueue Queue the uploaded resources are used on, may be the same as the transfer queue
+		* @param dstQueueFamily Queue family of the destination queue, the resources are transferred to it if it differs from the transfer queue family
+		* @param ringSize (Optional) Size of the staging ring buffer, larger uploads get a staging buffer of their own
+		*
+		* @note If both queues are the same, uploads must be recorded on the thread submitting to that queue, otherwise they may be recorded on any thread
+		*/
+		void prepare(vks::VulkanDevice *device, VkQueue transferQueue, uint32_t transferQueueFamily, VkQueue dstQueue, uint32_t dstQueueFamily, VkDeviceSize ringSize = 32 * 1024 * 1024)
+		{
+			this->device = device;
+			this->transferQueue = transferQueue;
+			this->transferQueueFamily = transferQueueFamily;
+			this->dstQueue = dstQueue;
+			this->dstQueueFamily = dstQueueFamily;
+			transferCommandPool = device->createCommandPool(transferQueueFamily);
+			if (separateQueues()) {
+				acquireCommandPool = device->createCommandPool(dstQueueFamily);
+			}
+			imageCopyAlignment = std::max(imageCopyAlignment, device->properties.limits.optimalBufferCopyOffsetAlignment);
+			VK_CHECK_RESULT(device->createBuffer(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ring, ringSize));
+			VK_CHECK_RESULT(ring.map());
+		}
+
+		/** @brief Wait for all uploads and release all resources */
+		void destroy()
+		{
+			if (!device) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			submitCurrent();
+			VK_CHECK_RESULT(vkQueueWaitIdle(transferQueue));
+			if (separateQueues()) {
+				VK_CHECK_RESULT(vkQueueWaitIdle(dstQueue));
+			}
+			if (current) {
+				freeBatches.push_back(std::move(current));
+			}
+			for (auto &batch : submitted) {
+				freeBatches.push_back(std::move(batch));
+			}
+			submitted.clear();
+			for (auto &batch : freeBatches) {
+				for (auto &stagingBuffer : batch->dedicatedStagingBuffers) {
+					stagingBuffer.destroy();
+				}
+				vkDestroyFence(device->logicalDevice, batch->transferFence, nullptr);
+				if (batch->acquireFence != VK_NULL_HANDLE) {
+					vkDestroyFence(device->logicalDevice, batch->acquireFence, nullptr);
+					vkDestroySemaphore(device->logicalDevice, batch->semaphore, nullptr);
+				}
+			}
+			freeBatches.clear();
+			// Destroying the pools frees their command buffers
+			vkDestroyCommandPool(device->logicalDevice, transferCommandPool, nullptr);
+			if (acquireCommandPool != VK_NULL_HANDLE) {
+				vkDestroyCommandPool(device->logicalDevice, acquireCommandPool, nullptr);
+			}
+			ring.destroy();
+			device = nullptr;
+		}
+
+		/**
+		* Upload data to a device local buffer
+		*
+		* @param dstBuffer Buffer to copy to, must have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT
+		*
+		* @return Ticket of the batch the upload has been recorded into
+		*/
+		Ticket uploadBuffer(VkBuffer dstBuffer, const void *data, VkDeviceSize size, VkDeviceSize dstOffset = 0)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			VkBuffer stagingBuffer;
+			VkDeviceSize stagingOffset;
+			memcpy(reserve(size, 4, &stagingBuffer, &stagingOffset), data, size);
+			Batch &batch = getBatch();
+			VkBufferCopy copyRegion = {};
+			copyRegion.srcOffset = stagingOffset;
+			copyRegion.dstOffset = dstOffset;
+			copyRegion.size = size;
+			vkCmdCopyBuffer(batch.transferCommandBuffer, stagingBuffer, dstBuffer, 1, &copyRegion);
+			VkBufferMemoryBarrier barrier = vks::initializers::bufferMemoryBarrier();
+			barrier.buffer = dstBuffer;
+			barrier.offset = dstOffset;
+			barrier.size = size;
+			batch.bufferBarriers.push_back(barrier);
+			batch.uploadCount++;
+			uploadCount++;
+			uploadedBytes += size;
+			return batch.ticket;
+		}
+
+		/**
+		* Upload data to a device local image and transition it to its final layout
+		*
+		* @param image Image to copy to, must have been created with VK_IMAGE_USAGE_TRANSFER_DST_BIT, its previous contents are discarded
+		* @param regions Copy regions with buffer offsets relative to the start of data
+		* @param subresourceRange Subresources covered by the regions
+		* @param finalLayout Layout the image is used in on the destination queue
+		*
+		* @return Ticket of the batch the upload has been recorded into
+		*/
+		Ticket uploadImage(VkImage image, const void *data, VkDeviceSize size, const std::vector<VkBufferImageCopy> &regions, const VkImageSubresourceRange &subresourceRange, VkImageLayout finalLayout)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			VkBuffer stagingBuffer;
+			VkDeviceSize stagingOffset;
+			memcpy(reserve(size, imageCopyAlignment, &stagingBuffer, &stagingOffset), data, size);
+			Batch &batch = getBatch();
+			vks::tools::setImageLayout(batch.transferCommandBuffer, image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+			std::vector<VkBufferImageCopy> stagingRegions(regions);
+			for (auto &region : stagingRegions) {
+				region.bufferOffset += stagingOffset;
+			}
+			vkCmdCopyBufferToImage(batch.transferCommandBuffer, stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(stagingRegions.size()), stagingRegions.data());
+			VkImageMemoryBarrier barrier = vks::initializers::imageMemoryBarrier();
+			barrier.image = image;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = finalLayout;
+			barrier.subresourceRange = subresourceRange;
+			batch.imageBarriers.push_back(barrier);
+			batch.uploadCount++;
+			uploadCount++;
+			uploadedBytes += size;
+			return batch.ticket;
+		}
+
+		/**
+		* Submit the uploads recorded so far to the transfer queue, without waiting for update
+		*
+		* @return Ticket of the submitted batch
+		*
+		* @note If transfer and destination queue are the same, this must be called on the thread submitting to that queue
+		*/
+		Ticket flush()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			Ticket ticket = current ? current->ticket : nextTicket - 1;
+			submitCurrent();
+			return ticket;
+		}
+
+		/**
+		* Collect uploads of helpers that would otherwise wait for each of their uploads (e.g. the texture loaders) into one batch until endBatch
+		*
+		* @note Applies to uploads from all threads, batches may be nested
+		*/
+		void beginBatch()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			batchDepth++;
+		}
+
+		/** @brief End a batch started with beginBatch, returns the ticket of the uploads recorded so far (to wait for or to check for availability) */
+		Ticket endBatch()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			assert(batchDepth > 0);
+			batchDepth--;
+			return current ? current->ticket : nextTicket - 1;
+		}
+
+		bool isBatching()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return batchDepth > 0;
+		}
+
+		/**
+		* Submit pending uploads and ownership acquires and release the resources of finished batches
+		*
+		* @note Must be called on the thread submitting to the destination queue, e.g. once per frame before the frame's work is submitted
+		*/
+		void update()
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			submitCurrent();
+			if (separateQueues()) {
+				for (auto &batch : submitted) {
+					if (!batch->acquireSubmitted) {
+						submitAcquire(*batch);
+					}
+				}
+			}
+			retireBatches(false);
+		}
+
+		/** @brief Wait until the uploads of a batch have finished on the GPU, must be called on the thread submitting to the destination queue */
+		void wait(Ticket ticket)
+		{
+			update();
+			std::lock_guard<std::mutex> lock(mutex);
+			while (completedTicket < ticket) {
+				assert(!submitted.empty());
+				Batch &batch = *submitted.front();
+				VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &batch.transferFence, VK_TRUE, UINT64_MAX));
+				if (separateQueues()) {
+					VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &batch.acquireFence, VK_TRUE, UINT64_MAX));
+				}
+				retireBatches(false);
+			}
+		}
+
+		/** @brief True if work submitted to the destination queue from now on may use the resources of the batch */
+		bool isAvailable(Ticket ticket)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return ticket <= availableTicket;
+		}
+
+		/** @brief True if the uploads of the batch have finished on the GPU */
+		bool isComplete(Ticket ticket)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return ticket <= completedTicket;
+		}
+
+		/** @brief True if uploads run on a queue of their own, in parallel to the work on the destination queue */
+		bool usesTransferQueue() const { return separateQueues(); }
+		/** @brief Number of queue submissions (transfers and ownership acquires) */
+		uint64_t getSubmissionCount() const { return submissionCount; }
+		uint64_t getUploadCount() const { return uploadCount; }
+		uint64_t getUploadedBytes() const { return uploadedBytes; }
+	};
+}
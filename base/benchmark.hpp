@@ -6,13 +6,22 @@
 * This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
 */
 
+#pragma once
+
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <numeric>
 #include <limits>
 #include <functional>
 #include <chrono>
+#include <mutex>
 #include <iomanip>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include "vulkan/vulkan.h"
+#include "cpuprofiler.hpp"
 
 namespace vks
 {
@@ -20,16 +29,167 @@ namespace vks
 	private:
 		FILE *stream;
 		VkPhysicalDeviceProperties deviceProps;
+		// Set while the benchmark phase is running, samples reported during warm up are ignored
+		bool measuring = false;
 	public:
 		bool active = false;
 		bool outputFrameTimes = false;
-		uint32_t warmup = 1;
+		/** @brief Maximum warm up time in seconds, warm up ends earlier once frame times are stable */
+		uint32_t warmup = 5;
+		/** @brief Maximum benchmark time in seconds */
 		uint32_t duration = 10;
+		/** @brief If greater than zero, the benchmark ends as soon as the 95% confidence interval of the mean frame time is within this fraction of the mean */
+		double targetPrecision = 0.0;
+		/** @brief Consecutive frames averaged into one batch for the confidence interval (frame times of consecutive frames are not independent) */
+		uint32_t batchSize = 30;
 		std::vector<double> frameTimes;
+		// CPU time spent on each frame without waiting for the GPU or the swap chain, i.e. the cost of updating, recording and submitting
+		std::vector<double> cpuTimes;
+		// GPU execution time of each frame, measured with timestamps
+		std::vector<double> gpuTimes;
 		std::string filename = "";
+		// Called once the warm up phase has finished, e.g. to discard profiling results gathered while warming up
+		std::function<void()> onWarmupFinished;
+
+		// GPU times of profiled scopes, written to the results file if not empty
+		struct ScopeTiming {
+			std::string name;
+			uint32_t count;
+			double min;
+			double max;
+			double avg;
+		};
+		std::vector<ScopeTiming> gpuTimings;
+
+		// Example specific values reported once per frame (e.g. ray throughput), see addMetric
+		struct Metric {
+			std::string name;
+			std::vector<double> samples;
+		};
+		std::vector<Metric> metrics;
+		std::mutex metricsMutex;
+
+		/** @brief Distribution of a set of samples in milliseconds */
+		struct Statistics {
+			size_t count = 0;
+			double mean = 0.0;
+			// Half width of the 95% confidence interval of the mean
+			double confidence = 0.0;
+			double min = 0.0;
+			double p50 = 0.0;
+			double p95 = 0.0;
+			double p99 = 0.0;
+			double p999 = 0.0;
+			double max = 0.0;
+		};
 
 		double runtime = 0.0;
 		uint32_t frameCount = 0;
+		double warmupTime = 0.0;
+		uint32_t warmupFrames = 0;
+		// True if frame times became stable before the maximum warm up time
+		bool warmupSteady = false;
+		// True if the target precision has been reached before the maximum benchmark time
+		bool precisionReached = false;
+
+		/** @brief Two-sided 95% quantile of the Student t distribution */
+		static double tQuantile(size_t degreesOfFreedom)
+		{
+			static const double table[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+			if (degreesOfFreedom == 0) {
+				return std::numeric_limits<double>::infinity();
+			}
+			return (degreesOfFreedom <= 30) ? table[degreesOfFreedom - 1] : 1.960;
+		}
+
+		/** @brief Half width of the 95% confidence interval of the mean, based on the means of batches of consecutive samples */
+		static double confidenceInterval(const std::vector<double> &samples, uint32_t batchSize)
+		{
+			size_t batchCount = samples.size() / batchSize;
+			if (batchCount < 2) {
+				return std::numeric_limits<double>::infinity();
+			}
+			std::vector<double> batchMeans(batchCount);
+			for (size_t i = 0; i < batchCount; i++) {
+				batchMeans[i] = std::accumulate(samples.begin() + i * batchSize, samples.begin() + (i + 1) * batchSize, 0.0) / (double)batchSize;
+			}
+			double mean = std::accumulate(batchMeans.begin(), batchMeans.end(), 0.0) / (double)batchCount;
+			double variance = 0.0;
+			for (auto batchMean : batchMeans) {
+				variance += (batchMean - mean) * (batchMean - mean);
+			}
+			variance /= (double)(batchCount - 1);
+			return tQuantile(batchCount - 1) * std::sqrt(variance / (double)batchCount);
+		}
+
+		/** @brief Percentile (0..100) of sorted samples, linearly interpolated between the closest ranks */
+		static double percentile(const std::vector<double> &sorted, double p)
+		{
+			double rank = p / 100.0 * (double)(sorted.size() - 1);
+			size_t lower = (size_t)rank;
+			size_t upper = std::min(lower + 1, sorted.size() - 1);
+			return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - (double)lower);
+		}
+
+		Statistics getStatistics(const std::vector<double> &samples) const
+		{
+			Statistics statistics;
+			if (samples.empty()) {
+				return statistics;
+			}
+			std::vector<double> sorted(samples);
+			std::sort(sorted.begin(), sorted.end());
+			statistics.count = sorted.size();
+			statistics.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / (double)sorted.size();
+			statistics.confidence = confidenceInterval(samples, batchSize);
+			statistics.min = sorted.front();
+			statistics.p50 = percentile(sorted, 50.0);
+			statistics.p95 = percentile(sorted, 95.0);
+			statistics.p99 = percentile(sorted, 99.0);
+			statistics.p999 = percentile(sorted, 99.9);
+			statistics.max = sorted.back();
+			return statistics;
+		}
+
+		/** @brief Discard all results, so the benchmark can be run again (e.g. for the next scenario of a sweep) */
+		void reset()
+		{
+			frameTimes.clear();
+			cpuTimes.clear();
+			gpuTimes.clear();
+			gpuTimings.clear();
+			metrics.clear();
+			runtime = 0.0;
+			frameCount = 0;
+			warmupTime = 0.0;
+			warmupFrames = 0;
+			warmupSteady = false;
+			precisionReached = false;
+		}
+
+		/** @brief Report the CPU time of the frame that has just been rendered, ignored during warm up */
+		void addCpuTime(double time)
+		{
+			if (measuring) {
+				cpuTimes.push_back(time);
+			}
+		}
+
+		/** @brief Report an example specific value for the current frame, ignored during warm up. May be called from worker threads (e.g. task graph nodes) */
+		void addMetric(const std::string &name, double value)
+		{
+			if (!measuring) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(metricsMutex);
+			for (auto &metric : metrics) {
+				if (metric.name == name) {
+					metric.samples.push_back(value);
+					return;
+				}
+			}
+			metrics.push_back({ name, { value } });
+		}
 
 		void run(std::function<void()> renderFunc, VkPhysicalDeviceProperties deviceProps) {
 			active = true;
@@ -42,18 +202,47 @@ namespace vks
 			std::cout << std::fixed << std::setprecision(3);
 
 			// Warm up phase to get more stable frame rates
+			// Frame times are averaged over windows of at least batchSize frames and 100 ms, warm up ends once two consecutive windows differ by less than 5% from their predecessor
 			{
-				double tMeasured = 0.0;
-				while (tMeasured < (warmup * 1000)) {
+				const double windowTolerance = 0.05;
+				const uint32_t requiredStableWindows = 2;
+				double windowTime = 0.0;
+				uint32_t windowFrames = 0;
+				double previousWindowMean = 0.0;
+				uint32_t stableWindows = 0;
+				while (warmupTime < (warmup * 1000.0)) {
 					auto tStart = std::chrono::high_resolution_clock::now();
 					renderFunc();
 					auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
-					tMeasured += tDiff;
+					warmupTime += tDiff;
+					warmupFrames++;
+					windowTime += tDiff;
+					windowFrames++;
+					if ((windowFrames >= batchSize) && (windowTime >= 100.0)) {
+						double windowMean = windowTime / (double)windowFrames;
+						if ((previousWindowMean > 0.0) && (std::abs(windowMean - previousWindowMean) < windowTolerance * previousWindowMean)) {
+							stableWindows++;
+						} else {
+							stableWindows = 0;
+						}
+						previousWindowMean = windowMean;
+						windowTime = 0.0;
+						windowFrames = 0;
+						if (stableWindows >= requiredStableWindows) {
+							warmupSteady = true;
+							break;
+						}
+					}
 				};
+				std::cout << "warm up: " << warmupTime << " ms, " << warmupFrames << " frames (" << (warmupSteady ? "steady state reached" : "maximum warm up time reached") << ")" << std::endl;
+				if (onWarmupFinished) {
+					onWarmupFinished();
+				}
 			}
 
 			// Benchmark phase
 			{
+				measuring = true;
 				while (runtime < (duration * 1000.0)) {
 					auto tStart = std::chrono::high_resolution_clock::now();
 					renderFunc();
@@ -61,12 +250,43 @@ namespace vks
 					runtime += tDiff;
 					frameTimes.push_back(tDiff);
 					frameCount++;
+					// Checking the confidence interval once per batch keeps the cost negligible
+					if ((targetPrecision > 0.0) && (frameCount % batchSize == 0)) {
+						double mean = runtime / (double)frameCount;
+						if ((frameCount / batchSize >= 10) && (confidenceInterval(frameTimes, batchSize) <= targetPrecision * mean)) {
+							precisionReached = true;
+							break;
+						}
+					}
 				};
+				measuring = false;
 				std::cout << "Benchmark finished" << std::endl;
 				std::cout << "device : " << deviceProps.deviceName << " (driver version: " << deviceProps.driverVersion << ")" << std::endl;
 				std::cout << "runtime: " << (runtime / 1000.0) << std::endl;
 				std::cout << "frames : " << frameCount << std::endl;
 				std::cout << "fps    : " << frameCount / (runtime / 1000.0) << std::endl;
+				if (targetPrecision > 0.0) {
+					std::cout << "precision: " << (precisionReached ? "reached" : "not reached within the maximum benchmark time") << std::endl;
+				}
+			}
+		}
+
+		/** @brief Print the distribution of the frame, CPU and GPU times, call once GPU times have been collected */
+		void printStatistics()
+		{
+			std::cout << std::fixed << std::setprecision(3);
+			const std::string names[] = { "frame", "cpu", "gpu" };
+			const Statistics statistics[] = { getStatistics(frameTimes), getStatistics(cpuTimes), getStatistics(gpuTimes) };
+			for (size_t i = 0; i < 3; i++) {
+				if (statistics[i].count == 0) {
+					continue;
+				}
+				const Statistics &s = statistics[i];
+				std::cout << names[i] << " time (ms): mean " << s.mean << " +/- " << s.confidence << ", p50 " << s.p50 << ", p95 " << s.p95 << ", p99 " << s.p99 << ", p99.9 " << s.p999 << ", max " << s.max << std::endl;
+			}
+			for (auto &metric : metrics) {
+				const Statistics s = getStatistics(metric.samples);
+				std::cout << metric.name << ": mean " << s.mean << ", min " << s.min << ", max " << s.max << std::endl;
 			}
 		}
 
@@ -78,6 +298,19 @@ namespace vks
 				result << "device,driverversion,duration (ms),frames,fps" << std::endl;
 				result << deviceProps.deviceName << "," << deviceProps.driverVersion << "," << runtime << "," << frameCount << "," << frameCount / (runtime / 1000.0) << std::endl;
 
+				const Statistics frameStatistics = getStatistics(frameTimes);
+				const Statistics cpuStatistics = getStatistics(cpuTimes);
+				const Statistics gpuStatistics = getStatistics(gpuTimes);
+				result << std::endl << "statistic,frame time (ms),cpu time (ms),gpu time (ms)" << std::endl;
+				result << "mean," << frameStatistics.mean << "," << cpuStatistics.mean << "," << gpuStatistics.mean << std::endl;
+				result << "ci95," << frameStatistics.confidence << "," << cpuStatistics.confidence << "," << gpuStatistics.confidence << std::endl;
+				result << "min," << frameStatistics.min << "," << cpuStatistics.min << "," << gpuStatistics.min << std::endl;
+				result << "p50," << frameStatistics.p50 << "," << cpuStatistics.p50 << "," << gpuStatistics.p50 << std::endl;
+				result << "p95," << frameStatistics.p95 << "," << cpuStatistics.p95 << "," << gpuStatistics.p95 << std::endl;
+				result << "p99," << frameStatistics.p99 << "," << cpuStatistics.p99 << "," << gpuStatistics.p99 << std::endl;
+				result << "p99.9," << frameStatistics.p999 << "," << cpuStatistics.p999 << "," << gpuStatistics.p999 << std::endl;
+				result << "max," << frameStatistics.max << "," << cpuStatistics.max << "," << gpuStatistics.max << std::endl;
+
 				if (outputFrameTimes) {
 					result << std::endl << "frame,ms" << std::endl;
 					for (size_t i = 0; i < frameTimes.size(); i++) {
@@ -92,11 +325,79 @@ namespace vks
 					std::cout << std::endl;
 				}
 
+				if (!metrics.empty()) {
+					result << std::endl << "metric,samples,mean,min,max" << std::endl;
+					for (auto &metric : metrics) {
+						const Statistics s = getStatistics(metric.samples);
+						result << metric.name << "," << s.count << "," << s.mean << "," << s.min << "," << s.max << std::endl;
+					}
+				}
+
+				if (!gpuTimings.empty()) {
+					result << std::endl << "gpu scope,samples,min (ms),max (ms),avg (ms)" << std::endl;
+					for (auto &timing : gpuTimings) {
+						result << timing.name << "," << timing.count << "," << timing.min << "," << timing.max << "," << timing.avg << std::endl;
+					}
+				}
+
 				result.flush();
 #if defined(_WIN32)
 				FreeConsole();
 #endif
 			}
+			saveJson();
+		}
+
+		/** @brief Name of the JSON results file, the CSV file name with a .json extension */
+		std::string getJsonFilename() const
+		{
+			const std::string csvExtension = ".csv";
+			if ((filename.size() > csvExtension.size()) && (filename.compare(filename.size() - csvExtension.size(), csvExtension.size(), csvExtension) == 0)) {
+				return filename.substr(0, filename.size() - csvExtension.size()) + ".json";
+			}
+			return filename + ".json";
+		}
+
+		/** @brief Save the results in a machine readable format next to the CSV file */
+		void saveJson()
+		{
+			std::ofstream json(getJsonFilename(), std::ios::out | std::ios::trunc);
+			if (!json.is_open()) {
+				return;
+			}
+			auto writeStatistics = [&json](const Statistics &s) {
+				// Infinity (not enough samples for a confidence interval) is not valid JSON
+				double confidence = std::isinf(s.confidence) ? -1.0 : s.confidence;
+				json << "{\"samples\":" << s.count << ",\"mean\":" << s.mean << ",\"ci95\":" << confidence << ",\"min\":" << s.min
+					<< ",\"p50\":" << s.p50 << ",\"p95\":" << s.p95 << ",\"p99\":" << s.p99 << ",\"p99.9\":" << s.p999 << ",\"max\":" << s.max << "}";
+			};
+			json << std::fixed << std::setprecision(4);
+			json << "{" << std::endl;
+			json << "\"device\":\"" << vks::cpuprofiler::escapeJson(deviceProps.deviceName) << "\"," << std::endl;
+			json << "\"driverVersion\":" << deviceProps.driverVersion << "," << std::endl;
+			json << "\"warmup\":{\"duration\":" << warmupTime << ",\"frames\":" << warmupFrames << ",\"steady\":" << (warmupSteady ? "true" : "false") << "}," << std::endl;
+			json << "\"duration\":" << runtime << "," << std::endl;
+			json << "\"frames\":" << frameCount << "," << std::endl;
+			json << "\"fps\":" << ((runtime > 0.0) ? frameCount / (runtime / 1000.0) : 0.0) << "," << std::endl;
+			json << "\"targetPrecision\":" << targetPrecision << ",\"precisionReached\":" << (precisionReached ? "true" : "false") << "," << std::endl;
+			json << "\"frameTime\":";
+			writeStatistics(getStatistics(frameTimes));
+			json << "," << std::endl << "\"cpuTime\":";
+			writeStatistics(getStatistics(cpuTimes));
+			json << "," << std::endl << "\"gpuTime\":";
+			writeStatistics(getStatistics(gpuTimes));
+			json << "," << std::endl << "\"metrics\":{";
+			for (size_t i = 0; i < metrics.size(); i++) {
+				json << (i > 0 ? "," : "") << std::endl << "\"" << vks::cpuprofiler::escapeJson(metrics[i].name) << "\":";
+				writeStatistics(getStatistics(metrics[i].samples));
+			}
+			json << "}";
+			json << "," << std::endl << "\"gpuScopes\":[";
+			for (size_t i = 0; i < gpuTimings.size(); i++) {
+				const ScopeTiming &timing = gpuTimings[i];
+				json << (i > 0 ? "," : "") << std::endl << "{\"name\":\"" << vks::cpuprofiler::escapeJson(timing.name) << "\",\"samples\":" << timing.count << ",\"min\":" << timing.min << ",\"max\":" << timing.max << ",\"avg\":" << timing.avg << "}";
+			}
+			json << "]" << std::endl << "}" << std::endl;
 		}
 	};
-}
\ No newline at end of file
+}
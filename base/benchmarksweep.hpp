@@ -0,0 +1,232 @@
+/*
+* Benchmark scenario sweep
+*
+* Runs the benchmark for every combination of a set of parameters in a single process and device session
+* Parameters and their values are read from a text file, one parameter per line:
+*
+*   # Comment
+*   resolution = 512, 1024, 2048
+*   triangles = 1, 1000
+*
+* How a parameter is applied is up to the example (see VulkanExampleBase::applyBenchmarkScenario)
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include "benchmark.hpp"
+
+namespace vks
+{
+	class BenchmarkSweep
+	{
+	public:
+		struct Parameter
+		{
+			std::string name;
+			std::vector<std::string> values;
+		};
+
+		/** @brief One combination of parameter values, in the order the parameters are listed in the file */
+		typedef std::vector<std::pair<std::string, std::string>> Scenario;
+
+	private:
+		std::vector<Parameter> parameters;
+
+		struct Result
+		{
+			Scenario scenario;
+			bool supported;
+			uint32_t frames;
+			double fps;
+			Benchmark::Statistics frameTime;
+			Benchmark::Statistics cpuTime;
+			Benchmark::Statistics gpuTime;
+			// Mean of each example specific metric
+			std::vector<std::pair<std::string, double>> metrics;
+		};
+		std::vector<Result> results;
+
+		static std::string trim(const std::string &value)
+		{
+			const char *whitespace = " \t\r\n";
+			size_t first = value.find_first_not_of(whitespace);
+			if (first == std::string::npos) {
+				return "";
+			}
+			size_t last = value.find_last_not_of(whitespace);
+			return value.substr(first, last - first + 1);
+		}
+
+	public:
+		bool active = false;
+
+		/**
+		* Load the parameters to sweep over
+		*
+		* @return False if the file could not be read or contains invalid lines
+		*/
+		bool load(const std::string &filename)
+		{
+			std::ifstream file(filename);
+			if (!file.is_open()) {
+				std::cerr << "Could not open benchmark sweep file \"" << filename << "\"" << std::endl;
+				return false;
+			}
+			parameters.clear();
+			std::string line;
+			uint32_t lineNumber = 0;
+			while (std::getline(file, line)) {
+				lineNumber++;
+				line = trim(line.substr(0, line.find('#')));
+				if (line.empty()) {
+					continue;
+				}
+				size_t separator = line.find('=');
+				if (separator == std::string::npos) {
+					std::cerr << filename << "(" << lineNumber << "): expected \"name = value, value, ...\"" << std::endl;
+					return false;
+				}
+				Parameter parameter;
+				parameter.name = trim(line.substr(0, separator));
+				std::stringstream values(line.substr(separator + 1));
+				std::string value;
+				while (std::getline(values, value, ',')) {
+					value = trim(value);
+					if (!value.empty()) {
+						parameter.values.push_back(value);
+					}
+				}
+				if (parameter.name.empty() || parameter.values.empty()) {
+					std::cerr << filename << "(" << lineNumber << "): parameter without name or values" << std::endl;
+					return false;
+				}
+				parameters.push_back(parameter);
+			}
+			active = !parameters.empty();
+			return active;
+		}
+
+		/** @brief All combinations of the parameter values, the last parameter changes fastest */
+		std::vector<Scenario> getScenarios() const
+		{
+			std::vector<Scenario> scenarios;
+			if (parameters.empty()) {
+				return scenarios;
+			}
+			std::vector<size_t> indices(parameters.size(), 0);
+			while (true) {
+				Scenario scenario;
+				for (size_t i = 0; i < parameters.size(); i++) {
+					scenario.push_back(std::make_pair(parameters[i].name, parameters[i].values[indices[i]]));
+				}
+				scenarios.push_back(scenario);
+				// Advance the indices like the digits of a number
+				size_t digit = parameters.size();
+				while (digit > 0) {
+					digit--;
+					if (++indices[digit] < parameters[digit].values.size()) {
+						break;
+					}
+					indices[digit] = 0;
+					if (digit == 0) {
+						return scenarios;
+					}
+				}
+			}
+		}
+
+		static std::string toString(const Scenario &scenario)
+		{
+			std::string result;
+			for (auto &value : scenario) {
+				result += (result.empty() ? "" : ", ") + value.first + " = " + value.second;
+			}
+			return result;
+		}
+
+		/** @brief Store the results of the benchmark that has just been run for a scenario */
+		void addResult(const Scenario &scenario, const Benchmark &benchmark)
+		{
+			Result result;
+			result.scenario = scenario;
+			result.supported = true;
+			result.frames = benchmark.frameCount;
+			result.fps = (benchmark.runtime > 0.0) ? benchmark.frameCount / (benchmark.runtime / 1000.0) : 0.0;
+			result.frameTime = benchmark.getStatistics(benchmark.frameTimes);
+			result.cpuTime = benchmark.getStatistics(benchmark.cpuTimes);
+			result.gpuTime = benchmark.getStatistics(benchmark.gpuTimes);
+			for (auto &metric : benchmark.metrics) {
+				result.metrics.push_back(std::make_pair(metric.name, benchmark.getStatistics(metric.samples).mean));
+			}
+			results.push_back(result);
+		}
+
+		/** @brief Mark a scenario the example could not apply, it's listed in the results without measurements */
+		void addUnsupported(const Scenario &scenario)
+		{
+			Result result = {};
+			result.scenario = scenario;
+			result.supported = false;
+			results.push_back(result);
+		}
+
+		/** @brief Write all results as a single CSV table with one row per scenario */
+		bool saveResults(const std::string &filename) const
+		{
+			std::ofstream table(filename, std::ios::out | std::ios::trunc);
+			if (!table.is_open()) {
+				return false;
+			}
+			// Scenarios may report different metrics (e.g. only if a feature is enabled), each gets a column
+			std::vector<std::string> metricNames;
+			for (auto &result : results) {
+				for (auto &metric : result.metrics) {
+					if (std::find(metricNames.begin(), metricNames.end(), metric.first) == metricNames.end()) {
+						metricNames.push_back(metric.first);
+					}
+				}
+			}
+			table << std::fixed << std::setprecision(4);
+			for (auto &parameter : parameters) {
+				table << parameter.name << ",";
+			}
+			table << "frames,fps,frame mean (ms),frame ci95 (ms),frame p50 (ms),frame p95 (ms),frame p99 (ms),frame p99.9 (ms),cpu mean (ms),cpu p99 (ms),gpu mean (ms),gpu p99 (ms)";
+			for (auto &metricName : metricNames) {
+				table << "," << metricName;
+			}
+			table << std::endl;
+			for (auto &result : results) {
+				for (auto &value : result.scenario) {
+					table << value.second << ",";
+				}
+				if (!result.supported) {
+					table << "unsupported" << std::endl;
+					continue;
+				}
+				table << result.frames << "," << result.fps << ","
+					<< result.frameTime.mean << "," << result.frameTime.confidence << "," << result.frameTime.p50 << "," << result.frameTime.p95 << "," << result.frameTime.p99 << "," << result.frameTime.p999 << ","
+					<< result.cpuTime.mean << "," << result.cpuTime.p99 << ","
+					<< result.gpuTime.mean << "," << result.gpuTime.p99;
+				for (auto &metricName : metricNames) {
+					table << ",";
+					for (auto &metric : result.metrics) {
+						if (metric.first == metricName) {
+							table << metric.second;
+						}
+					}
+				}
+				table << std::endl;
+			}
+			return table.good();
+		}
+	};
+}
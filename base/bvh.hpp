@@ -0,0 +1,241 @@
+/*
+* Bounding volume hierarchy for triangles
+*
+* Built on the CPU with the surface area heuristic (binned), the nodes are laid out so they can be uploaded to a storage buffer and traversed in a shader as is
+* The triangles are not stored in the hierarchy, instead the triangle data has to be reordered so the triangles of each leaf are stored contiguously (see reorder)
+* Large subtrees can be built in parallel on a task scheduler, they cover disjoint ranges of the triangles and nodes
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <atomic>
+#include <glm/glm.hpp>
+#include "taskscheduler.hpp"
+
+namespace vks
+{
+	class BVH
+	{
+	public:
+		/** @brief Node matching the std430 layout of { vec3 min; uint leftFirst; vec3 max; uint count; } */
+		struct Node
+		{
+			glm::vec3 min;
+			// Inner nodes: index of the left child, the right child follows it. Leaves: index of the first triangle
+			uint32_t leftFirst;
+			glm::vec3 max;
+			// Number of triangles, zero for inner nodes
+			uint32_t count;
+		};
+
+	private:
+		struct Bounds
+		{
+			glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+			glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+			void grow(const glm::vec3 &point)
+			{
+				min = glm::min(min, point);
+				max = glm::max(max, point);
+			}
+
+			void grow(const Bounds &bounds)
+			{
+				min = glm::min(min, bounds.min);
+				max = glm::max(max, bounds.max);
+			}
+
+			float area() const
+			{
+				glm::vec3 extent = max - min;
+				return (extent.x < 0.0f) ? 0.0f : 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+			}
+		};
+
+		static const uint32_t binCount = 16;
+		// Subtrees with fewer triangles are built on the thread that split their parent
+		static const uint32_t parallelBuildSize = 4096;
+
+		// Shared by the threads building subtrees
+		struct BuildState
+		{
+			TaskScheduler *scheduler = nullptr;
+			TaskGroup group;
+			// Nodes are allocated in pairs of siblings from the storage reserved up front
+			std::atomic<uint32_t> nodeCount{ 0 };
+			std::atomic<uint32_t> depth{ 0 };
+		};
+
+		std::vector<Bounds> triangleBounds;
+		std::vector<glm::vec3> centroids;
+		BuildState *buildState = nullptr;
+
+		void subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, uint32_t depth)
+		{
+			Bounds bounds, centroidBounds;
+			for (uint32_t i = first; i < first + count; i++) {
+				bounds.grow(triangleBounds[indices[i]]);
+				centroidBounds.grow(centroids[indices[i]]);
+			}
+			nodes[nodeIndex].min = bounds.min;
+			nodes[nodeIndex].max = bounds.max;
+			nodes[nodeIndex].leftFirst = first;
+			nodes[nodeIndex].count = count;
+			uint32_t deepest = buildState->depth.load(std::memory_order_relaxed);
+			while ((depth > deepest) && !buildState->depth.compare_exchange_weak(deepest, depth, std::memory_order_relaxed)) {}
+			if ((count <= minLeafSize) || (depth >= maxDepth)) {
+				return;
+			}
+
+			// Find the cheapest split plane between bins along any axis
+			// Cost model: traversing a node and testing a triangle cost the same
+			float bestCost = std::numeric_limits<float>::max();
+			int32_t bestAxis = -1;
+			uint32_t bestSplit = 0;
+			for (int32_t axis = 0; axis < 3; axis++) {
+				float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+				if (extent <= 0.0f) {
+					continue;
+				}
+				Bounds bins[binCount];
+				uint32_t binTriangles[binCount] = {};
+				float scale = (float)binCount / extent;
+				for (uint32_t i = first; i < first + count; i++) {
+					uint32_t bin = std::min(binCount - 1, (uint32_t)((centroids[indices[i]][axis] - centroidBounds.min[axis]) * scale));
+					bins[bin].grow(triangleBounds[indices[i]]);
+					binTriangles[bin]++;
+				}
+				// Sweep from the right to get the cost of everything right of each split, then from the left
+				float rightArea[binCount - 1];
+				uint32_t rightCount[binCount - 1];
+				Bounds right;
+				uint32_t rightSum = 0;
+				for (uint32_t i = binCount - 1; i > 0; i--) {
+					right.grow(bins[i]);
+					rightSum += binTriangles[i];
+					rightArea[i - 1] = right.area();
+					rightCount[i - 1] = rightSum;
+				}
+				Bounds left;
+				uint32_t leftSum = 0;
+				for (uint32_t i = 0; i < binCount - 1; i++) {
+					left.grow(bins[i]);
+					leftSum += binTriangles[i];
+					if ((leftSum == 0) || (rightCount[i] == 0)) {
+						continue;
+					}
+					float cost = left.area() * (float)leftSum + rightArea[i] * (float)rightCount[i];
+					if (cost < bestCost) {
+						bestCost = cost;
+						bestAxis = axis;
+						bestSplit = i;
+					}
+				}
+			}
+
+			uint32_t leftCount = 0;
+			if (bestAxis >= 0) {
+				float parentArea = bounds.area();
+				float splitCost = 1.0f + ((parentArea > 0.0f) ? bestCost / parentArea : (float)count);
+				if ((splitCost >= (float)count) && (count <= maxLeafSize)) {
+					return;
+				}
+				float scale = (float)binCount / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+				float splitMin = centroidBounds.min[bestAxis];
+				auto middle = std::partition(indices.begin() + first, indices.begin() + first + count, [&](uint32_t index) {
+					return std::min(binCount - 1, (uint32_t)((centroids[index][bestAxis] - splitMin) * scale)) <= bestSplit;
+				});
+				leftCount = static_cast<uint32_t>(middle - (indices.begin() + first));
+			}
+			if ((leftCount == 0) || (leftCount == count)) {
+				// All centroids are in the same place, there's no better split than halving the range
+				if (count <= maxLeafSize) {
+					return;
+				}
+				leftCount = count / 2;
+			}
+
+			uint32_t leftIndex = buildState->nodeCount.fetch_add(2, std::memory_order_relaxed);
+			nodes[nodeIndex].leftFirst = leftIndex;
+			nodes[nodeIndex].count = 0;
+			if (buildState->scheduler && (count >= parallelBuildSize)) {
+				buildState->scheduler->run(buildState->group, [this, leftIndex, first, leftCount, depth] {
+					subdivide(leftIndex, first, leftCount, depth + 1);
+				});
+			} else {
+				subdivide(leftIndex, first, leftCount, depth + 1);
+			}
+			subdivide(leftIndex + 1, first + leftCount, count - leftCount, depth + 1);
+		}
+
+	public:
+		std::vector<Node> nodes;
+		/** @brief Original index of each triangle in leaf order */
+		std::vector<uint32_t> indices;
+		/** @brief Nodes with this many triangles or less are never split */
+		uint32_t minLeafSize = 1;
+		/** @brief Nodes with more triangles are always split if possible, smaller nodes only if the split is cheaper */
+		uint32_t maxLeafSize = 8;
+		/** @brief Limits the traversal stack size required by shaders, nodes at this depth become leaves */
+		uint32_t maxDepth = 32;
+		/** @brief Depth of the deepest leaf of the last build */
+		uint32_t depth = 0;
+
+		/**
+		* Build the hierarchy
+		*
+		* @param vertices Three vertices per triangle
+		* @param scheduler (Optional) Scheduler to build large subtrees in parallel on, the node order then differs between builds
+		*/
+		void build(const std::vector<glm::vec3> &vertices, TaskScheduler *scheduler = nullptr)
+		{
+			uint32_t triangleCount = static_cast<uint32_t>(vertices.size() / 3);
+			nodes.clear();
+			indices.resize(triangleCount);
+			triangleBounds.resize(triangleCount);
+			centroids.resize(triangleCount);
+			for (uint32_t i = 0; i < triangleCount; i++) {
+				indices[i] = i;
+				triangleBounds[i] = Bounds();
+				triangleBounds[i].grow(vertices[i * 3]);
+				triangleBounds[i].grow(vertices[i * 3 + 1]);
+				triangleBounds[i].grow(vertices[i * 3 + 2]);
+				centroids[i] = (vertices[i * 3] + vertices[i * 3 + 1] + vertices[i * 3 + 2]) / 3.0f;
+			}
+			// Every leaf holds at least one triangle, so there are less than twice as many nodes as triangles
+			nodes.resize(std::max(triangleCount, 1u) * 2);
+			BuildState state;
+			state.scheduler = scheduler;
+			state.nodeCount = 1;
+			buildState = &state;
+			subdivide(0, 0, triangleCount, 0);
+			if (scheduler) {
+				scheduler->wait(state.group);
+			}
+			buildState = nullptr;
+			nodes.resize(state.nodeCount.load());
+			depth = state.depth.load();
+			triangleBounds.clear();
+			centroids.clear();
+		}
+
+		/** @brief Reorder per triangle data (e.g. the triangles passed to the shader) to match the leaves */
+		template<typename T>
+		void reorder(std::vector<T> &items) const
+		{
+			std::vector<T> ordered;
+			ordered.reserve(indices.size());
+			for (auto index : indices) {
+				ordered.push_back(items[index]);
+			}
+			items.swap(ordered);
+		}
+	};
+}
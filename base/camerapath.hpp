@@ -0,0 +1,263 @@
+/*
+* Camera path recording and replay
+*
+* Records the camera, the animation timer and the UI inputs of every frame to a compact binary file
+* Replaying such a file renders the same sequence of views with a fixed time step, so benchmark results can be compared between builds and machines
+* A recording can be split into segments (e.g. a fly through and a close up), replay statistics are reported per segment
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <glm/glm.hpp>
+#include "benchmark.hpp"
+
+namespace vks
+{
+	class CameraPath
+	{
+	public:
+		enum MouseButtons : uint8_t {
+			MOUSE_BUTTON_LEFT = 1,
+			MOUSE_BUTTON_RIGHT = 2,
+			MOUSE_BUTTON_MIDDLE = 4
+		};
+
+		/** @brief State captured at the start of a frame */
+		struct Frame
+		{
+			glm::vec3 position;
+			glm::vec3 rotation;
+			float timer;
+			glm::vec2 mousePos;
+			// Combination of MouseButtons
+			uint8_t mouseButtons;
+			uint16_t segment;
+		};
+
+		/** @brief Replay statistics of a segment, in milliseconds */
+		struct SegmentResult
+		{
+			std::string name;
+			Benchmark::Statistics frameTime;
+			Benchmark::Statistics cpuTime;
+			Benchmark::Statistics gpuTime;
+		};
+
+	private:
+		// "VKCP" when read as bytes on a little endian machine
+		static const uint32_t fileMagic = 0x50434B56;
+		static const uint32_t fileVersion = 1;
+
+		enum class Mode { none, record, replay };
+		Mode mode = Mode::none;
+		std::string filename;
+		std::vector<Frame> frames;
+		uint16_t segmentCount = 1;
+		std::chrono::steady_clock::time_point recordingStart;
+		std::vector<SegmentResult> results;
+
+		template<typename T>
+		static void write(std::ofstream &file, const T &value)
+		{
+			file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		template<typename T>
+		static void read(std::ifstream &file, T &value)
+		{
+			file.read(reinterpret_cast<char*>(&value), sizeof(T));
+		}
+
+	public:
+		/** @brief Time step in seconds the frames are replayed with, the mean frame time of the recording */
+		float timestep = 1.0f / 60.0f;
+		/** @brief Number of times the whole path is rendered before measuring (warms up caches, clocks and lazily created resources) */
+		uint32_t warmupPasses = 1;
+		/** @brief Number of times the whole path is rendered while measuring */
+		uint32_t passes = 1;
+
+		bool recording() const { return mode == Mode::record; }
+		bool replaying() const { return mode == Mode::replay; }
+		const std::vector<Frame> &getFrames() const { return frames; }
+		uint32_t getSegmentCount() const { return segmentCount; }
+		const std::vector<SegmentResult> &getResults() const { return results; }
+
+		/** @brief Record every frame from now on, the path is written to the given file by save() */
+		void startRecording(const std::string &filename)
+		{
+			this->filename = filename;
+			frames.clear();
+			segmentCount = 1;
+			mode = Mode::record;
+		}
+
+		/** @brief Append the state of the current frame to the recording */
+		void record(const Frame &frame)
+		{
+			if (!recording()) {
+				return;
+			}
+			if (frames.empty()) {
+				recordingStart = std::chrono::steady_clock::now();
+			}
+			frames.push_back(frame);
+			frames.back().segment = segmentCount - 1;
+		}
+
+		/** @brief Start a new segment with the next recorded frame */
+		void addSegment()
+		{
+			if (!recording() || frames.empty() || (frames.back().segment != segmentCount - 1)) {
+				return;
+			}
+			segmentCount++;
+			std::cout << "Camera path: segment " << segmentCount << " starts at frame " << frames.size() << std::endl;
+		}
+
+		/** @brief Write the recording to the file passed to startRecording */
+		bool save()
+		{
+			if (!recording() || frames.empty()) {
+				return false;
+			}
+			if (frames.size() > 1) {
+				double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - recordingStart).count();
+				timestep = (float)(elapsed / (double)(frames.size() - 1));
+			}
+			std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!file.is_open()) {
+				std::cerr << "Could not write camera path to \"" << filename << "\"" << std::endl;
+				return false;
+			}
+			// Fields are written one by one, so the file doesn't depend on the padding of Frame
+			write(file, (uint32_t)fileMagic);
+			write(file, (uint32_t)fileVersion);
+			write(file, (uint32_t)frames.size());
+			write(file, (uint32_t)segmentCount);
+			write(file, timestep);
+			for (auto &frame : frames) {
+				write(file, frame.position);
+				write(file, frame.rotation);
+				write(file, frame.timer);
+				write(file, frame.mousePos);
+				write(file, frame.mouseButtons);
+				write(file, frame.segment);
+			}
+			if (!file.good()) {
+				return false;
+			}
+			std::cout << "Camera path with " << frames.size() << " frames in " << segmentCount << " segment(s) written to " << filename << std::endl;
+			return true;
+		}
+
+		/**
+		* Load a recorded path for replay
+		*
+		* @return False if the file could not be read or is not a camera path
+		*/
+		bool load(const std::string &filename)
+		{
+			std::ifstream file(filename, std::ios::in | std::ios::binary);
+			if (!file.is_open()) {
+				std::cerr << "Could not open camera path \"" << filename << "\"" << std::endl;
+				return false;
+			}
+			uint32_t magic = 0, version = 0, frameCount = 0, segments = 0;
+			read(file, magic);
+			read(file, version);
+			read(file, frameCount);
+			read(file, segments);
+			read(file, timestep);
+			if (!file.good() || (magic != fileMagic) || (version != fileVersion) || (frameCount == 0) || (segments == 0) || (segments > 0xFFFF) || !(timestep > 0.0f)) {
+				std::cerr << "\"" << filename << "\" is not a valid camera path" << std::endl;
+				return false;
+			}
+			frames.resize(frameCount);
+			for (auto &frame : frames) {
+				read(file, frame.position);
+				read(file, frame.rotation);
+				read(file, frame.timer);
+				read(file, frame.mousePos);
+				read(file, frame.mouseButtons);
+				read(file, frame.segment);
+				if (frame.segment >= segments) {
+					file.setstate(std::ios::failbit);
+				}
+			}
+			if (!file.good()) {
+				std::cerr << "Camera path \"" << filename << "\" is truncated or corrupt" << std::endl;
+				frames.clear();
+				return false;
+			}
+			this->filename = filename;
+			segmentCount = (uint16_t)segments;
+			mode = Mode::replay;
+			return true;
+		}
+
+		/**
+		* Split the samples measured while replaying into per segment statistics, plus the statistics of the whole path
+		*
+		* @param frameTimes Frame time of every replayed frame, in path order (passes times the number of frames)
+		* @param cpuTimes CPU time of every replayed frame
+		* @param gpuTimes GPU time of every replayed frame, only split into segments if there is one sample per frame
+		* @param benchmark Provides the statistics settings (e.g. batch size of the confidence interval)
+		*/
+		void computeResults(const std::vector<double> &frameTimes, const std::vector<double> &cpuTimes, const std::vector<double> &gpuTimes, const Benchmark &benchmark)
+		{
+			std::vector<std::vector<double>> segmentFrameTimes(segmentCount), segmentCpuTimes(segmentCount), segmentGpuTimes(segmentCount);
+			bool gpuTimesPerFrame = gpuTimes.size() == frameTimes.size();
+			for (size_t i = 0; i < frameTimes.size(); i++) {
+				uint16_t segment = frames[i % frames.size()].segment;
+				segmentFrameTimes[segment].push_back(frameTimes[i]);
+				if (i < cpuTimes.size()) {
+					segmentCpuTimes[segment].push_back(cpuTimes[i]);
+				}
+				if (gpuTimesPerFrame) {
+					segmentGpuTimes[segment].push_back(gpuTimes[i]);
+				}
+			}
+			results.clear();
+			for (uint16_t i = 0; i < segmentCount; i++) {
+				results.push_back({ "segment " + std::to_string(i + 1), benchmark.getStatistics(segmentFrameTimes[i]), benchmark.getStatistics(segmentCpuTimes[i]), benchmark.getStatistics(segmentGpuTimes[i]) });
+			}
+			results.push_back({ "all", benchmark.getStatistics(frameTimes), benchmark.getStatistics(cpuTimes), benchmark.getStatistics(gpuTimes) });
+		}
+
+		void printResults() const
+		{
+			std::cout << std::fixed << std::setprecision(3);
+			std::cout << "Camera path replay, " << frames.size() << " frames with a time step of " << timestep * 1000.0f << " ms:" << std::endl;
+			for (auto &result : results) {
+				std::cout << result.name << ": " << result.frameTime.count << " frames, frame time mean " << result.frameTime.mean << " ms, p50 " << result.frameTime.p50 << " ms, p95 " << result.frameTime.p95 << " ms, p99 " << result.frameTime.p99 << " ms, max " << result.frameTime.max << " ms"
+					<< ", cpu mean " << result.cpuTime.mean << " ms, gpu mean " << result.gpuTime.mean << " ms" << std::endl;
+			}
+		}
+
+		/** @brief Write the replay statistics as a CSV table with one row per segment */
+		bool saveResults(const std::string &filename) const
+		{
+			std::ofstream table(filename, std::ios::out | std::ios::trunc);
+			if (!table.is_open()) {
+				return false;
+			}
+			table << std::fixed << std::setprecision(4);
+			table << "segment,frames,frame mean (ms),frame ci95 (ms),frame p50 (ms),frame p95 (ms),frame p99 (ms),frame max (ms),cpu mean (ms),cpu p99 (ms),gpu mean (ms),gpu p99 (ms)" << std::endl;
+			for (auto &result : results) {
+				table << result.name << "," << result.frameTime.count << ","
+					<< result.frameTime.mean << "," << result.frameTime.confidence << "," << result.frameTime.p50 << "," << result.frameTime.p95 << "," << result.frameTime.p99 << "," << result.frameTime.max << ","
+					<< result.cpuTime.mean << "," << result.cpuTime.p99 << ","
+					<< result.gpuTime.mean << "," << result.gpuTime.p99 << std::endl;
+			}
+			return table.good();
+		}
+	};
+}
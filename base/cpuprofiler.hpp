@@ -0,0 +1,259 @@
+/*
+* CPU profiler
+*
+* Measures the CPU time of named scopes with RAII objects (see VKS_CPU_SCOPE)
+* Every thread writes to its own fixed size ring buffer without locks, so recording a scope only costs two clock reads and a few stores
+* When a ring buffer is full the oldest records are overwritten
+* Each slot of a ring buffer carries the number of the record it holds, so a snapshot taken while the thread records skips records that are being overwritten
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <algorithm>
+
+namespace vks
+{
+	namespace cpuprofiler
+	{
+		/** @brief A single execution of a scope, times are in nanoseconds since the profiler's epoch */
+		struct Record
+		{
+			// Must point to a string that outlives the profiler, e.g. a string literal
+			const char *name;
+			uint64_t start;
+			uint64_t end;
+		};
+
+		/** @brief Ring buffer of records written by a single thread */
+		class ThreadBuffer
+		{
+		private:
+			// A record and its sequence number (index of the record + 1), which is 0 while the record is being written
+			struct Slot
+			{
+				std::atomic<uint64_t> sequence{ 0 };
+				std::atomic<const char*> name{ nullptr };
+				std::atomic<uint64_t> start{ 0 };
+				std::atomic<uint64_t> end{ 0 };
+			};
+			std::unique_ptr<Slot[]> slots;
+			uint64_t mask;
+			// Number of records written so far, only modified by the owning thread
+			std::atomic<uint64_t> head{ 0 };
+		public:
+			const uint32_t id;
+			const std::string name;
+
+			ThreadBuffer(uint32_t id, const std::string &name, uint32_t capacity) : id(id), name(name)
+			{
+				// Capacity is rounded up to a power of two so the ring index is a mask
+				uint64_t size = 1;
+				while (size < capacity) {
+					size <<= 1;
+				}
+				slots.reset(new Slot[(size_t)size]);
+				mask = size - 1;
+			}
+
+			/** @brief Append a record, must only be called by the thread owning this buffer */
+			void push(const char *name, uint64_t start, uint64_t end)
+			{
+				uint64_t index = head.load(std::memory_order_relaxed);
+				Slot &slot = slots[(size_t)(index & mask)];
+				slot.sequence.store(0, std::memory_order_relaxed);
+				// Orders the invalidation before the writes, so a reader that sees any of them also sees the slot as invalid
+				std::atomic_thread_fence(std::memory_order_release);
+				slot.name.store(name, std::memory_order_relaxed);
+				slot.start.store(start, std::memory_order_relaxed);
+				slot.end.store(end, std::memory_order_relaxed);
+				slot.sequence.store(index + 1, std::memory_order_release);
+				head.store(index + 1, std::memory_order_release);
+			}
+
+			/**
+			* Copy the records currently stored in the buffer
+			*
+			* @note Records that get overwritten by the owning thread while copying are skipped, for exact results call this while the thread is idle
+			*/
+			std::vector<Record> snapshot() const
+			{
+				uint64_t end = head.load(std::memory_order_acquire);
+				uint64_t size = mask + 1;
+				uint64_t begin = (end > size) ? end - size : 0;
+				std::vector<Record> result;
+				result.reserve((size_t)(end - begin));
+				for (uint64_t i = begin; i < end; i++) {
+					const Slot &slot = slots[(size_t)(i & mask)];
+					// Skipped if the slot is being written or already holds a newer record
+					uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+					if (sequence != i + 1) {
+						continue;
+					}
+					Record record;
+					record.name = slot.name.load(std::memory_order_relaxed);
+					record.start = slot.start.load(std::memory_order_relaxed);
+					record.end = slot.end.load(std::memory_order_relaxed);
+					// Torn if the owning thread started overwriting the slot while it was read
+					std::atomic_thread_fence(std::memory_order_acquire);
+					if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+						continue;
+					}
+					result.push_back(record);
+				}
+				return result;
+			}
+		};
+
+		class Profiler
+		{
+		private:
+			std::mutex threadsMutex;
+			std::vector<std::unique_ptr<ThreadBuffer>> threads;
+		public:
+			std::atomic<bool> enabled{ false };
+			/** @brief Number of records kept per thread, must be set before the first scope is recorded */
+			uint32_t recordsPerThread = 1 << 16;
+			const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+			// Records starting before this time (in nanoseconds since the epoch) are not exported
+			std::atomic<uint64_t> discardBefore{ 0 };
+
+			/** @brief Create the ring buffer for the calling thread, only done once per thread */
+			ThreadBuffer *registerThread(const std::string &name)
+			{
+				std::lock_guard<std::mutex> lock(threadsMutex);
+				uint32_t id = static_cast<uint32_t>(threads.size());
+				threads.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer(id, name.empty() ? "Thread " + std::to_string(id) : name, recordsPerThread)));
+				return threads.back().get();
+			}
+
+			/** @brief Call a function for the buffer of every thread that recorded scopes */
+			template<typename F>
+			void forEachThread(F function)
+			{
+				std::lock_guard<std::mutex> lock(threadsMutex);
+				for (auto &thread : threads) {
+					function(*thread);
+				}
+			}
+		};
+
+		/** @brief The process wide profiler instance */
+		inline Profiler &get()
+		{
+			static Profiler profiler;
+			return profiler;
+		}
+
+		/** @brief Current time in nanoseconds since the profiler's epoch */
+		inline uint64_t now()
+		{
+			return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - get().epoch).count();
+		}
+
+		inline std::string &threadName()
+		{
+			static thread_local std::string name;
+			return name;
+		}
+
+		/** @brief Name shown for the calling thread in the trace, must be set before the thread records its first scope */
+		inline void setThreadName(const std::string &name)
+		{
+			threadName() = name;
+		}
+
+		/** @brief Ring buffer of the calling thread, created on first use */
+		inline ThreadBuffer *threadBuffer()
+		{
+			static thread_local ThreadBuffer *buffer = nullptr;
+			if (buffer == nullptr) {
+				buffer = get().registerThread(threadName());
+			}
+			return buffer;
+		}
+
+		/** @brief Records the time between its construction and destruction if the profiler is enabled */
+		class Scope
+		{
+		private:
+			const char *name;
+			uint64_t start;
+		public:
+			Scope(const char *name) : name(get().enabled.load(std::memory_order_relaxed) ? name : nullptr)
+			{
+				if (this->name) {
+					start = now();
+				}
+			}
+
+			~Scope()
+			{
+				if (name) {
+					uint64_t end = now();
+					threadBuffer()->push(name, start, end);
+				}
+			}
+
+			Scope(const Scope&) = delete;
+			Scope &operator=(const Scope&) = delete;
+		};
+
+		/** @brief Discard all records made so far (e.g. after warming up), the ring buffers are left untouched so this is safe while other threads record */
+		inline void clear()
+		{
+			get().discardBefore.store(now(), std::memory_order_relaxed);
+		}
+
+		/** @brief Escape a string for use in JSON */
+		inline std::string escapeJson(const std::string &value)
+		{
+			std::string escaped;
+			for (char c : value) {
+				if ((c == '"') || (c == '\\')) {
+					escaped += '\\';
+				}
+				escaped += c;
+			}
+			return escaped;
+		}
+
+		/**
+		* Write the recorded scopes as Chrome trace events, each thread is shown as a separate track of the "CPU" process
+		*
+		* @param trace Stream the events are appended to
+		* @param first True if no event has been written to the stream yet (events are comma separated), updated accordingly
+		*/
+		inline void writeTraceEvents(std::ostream &trace, bool &first)
+		{
+			const uint32_t pid = 0;
+			trace << (first ? "" : ",\n") << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"CPU\"}}";
+			first = false;
+			uint64_t discardBefore = get().discardBefore.load(std::memory_order_relaxed);
+			get().forEachThread([&](ThreadBuffer &thread) {
+				trace << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << thread.id << ",\"args\":{\"name\":\"" << escapeJson(thread.name) << "\"}}";
+				for (auto &record : thread.snapshot()) {
+					if (record.start < discardBefore) {
+						continue;
+					}
+					// Timestamps are in microseconds
+					trace << ",\n{\"name\":\"" << escapeJson(record.name) << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << thread.id
+						<< ",\"ts\":" << (double)record.start / 1000.0 << ",\"dur\":" << (double)(record.end - record.start) / 1000.0 << "}";
+				}
+			});
+		}
+	}
+}
+
+// Profile the CPU time of the enclosing block, name must be a string literal
+#define VKS_CPU_SCOPE_CONCAT_(a, b) a##b
+#define VKS_CPU_SCOPE_CONCAT(a, b) VKS_CPU_SCOPE_CONCAT_(a, b)
+#define VKS_CPU_SCOPE(name) vks::cpuprofiler::Scope VKS_CPU_SCOPE_CONCAT(cpuProfilerScope, __LINE__)(name)
@@ -0,0 +1,876 @@
+/*
+* CPU ray tracer
+*
+* Traces the scene of the compute shader ray tracer (the triangles in BVH leaf order and the vks::BVH built for them) with the same shading on the CPU
+* Serves as a fallback for machines without a usable GPU and as a reference for validating the output of the compute shader
+* The binary hierarchy is collapsed into a four wide one, so the four child boxes of a node and four triangles of a leaf are tested at once with SSE (plain C++ on other architectures)
+* The image is split into tiles that are traced in parallel, the calling thread takes tiles too
+* Primary rays can be traced in packets of 4x4 pixels: nodes are culled for the whole packet with an interval arithmetic test of the packet's frustum,
+* rays leave the packet and continue one by one once only a few of them still hit a subtree
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "bvh.hpp"
+#include "taskscheduler.hpp"
+#include "cpuprofiler.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define VKS_CPU_RAYTRACER_SSE
+#include <emmintrin.h>
+#endif
+
+namespace vks
+{
+	class CpuRayTracer
+	{
+	public:
+		/** @brief Per frame parameters, same meaning as the members of the compute shader's uniform block */
+		struct Settings
+		{
+			glm::vec3 cameraPos;
+			float aspectRatio;
+			glm::vec3 lightPos;
+			glm::vec3 background;
+			uint32_t accumulationFrame;
+			bool accumulate;
+			uint32_t aoSamples;
+			float aoRadius;
+			float reflectionStrength;
+		};
+
+		/** @brief Work done by the last call to render */
+		struct Statistics
+		{
+			uint64_t rays;
+			// Visited four wide nodes, not comparable to the binary nodes visited by the compute shader
+			uint64_t nodesVisited;
+			uint64_t triangleTests;
+			// Subtrees traversed by single rays that have left their packet
+			uint64_t packetFallbacks;
+			double milliseconds;
+		};
+
+	private:
+		static const uint32_t invalidIndex = 0xFFFFFFFF;
+		static const uint32_t tileSize = 16;
+		static const uint32_t stackSize = 128;
+		// Packets cover packetSize x packetSize pixels, the tile size is a multiple of it
+		static const uint32_t packetSize = 4;
+		static const uint32_t packetRays = packetSize * packetSize;
+		// Rays of a packet hitting a child are traced individually if there are fewer than this
+		static const uint32_t packetMinRays = 4;
+
+		// Same constants as the compute shader
+		const float epsilon = 0.0001f;
+		const float maxLength = 1000.0f;
+
+		// Four children of an inner node, the bounds are stored as structure of arrays for SIMD tests
+		struct Node4
+		{
+			float minX[4], minY[4], minZ[4];
+			float maxX[4], maxY[4], maxZ[4];
+			// Inner children: index of the node. Leaf children: index of the first triangle packet
+			uint32_t child[4];
+			// Number of triangle packets of leaf children, zero for inner children
+			uint32_t packetCount[4];
+			// Used children are stored first
+			uint32_t childCount;
+		};
+
+		// Four triangles of a leaf, padded with degenerate triangles that are never hit
+		struct TrianglePacket
+		{
+			float v0x[4], v0y[4], v0z[4];
+			float e1x[4], e1y[4], e1z[4];
+			float e2x[4], e2y[4], e2z[4];
+			// Index in the triangle array, invalidIndex for padding
+			uint32_t index[4];
+			uint32_t count;
+		};
+
+		// Data needed for shading a hit
+		struct Triangle
+		{
+			glm::vec3 v0, e1, e2;
+			glm::vec3 normal;
+			glm::vec3 diffuse;
+			float specular;
+		};
+
+		struct Hit
+		{
+			uint32_t triangle;
+			float t;
+			glm::vec2 barycentrics;
+		};
+
+		struct Counters
+		{
+			uint64_t rays = 0;
+			uint64_t nodesVisited = 0;
+			uint64_t triangleTests = 0;
+			uint64_t packetFallbacks = 0;
+		};
+
+		// Primary rays of a block of pixels, stored as structure of arrays for SIMD tests
+		struct RayPacket
+		{
+			float dirX[packetRays], dirY[packetRays], dirZ[packetRays];
+			float invX[packetRays], invY[packetRays], invZ[packetRays];
+			float t[packetRays];
+			uint32_t triangle[packetRays];
+			glm::vec2 barycentrics[packetRays];
+			// Rays of pixels inside the image
+			uint32_t active;
+			// Range of the inverse directions of the active rays
+			glm::vec3 invMin, invMax;
+		};
+
+		std::vector<Node4> nodes;
+		std::vector<TrianglePacket> packets;
+		std::vector<Triangle> triangles;
+		// Running average of the samples when accumulating
+		std::vector<glm::vec3> accumulation;
+		// Own threads, used unless a shared scheduler has been set
+		TaskScheduler ownScheduler;
+		TaskScheduler *scheduler = &ownScheduler;
+		Statistics statistics = {};
+
+		static float surfaceArea(const BVH::Node &node)
+		{
+			glm::vec3 extent = node.max - node.min;
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+
+		uint32_t packLeaf(uint32_t first, uint32_t count)
+		{
+			uint32_t firstPacket = static_cast<uint32_t>(packets.size());
+			for (uint32_t i = 0; i < count; i += 4) {
+				TrianglePacket packet = {};
+				packet.count = std::min(count - i, 4u);
+				for (uint32_t lane = 0; lane < 4; lane++) {
+					packet.index[lane] = invalidIndex;
+					if (lane >= packet.count) {
+						continue;
+					}
+					const Triangle &triangle = triangles[first + i + lane];
+					packet.index[lane] = first + i + lane;
+					packet.v0x[lane] = triangle.v0.x;
+					packet.v0y[lane] = triangle.v0.y;
+					packet.v0z[lane] = triangle.v0.z;
+					packet.e1x[lane] = triangle.e1.x;
+					packet.e1y[lane] = triangle.e1.y;
+					packet.e1z[lane] = triangle.e1.z;
+					packet.e2x[lane] = triangle.e2.x;
+					packet.e2y[lane] = triangle.e2.y;
+					packet.e2z[lane] = triangle.e2.z;
+				}
+				packets.push_back(packet);
+			}
+			return firstPacket;
+		}
+
+		void setChild(uint32_t nodeIndex, uint32_t slot, const BVH &bvh, uint32_t binaryIndex)
+		{
+			const BVH::Node &child = bvh.nodes[binaryIndex];
+			uint32_t childIndex = (child.count > 0) ? packLeaf(child.leftFirst, child.count) : collapse(bvh, binaryIndex);
+			// Nodes may have been reallocated while collapsing the child
+			Node4 &node = nodes[nodeIndex];
+			node.minX[slot] = child.min.x;
+			node.minY[slot] = child.min.y;
+			node.minZ[slot] = child.min.z;
+			node.maxX[slot] = child.max.x;
+			node.maxY[slot] = child.max.y;
+			node.maxZ[slot] = child.max.z;
+			node.child[slot] = childIndex;
+			node.packetCount[slot] = (child.count + 3) / 4;
+		}
+
+		// Turn an inner node of the binary hierarchy and up to two levels below it into a four wide node
+		uint32_t collapse(const BVH &bvh, uint32_t binaryIndex)
+		{
+			uint32_t children[4] = { bvh.nodes[binaryIndex].leftFirst, bvh.nodes[binaryIndex].leftFirst + 1 };
+			uint32_t childCount = 2;
+			// Replace the inner child with the largest surface area by its children until there are four
+			while (childCount < 4) {
+				int32_t largest = -1;
+				float largestArea = -1.0f;
+				for (uint32_t i = 0; i < childCount; i++) {
+					const BVH::Node &child = bvh.nodes[children[i]];
+					if ((child.count == 0) && (surfaceArea(child) > largestArea)) {
+						largestArea = surfaceArea(child);
+						largest = (int32_t)i;
+					}
+				}
+				if (largest < 0) {
+					break;
+				}
+				uint32_t opened = children[largest];
+				children[largest] = bvh.nodes[opened].leftFirst;
+				children[childCount++] = bvh.nodes[opened].leftFirst + 1;
+			}
+			uint32_t nodeIndex = static_cast<uint32_t>(nodes.size());
+			nodes.push_back(Node4());
+			nodes[nodeIndex].childCount = childCount;
+			for (uint32_t i = 0; i < childCount; i++) {
+				setChild(nodeIndex, i, bvh, children[i]);
+			}
+			return nodeIndex;
+		}
+
+		// Slab test of the four child boxes of a node, returns a bit mask of the hit children
+		uint32_t intersectBoxes(const Node4 &node, const glm::vec3 &origin, const glm::vec3 &invDirection, float maxT, float *tNear) const
+		{
+#if defined(VKS_CPU_RAYTRACER_SSE)
+			const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+			const __m128 idx = _mm_set1_ps(invDirection.x), idy = _mm_set1_ps(invDirection.y), idz = _mm_set1_ps(invDirection.z);
+			__m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), idx);
+			__m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), idx);
+			__m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), idy);
+			__m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), idy);
+			__m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), idz);
+			__m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), idz);
+			__m128 tMin = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+			__m128 tMax = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+			__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(tMin, tMax), _mm_cmpgt_ps(tMax, _mm_setzero_ps())), _mm_cmplt_ps(tMin, _mm_set1_ps(maxT)));
+			_mm_storeu_ps(tNear, _mm_max_ps(tMin, _mm_setzero_ps()));
+			return static_cast<uint32_t>(_mm_movemask_ps(hit));
+#else
+			uint32_t mask = 0;
+			for (uint32_t i = 0; i < 4; i++) {
+				glm::vec3 t0 = (glm::vec3(node.minX[i], node.minY[i], node.minZ[i]) - origin) * invDirection;
+				glm::vec3 t1 = (glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]) - origin) * invDirection;
+				glm::vec3 tMin = glm::min(t0, t1);
+				glm::vec3 tMax = glm::max(t0, t1);
+				float tEntry = std::max(std::max(tMin.x, tMin.y), tMin.z);
+				float tExit = std::min(std::min(tMax.x, tMax.y), tMax.z);
+				tNear[i] = std::max(tEntry, 0.0f);
+				if ((tEntry <= tExit) && (tExit > 0.0f) && (tEntry < maxT)) {
+					mask |= 1u << i;
+				}
+			}
+			return mask;
+#endif
+		}
+
+		// Moeller-Trumbore test of the four triangles of a packet with the same tolerances as the compute shader, updates the hit if a closer one is found
+		bool intersectPacket(const TrianglePacket &packet, const glm::vec3 &origin, const glm::vec3 &direction, Hit &hit) const
+		{
+			float t[4], u[4], v[4];
+			uint32_t mask = 0;
+#if defined(VKS_CPU_RAYTRACER_SSE)
+			const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+			const __m128 e1x = _mm_loadu_ps(packet.e1x), e1y = _mm_loadu_ps(packet.e1y), e1z = _mm_loadu_ps(packet.e1z);
+			const __m128 e2x = _mm_loadu_ps(packet.e2x), e2y = _mm_loadu_ps(packet.e2y), e2z = _mm_loadu_ps(packet.e2z);
+			const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+			// h = cross(d, e2), a = dot(e1, h)
+			__m128 hx = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+			__m128 hy = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+			__m128 hz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+			__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, hx), _mm_mul_ps(e1y, hy)), _mm_mul_ps(e1z, hz));
+			__m128 valid = _mm_or_ps(_mm_cmplt_ps(a, _mm_set1_ps(-0.00001f)), _mm_cmpgt_ps(a, _mm_set1_ps(0.00001f)));
+			__m128 f = _mm_div_ps(one, a);
+			// s = o - v0, u = f * dot(s, h)
+			__m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.v0x));
+			__m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.v0y));
+			__m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.v0z));
+			__m128 uu = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, hx), _mm_mul_ps(sy, hy)), _mm_mul_ps(sz, hz)));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+			// q = cross(s, e1), v = f * dot(d, q)
+			__m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+			__m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+			__m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+			__m128 vv = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+			// t = f * dot(e2, q)
+			__m128 tt = _mm_mul_ps(f, _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)));
+			valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tt, _mm_set1_ps(0.00001f)), _mm_cmplt_ps(tt, _mm_set1_ps(hit.t))));
+			mask = static_cast<uint32_t>(_mm_movemask_ps(valid));
+			if (mask == 0) {
+				return false;
+			}
+			_mm_storeu_ps(t, tt);
+			_mm_storeu_ps(u, uu);
+			_mm_storeu_ps(v, vv);
+#else
+			for (uint32_t i = 0; i < packet.count; i++) {
+				glm::vec3 e1(packet.e1x[i], packet.e1y[i], packet.e1z[i]);
+				glm::vec3 e2(packet.e2x[i], packet.e2y[i], packet.e2z[i]);
+				glm::vec3 h = glm::cross(direction, e2);
+				float a = glm::dot(e1, h);
+				if (a > -0.00001f && a < 0.00001f) {
+					continue;
+				}
+				float f = 1.0f / a;
+				glm::vec3 s = origin - glm::vec3(packet.v0x[i], packet.v0y[i], packet.v0z[i]);
+				u[i] = f * glm::dot(s, h);
+				if (u[i] < 0.0f || u[i] > 1.0f) {
+					continue;
+				}
+				glm::vec3 q = glm::cross(s, e1);
+				v[i] = f * glm::dot(direction, q);
+				if (v[i] < 0.0f || u[i] + v[i] > 1.0f) {
+					continue;
+				}
+				t[i] = f * glm::dot(e2, q);
+				if ((t[i] > 0.00001f) && (t[i] < hit.t)) {
+					mask |= 1u << i;
+				}
+			}
+			if (mask == 0) {
+				return false;
+			}
+#endif
+			for (uint32_t i = 0; i < 4; i++) {
+				if ((mask & (1u << i)) && (t[i] < hit.t)) {
+					hit.t = t[i];
+					hit.triangle = packet.index[i];
+					hit.barycentrics = glm::vec2(u[i], v[i]);
+				}
+			}
+			return true;
+		}
+
+		// Order the children set in mask farthest first, so the closest one ends up on top of the stack, returns the number of children
+		static uint32_t sortFarthestFirst(uint32_t mask, const float *tNear, uint32_t *order)
+		{
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < 4; i++) {
+				if (mask & (1u << i)) {
+					uint32_t j = count++;
+					while ((j > 0) && (tNear[order[j - 1]] < tNear[i])) {
+						order[j] = order[j - 1];
+						j--;
+					}
+					order[j] = i;
+				}
+			}
+			return count;
+		}
+
+		// Traverse the subtree of a child (a node or the triangle packets of a leaf), only hits closer than hit.t are taken
+		bool traverse(uint32_t child, uint32_t packetCount, const glm::vec3 &origin, const glm::vec3 &direction, bool anyHit, Hit &hit, Counters &counters) const
+		{
+			const glm::vec3 invDirection = 1.0f / direction;
+
+			struct StackEntry
+			{
+				uint32_t child;
+				uint32_t packetCount;
+				float tNear;
+			};
+			StackEntry stack[stackSize];
+			uint32_t stackTop = 0;
+			stack[stackTop++] = { child, packetCount, 0.0f };
+			while (stackTop > 0) {
+				const StackEntry entry = stack[--stackTop];
+				// Skip subtrees behind a hit found after they have been pushed
+				if (entry.tNear >= hit.t) {
+					continue;
+				}
+				if (entry.packetCount > 0) {
+					for (uint32_t i = entry.child; i < entry.child + entry.packetCount; i++) {
+						counters.triangleTests += packets[i].count;
+						if (intersectPacket(packets[i], origin, direction, hit) && anyHit) {
+							return true;
+						}
+					}
+					continue;
+				}
+				counters.nodesVisited++;
+				const Node4 &node = nodes[entry.child];
+				float tNear[4];
+				uint32_t mask = intersectBoxes(node, origin, invDirection, hit.t, tNear) & ((1u << node.childCount) - 1);
+				uint32_t order[4];
+				uint32_t count = sortFarthestFirst(mask, tNear, order);
+				for (uint32_t i = 0; (i < count) && (stackTop < stackSize); i++) {
+					stack[stackTop++] = { node.child[order[i]], node.packetCount[order[i]], tNear[order[i]] };
+				}
+			}
+			return hit.triangle != invalidIndex;
+		}
+
+		static uint32_t countBits(uint32_t mask)
+		{
+			uint32_t count = 0;
+			for (; mask; mask &= mask - 1) {
+				count++;
+			}
+			return count;
+		}
+
+		// Test of the four child boxes of a node against all rays of a packet at once (interval arithmetic)
+		// The rays share their origin and the signs of their directions, so the ranges of their entry and exit distances follow from the range of the inverse directions
+		// Conservative: a child that is missed here is missed by every ray of the packet
+		uint32_t intersectBoxesFrustum(const Node4 &node, const glm::vec3 &origin, const RayPacket &packet, float maxT, float *tNear) const
+		{
+#if defined(VKS_CPU_RAYTRACER_SSE)
+			__m128 entry[3], exit[3];
+			const float *mins[3] = { node.minX, node.minY, node.minZ };
+			const float *maxs[3] = { node.maxX, node.maxY, node.maxZ };
+			for (uint32_t axis = 0; axis < 3; axis++) {
+				const bool negative = packet.invMax[axis] < 0.0f;
+				const __m128 o = _mm_set1_ps(origin[axis]);
+				const __m128 lo = _mm_set1_ps(packet.invMin[axis]);
+				const __m128 hi = _mm_set1_ps(packet.invMax[axis]);
+				__m128 nearPlane = _mm_sub_ps(_mm_loadu_ps(negative ? maxs[axis] : mins[axis]), o);
+				__m128 farPlane = _mm_sub_ps(_mm_loadu_ps(negative ? mins[axis] : maxs[axis]), o);
+				entry[axis] = _mm_min_ps(_mm_mul_ps(nearPlane, lo), _mm_mul_ps(nearPlane, hi));
+				exit[axis] = _mm_max_ps(_mm_mul_ps(farPlane, lo), _mm_mul_ps(farPlane, hi));
+			}
+			__m128 tEntry = _mm_max_ps(_mm_max_ps(entry[0], entry[1]), entry[2]);
+			__m128 tExit = _mm_min_ps(_mm_min_ps(exit[0], exit[1]), exit[2]);
+			__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(tEntry, tExit), _mm_cmpgt_ps(tExit, _mm_setzero_ps())), _mm_cmplt_ps(tEntry, _mm_set1_ps(maxT)));
+			_mm_storeu_ps(tNear, _mm_max_ps(tEntry, _mm_setzero_ps()));
+			return static_cast<uint32_t>(_mm_movemask_ps(hit));
+#else
+			uint32_t mask = 0;
+			for (uint32_t i = 0; i < 4; i++) {
+				const float mins[3] = { node.minX[i], node.minY[i], node.minZ[i] };
+				const float maxs[3] = { node.maxX[i], node.maxY[i], node.maxZ[i] };
+				float tEntry = -std::numeric_limits<float>::max();
+				float tExit = std::numeric_limits<float>::max();
+				for (uint32_t axis = 0; axis < 3; axis++) {
+					const bool negative = packet.invMax[axis] < 0.0f;
+					float nearPlane = (negative ? maxs[axis] : mins[axis]) - origin[axis];
+					float farPlane = (negative ? mins[axis] : maxs[axis]) - origin[axis];
+					tEntry = std::max(tEntry, std::min(nearPlane * packet.invMin[axis], nearPlane * packet.invMax[axis]));
+					tExit = std::min(tExit, std::max(farPlane * packet.invMin[axis], farPlane * packet.invMax[axis]));
+				}
+				tNear[i] = std::max(tEntry, 0.0f);
+				if ((tEntry <= tExit) && (tExit > 0.0f) && (tEntry < maxT)) {
+					mask |= 1u << i;
+				}
+			}
+			return mask;
+#endif
+		}
+
+		// Slab test of one child box of a node against every ray of a packet, returns a bit mask of the rays hitting it before their closest hit
+		uint32_t intersectBoxRays(const Node4 &node, uint32_t slot, const glm::vec3 &origin, const RayPacket &packet) const
+		{
+			uint32_t mask = 0;
+#if defined(VKS_CPU_RAYTRACER_SSE)
+			const __m128 minX = _mm_set1_ps(node.minX[slot] - origin.x), maxX = _mm_set1_ps(node.maxX[slot] - origin.x);
+			const __m128 minY = _mm_set1_ps(node.minY[slot] - origin.y), maxY = _mm_set1_ps(node.maxY[slot] - origin.y);
+			const __m128 minZ = _mm_set1_ps(node.minZ[slot] - origin.z), maxZ = _mm_set1_ps(node.maxZ[slot] - origin.z);
+			for (uint32_t i = 0; i < packetRays; i += 4) {
+				const __m128 idx = _mm_loadu_ps(packet.invX + i), idy = _mm_loadu_ps(packet.invY + i), idz = _mm_loadu_ps(packet.invZ + i);
+				__m128 t0x = _mm_mul_ps(minX, idx), t1x = _mm_mul_ps(maxX, idx);
+				__m128 t0y = _mm_mul_ps(minY, idy), t1y = _mm_mul_ps(maxY, idy);
+				__m128 t0z = _mm_mul_ps(minZ, idz), t1z = _mm_mul_ps(maxZ, idz);
+				__m128 tMin = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_min_ps(t0z, t1z));
+				__m128 tMax = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_max_ps(t0z, t1z));
+				__m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(tMin, tMax), _mm_cmpgt_ps(tMax, _mm_setzero_ps())), _mm_cmplt_ps(tMin, _mm_loadu_ps(packet.t + i)));
+				mask |= static_cast<uint32_t>(_mm_movemask_ps(hit)) << i;
+			}
+#else
+			const glm::vec3 boxMin = glm::vec3(node.minX[slot], node.minY[slot], node.minZ[slot]) - origin;
+			const glm::vec3 boxMax = glm::vec3(node.maxX[slot], node.maxY[slot], node.maxZ[slot]) - origin;
+			for (uint32_t i = 0; i < packetRays; i++) {
+				glm::vec3 invDirection(packet.invX[i], packet.invY[i], packet.invZ[i]);
+				glm::vec3 t0 = boxMin * invDirection;
+				glm::vec3 t1 = boxMax * invDirection;
+				glm::vec3 tMin = glm::min(t0, t1);
+				glm::vec3 tMax = glm::max(t0, t1);
+				float tEntry = std::max(std::max(tMin.x, tMin.y), tMin.z);
+				float tExit = std::min(std::min(tMax.x, tMax.y), tMax.z);
+				if ((tEntry <= tExit) && (tExit > 0.0f) && (tEntry < packet.t[i])) {
+					mask |= 1u << i;
+				}
+			}
+#endif
+			return mask;
+		}
+
+		// Closest hits of the active rays of a packet, which have to be coherent (see renderTile)
+		void intersectPacketRays(const glm::vec3 &origin, RayPacket &packet, Counters &counters) const
+		{
+			counters.rays += countBits(packet.active);
+			if (nodes.empty()) {
+				return;
+			}
+
+			struct StackEntry
+			{
+				uint32_t child;
+				uint32_t packetCount;
+				float tNear;
+				// Rays of the packet that hit the child
+				uint32_t rays;
+				// The rays traverse the child one by one
+				bool single;
+			};
+			StackEntry stack[stackSize];
+			uint32_t stackTop = 0;
+			stack[stackTop++] = { 0, 0, 0.0f, packet.active, false };
+			while (stackTop > 0) {
+				const StackEntry entry = stack[--stackTop];
+				// Farthest closest hit of the rays, subtrees behind it are skipped
+				float maxT = 0.0f;
+				for (uint32_t rays = entry.rays; rays; rays &= rays - 1) {
+					maxT = std::max(maxT, packet.t[countBits((rays & (~rays + 1)) - 1)]);
+				}
+				if (entry.tNear >= maxT) {
+					continue;
+				}
+				if (entry.single || (entry.packetCount > 0)) {
+					for (uint32_t rays = entry.rays; rays; rays &= rays - 1) {
+						uint32_t ray = countBits((rays & (~rays + 1)) - 1);
+						const glm::vec3 direction(packet.dirX[ray], packet.dirY[ray], packet.dirZ[ray]);
+						Hit hit = { packet.triangle[ray], packet.t[ray], packet.barycentrics[ray] };
+						if (entry.single) {
+							counters.packetFallbacks++;
+							traverse(entry.child, entry.packetCount, origin, direction, false, hit, counters);
+						} else {
+							for (uint32_t i = entry.child; i < entry.child + entry.packetCount; i++) {
+								counters.triangleTests += packets[i].count;
+								intersectPacket(packets[i], origin, direction, hit);
+							}
+						}
+						packet.triangle[ray] = hit.triangle;
+						packet.t[ray] = hit.t;
+						packet.barycentrics[ray] = hit.barycentrics;
+					}
+					continue;
+				}
+				counters.nodesVisited++;
+				const Node4 &node = nodes[entry.child];
+				float tNear[4];
+				uint32_t mask = intersectBoxesFrustum(node, origin, packet, maxT, tNear) & ((1u << node.childCount) - 1);
+				uint32_t order[4];
+				uint32_t count = sortFarthestFirst(mask, tNear, order);
+				for (uint32_t i = 0; (i < count) && (stackTop < stackSize); i++) {
+					uint32_t slot = order[i];
+					uint32_t rays = intersectBoxRays(node, slot, origin, packet) & entry.rays;
+					if (rays == 0) {
+						continue;
+					}
+					// Once only a few rays are left, the packet tests cost more than they save
+					stack[stackTop++] = { node.child[slot], node.packetCount[slot], tNear[slot], rays, countBits(rays) < packetMinRays };
+				}
+			}
+		}
+
+		// Closest hit (or any hit closer than maxT) of a ray, the hit distance is set to maxT if nothing is hit
+		bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float maxT, bool anyHit, Hit &hit, Counters &counters) const
+		{
+			counters.rays++;
+			hit.triangle = invalidIndex;
+			hit.t = maxT;
+			if (nodes.empty()) {
+				return false;
+			}
+			return traverse(0, 0, origin, direction, anyHit, hit, counters);
+		}
+
+		// Shading, mirrors the functions of the compute shader
+
+		static uint32_t hash(uint32_t x)
+		{
+			x ^= x >> 16;
+			x *= 0x7feb352du;
+			x ^= x >> 15;
+			x *= 0x846ca68bu;
+			x ^= x >> 16;
+			return x;
+		}
+
+		static float random(uint32_t &seed)
+		{
+			seed = hash(seed);
+			return (float)(seed >> 8) / 16777216.0f;
+		}
+
+		static glm::vec3 sampleHemisphere(const glm::vec3 &normal, uint32_t &seed)
+		{
+			float phi = 2.0f * 3.14159265358979f * random(seed);
+			float r2 = random(seed);
+			float r = std::sqrt(r2);
+			glm::vec3 tangent = glm::normalize(glm::cross((std::abs(normal.x) > 0.5f) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), normal));
+			glm::vec3 bitangent = glm::cross(normal, tangent);
+			return glm::normalize(tangent * std::cos(phi) * r + bitangent * std::sin(phi) * r + normal * std::sqrt(1.0f - r2));
+		}
+
+		static glm::vec2 jitter(uint32_t frame)
+		{
+			glm::vec2 offset = glm::vec2(0.5f) + glm::vec2(0.7548776662f, 0.5698402910f) * (float)frame;
+			return offset - glm::floor(offset);
+		}
+
+		static glm::vec3 faceNormal(const Triangle &triangle, const glm::vec3 &direction)
+		{
+			return (glm::dot(triangle.normal, direction) > 0.0f) ? -triangle.normal : triangle.normal;
+		}
+
+		glm::vec3 directLight(const Settings &settings, const glm::vec3 &pos, const glm::vec3 &normal, const glm::vec3 &direction, const Triangle &triangle, Counters &counters) const
+		{
+			glm::vec3 lightVec = settings.lightPos - pos;
+			float lightDist = glm::length(lightVec);
+			lightVec /= lightDist;
+			float diffuse = glm::dot(normal, lightVec);
+			if (diffuse <= 0.0f) {
+				return glm::vec3(0.0f);
+			}
+			Hit shadowHit;
+			if (intersect(pos + normal * epsilon, lightVec, lightDist, true, shadowHit, counters)) {
+				return glm::vec3(0.0f);
+			}
+			float specular = std::pow(std::max(glm::dot(glm::reflect(direction, normal), lightVec), 0.0f), triangle.specular);
+			return triangle.diffuse * diffuse + glm::vec3(specular);
+		}
+
+		float ambientOcclusion(const Settings &settings, const glm::vec3 &pos, const glm::vec3 &normal, uint32_t &seed, Counters &counters) const
+		{
+			if (settings.aoSamples == 0) {
+				return 1.0f;
+			}
+			uint32_t visible = 0;
+			for (uint32_t i = 0; i < settings.aoSamples; i++) {
+				Hit occluder;
+				if (!intersect(pos + normal * epsilon, sampleHemisphere(normal, seed), settings.aoRadius, true, occluder, counters)) {
+					visible++;
+				}
+			}
+			return (float)visible / (float)settings.aoSamples;
+		}
+
+		glm::vec3 shade(const Settings &settings, const Hit &hit, const glm::vec3 &direction, uint32_t &seed, Counters &counters) const
+		{
+			const Triangle &triangle = triangles[hit.triangle];
+			glm::vec3 pos = triangle.v0 + hit.barycentrics.x * triangle.e1 + hit.barycentrics.y * triangle.e2;
+			glm::vec3 normal = faceNormal(triangle, direction);
+			glm::vec3 ambient = triangle.diffuse * 0.25f * ambientOcclusion(settings, pos, normal, seed, counters);
+			glm::vec3 color = directLight(settings, pos, normal, direction, triangle, counters) + ambient;
+
+			if (settings.reflectionStrength > 0.0f) {
+				glm::vec3 reflectedDirection = glm::reflect(direction, normal);
+				glm::vec3 reflectedOrigin = pos + normal * epsilon;
+				glm::vec3 reflectedColor = settings.background;
+				Hit reflectedHit;
+				if (intersect(reflectedOrigin, reflectedDirection, maxLength, false, reflectedHit, counters)) {
+					const Triangle &reflectedTriangle = triangles[reflectedHit.triangle];
+					glm::vec3 reflectedPos = reflectedOrigin + reflectedHit.t * reflectedDirection;
+					reflectedColor = directLight(settings, reflectedPos, faceNormal(reflectedTriangle, reflectedDirection), reflectedDirection, reflectedTriangle, counters) + reflectedTriangle.diffuse * 0.25f;
+				}
+				color = glm::mix(color, reflectedColor, settings.reflectionStrength);
+			}
+			return color;
+		}
+
+		// Same primary ray as the compute shader
+		static glm::vec3 primaryDirection(const Settings &settings, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+		{
+			const glm::vec2 offset = settings.accumulate ? jitter(settings.accumulationFrame) : glm::vec2(0.0f);
+			glm::vec2 uv = (glm::vec2((float)x, (float)y) + offset) / glm::vec2((float)width, (float)height);
+			glm::vec2 ndc = -1.0f + 2.0f * uv;
+			return glm::normalize(glm::vec3(ndc.x * settings.aspectRatio, ndc.y, -1.0f));
+		}
+
+		// Shade the primary hit of a pixel (if any), accumulate and store it
+		void writePixel(const Settings &settings, uint32_t pixelIndex, const Hit &hit, const glm::vec3 &direction, uint8_t *output, Counters &counters)
+		{
+			glm::vec3 color = settings.background;
+			if (hit.triangle != invalidIndex) {
+				uint32_t seed = hash(pixelIndex) ^ hash(settings.accumulationFrame);
+				color = shade(settings, hit, direction, seed, counters);
+			}
+			if (settings.accumulate) {
+				if (settings.accumulationFrame > 0) {
+					color = glm::mix(accumulation[pixelIndex], color, 1.0f / (float)(settings.accumulationFrame + 1));
+				}
+				accumulation[pixelIndex] = color;
+			}
+			// Same conversion as storing to the rgba8 image of the compute shader
+			color = glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f));
+			uint8_t *pixel = output + pixelIndex * 4;
+			pixel[0] = (uint8_t)(color.r * 255.0f + 0.5f);
+			pixel[1] = (uint8_t)(color.g * 255.0f + 0.5f);
+			pixel[2] = (uint8_t)(color.b * 255.0f + 0.5f);
+			pixel[3] = 0;
+		}
+
+		// Trace the primary rays of a block of pixels as a packet
+		void renderPacket(const Settings &settings, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, uint32_t x1, uint32_t y1, uint8_t *output, Counters &counters)
+		{
+			RayPacket packet;
+			packet.active = 0;
+			packet.invMin = glm::vec3(std::numeric_limits<float>::max());
+			packet.invMax = glm::vec3(-std::numeric_limits<float>::max());
+			bool coherent = true;
+			glm::vec3 firstDirection;
+			for (uint32_t ray = 0; ray < packetRays; ray++) {
+				uint32_t x = blockX + ray % packetSize;
+				uint32_t y = blockY + ray / packetSize;
+				packet.triangle[ray] = invalidIndex;
+				packet.barycentrics[ray] = glm::vec2(0.0f);
+				if ((x >= x1) || (y >= y1)) {
+					// Outside of the image, never hits anything
+					packet.dirX[ray] = packet.dirY[ray] = packet.dirZ[ray] = 0.0f;
+					packet.invX[ray] = packet.invY[ray] = packet.invZ[ray] = 0.0f;
+					packet.t[ray] = 0.0f;
+					continue;
+				}
+				glm::vec3 direction = primaryDirection(settings, x, y, width, height);
+				if (packet.active == 0) {
+					firstDirection = direction;
+				}
+				packet.active |= 1u << ray;
+				packet.dirX[ray] = direction.x;
+				packet.dirY[ray] = direction.y;
+				packet.dirZ[ray] = direction.z;
+				glm::vec3 invDirection = 1.0f / direction;
+				packet.invX[ray] = invDirection.x;
+				packet.invY[ray] = invDirection.y;
+				packet.invZ[ray] = invDirection.z;
+				packet.t[ray] = maxLength;
+				packet.invMin = glm::min(packet.invMin, invDirection);
+				packet.invMax = glm::max(packet.invMax, invDirection);
+				// The frustum test needs the directions of all rays in the same octant (and no zero components)
+				for (uint32_t axis = 0; axis < 3; axis++) {
+					if ((std::abs(direction[axis]) < 1.0e-6f) || ((direction[axis] < 0.0f) != (firstDirection[axis] < 0.0f))) {
+						coherent = false;
+					}
+				}
+			}
+
+			if (coherent) {
+				intersectPacketRays(settings.cameraPos, packet, counters);
+			}
+			for (uint32_t ray = 0; ray < packetRays; ray++) {
+				if ((packet.active & (1u << ray)) == 0) {
+					continue;
+				}
+				const glm::vec3 direction(packet.dirX[ray], packet.dirY[ray], packet.dirZ[ray]);
+				Hit hit = { packet.triangle[ray], packet.t[ray], packet.barycentrics[ray] };
+				if (!coherent) {
+					// Packets crossing an axis (e.g. the center column of the image) are traced ray by ray
+					intersect(settings.cameraPos, direction, maxLength, false, hit, counters);
+				}
+				writePixel(settings, (blockX + ray % packetSize) + (blockY + ray / packetSize) * width, hit, direction, output, counters);
+			}
+		}
+
+		void renderTile(const Settings &settings, uint32_t width, uint32_t height, uint32_t tileX, uint32_t tileY, uint8_t *output, Counters &counters)
+		{
+			const uint32_t x1 = std::min(tileX + tileSize, width);
+			const uint32_t y1 = std::min(tileY + tileSize, height);
+			if (packetTraversal) {
+				for (uint32_t y = tileY; y < y1; y += packetSize) {
+					for (uint32_t x = tileX; x < x1; x += packetSize) {
+						renderPacket(settings, width, height, x, y, x1, y1, output, counters);
+					}
+				}
+				return;
+			}
+			for (uint32_t y = tileY; y < y1; y++) {
+				for (uint32_t x = tileX; x < x1; x++) {
+					glm::vec3 direction = primaryDirection(settings, x, y, width, height);
+					Hit hit;
+					intersect(settings.cameraPos, direction, maxLength, false, hit, counters);
+					writePixel(settings, x + y * width, hit, direction, output, counters);
+				}
+			}
+		}
+
+	public:
+		/** @brief Number of worker threads, zero uses one per hardware thread (minus the calling thread). Applied on the next render */
+		uint32_t threadCount = 0;
+		/** @brief Trace the primary rays in packets of 4x4 pixels instead of one by one, secondary rays are always traced one by one */
+		bool packetTraversal = true;
+
+		const Statistics &getStatistics() const { return statistics; }
+		uint32_t getThreadCount() const { return scheduler->getThreadCount(); }
+
+		/** @brief Trace on the threads of a shared scheduler instead of own ones (threadCount is ignored then), render may then be called from the scheduler's jobs */
+		void setScheduler(TaskScheduler *sharedScheduler) { scheduler = sharedScheduler ? sharedScheduler : &ownScheduler; }
+
+		/**
+		* Take over the scene traced by the compute shader
+		*
+		* @param sceneTriangles Triangles in BVH leaf order, T needs the vec4 members v1, v2, v3 and diffuse and a float member specular
+		* @param bvh Hierarchy the triangles have been ordered for
+		*/
+		template<typename T>
+		void setScene(const std::vector<T> &sceneTriangles, const BVH &bvh)
+		{
+			triangles.resize(sceneTriangles.size());
+			for (size_t i = 0; i < sceneTriangles.size(); i++) {
+				const T &source = sceneTriangles[i];
+				Triangle &triangle = triangles[i];
+				triangle.v0 = glm::vec3(source.v1);
+				triangle.e1 = glm::vec3(source.v2) - triangle.v0;
+				triangle.e2 = glm::vec3(source.v3) - triangle.v0;
+				triangle.normal = glm::normalize(glm::cross(triangle.e1, triangle.e2));
+				triangle.diffuse = glm::vec3(source.diffuse);
+				triangle.specular = source.specular;
+			}
+			nodes.clear();
+			packets.clear();
+			if (bvh.nodes.empty() || triangles.empty()) {
+				return;
+			}
+			if (bvh.nodes[0].count > 0) {
+				// The root is a leaf, the four wide root gets it as its only child
+				nodes.push_back(Node4());
+				nodes[0].childCount = 1;
+				setChild(0, 0, bvh, 0);
+			} else {
+				collapse(bvh, 0);
+			}
+		}
+
+		/**
+		* Trace an image
+		*
+		* @param output Receives width * height RGBA8 pixels, row by row
+		* @param firstRow Rows above are left untouched, e.g. if they are traced elsewhere
+		*/
+		void render(const Settings &settings, uint32_t width, uint32_t height, uint8_t *output, uint32_t firstRow = 0)
+		{
+			VKS_CPU_SCOPE("CPU ray tracing");
+			auto tStart = std::chrono::high_resolution_clock::now();
+			uint32_t workerCount = (threadCount > 0) ? threadCount : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+			if ((scheduler == &ownScheduler) && (ownScheduler.getWorkerCount() != workerCount)) {
+				ownScheduler.setWorkerCount(workerCount);
+			}
+			if (settings.accumulate && (accumulation.size() != (size_t)width * height)) {
+				accumulation.assign((size_t)width * height, glm::vec3(0.0f));
+			}
+
+			// Tiles are split into many small ranges that idle threads steal, as their cost differs a lot
+			const uint32_t tilesX = (width + tileSize - 1) / tileSize;
+			const uint32_t tileCount = (firstRow < height) ? tilesX * ((height - firstRow + tileSize - 1) / tileSize) : 0;
+			std::atomic<uint64_t> rays(0), nodesVisited(0), triangleTests(0), packetFallbacks(0);
+			scheduler->parallelFor(tileCount, [&](uint32_t firstTile, uint32_t lastTile) {
+				VKS_CPU_SCOPE("Trace tiles");
+				Counters counters;
+				for (uint32_t tile = firstTile; tile < lastTile; tile++) {
+					renderTile(settings, width, height, (tile % tilesX) * tileSize, firstRow + (tile / tilesX) * tileSize, output, counters);
+				}
+				rays += counters.rays;
+				nodesVisited += counters.nodesVisited;
+				triangleTests += counters.triangleTests;
+				packetFallbacks += counters.packetFallbacks;
+			});
+
+			statistics.rays = rays;
+			statistics.nodesVisited = nodesVisited;
+			statistics.triangleTests = triangleTests;
+			statistics.packetFallbacks = packetFallbacks;
+			statistics.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		}
+	};
+}
@@ -0,0 +1,153 @@
+/*
+* Pipeline build queue
+*
+* Creates pipelines on the worker threads of a task scheduler, so independent pipelines are compiled concurrently
+* and rendering can start before all of them are available
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "taskscheduler.hpp"
+
+namespace vks
+{
+	class PipelineBuildQueue
+	{
+	private:
+		struct Job
+		{
+			uint32_t id;
+			std::function<void()> function;
+			// Set by the worker thread once the job has been executed
+			std::atomic<bool> finished{ false };
+			// Time spent executing the job in milliseconds, only valid once finished
+			double duration = 0.0;
+		};
+		TaskScheduler scheduler;
+		TaskGroup group;
+		// Jobs that haven't been reported as finished by update() yet, reported jobs are removed so the list doesn't grow with every pipeline recreation
+		std::vector<std::unique_ptr<Job>> jobs;
+		uint32_t nextId = 0;
+		// Number and accumulated build time of the jobs removed from the list
+		uint32_t removedCount = 0;
+		double removedBuildTime = 0.0;
+	public:
+		~PipelineBuildQueue()
+		{
+			wait();
+		}
+
+		/** @brief Sets the number of worker threads, if zero jobs are executed immediately on the calling thread */
+		void setThreadCount(uint32_t count)
+		{
+			scheduler.setWorkerCount(count);
+		}
+
+		/**
+		* Add a job that creates one or more pipelines
+		*
+		* @note The pipeline cache passed to vkCreate*Pipelines is internally synchronized, so all jobs can share one cache
+		* @note Shader modules should be loaded before adding the job, as loadShader is not thread safe
+		*
+		* @param function Function creating the pipelines, it must not reference any data on the caller's stack
+		*
+		* @return Id of the job, used to check if its pipelines are ready
+		*/
+		uint32_t add(std::function<void()> function)
+		{
+			jobs.push_back(std::unique_ptr<Job>(new Job()));
+			Job *job = jobs.back().get();
+			job->id = nextId++;
+			job->function = std::move(function);
+			auto execute = [job] {
+				VKS_CPU_SCOPE("Create pipelines");
+				auto tStart = std::chrono::high_resolution_clock::now();
+				job->function();
+				job->duration = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+				job->finished.store(true, std::memory_order_release);
+			};
+			if (scheduler.getWorkerCount() == 0) {
+				execute();
+			} else {
+				// Idle workers steal the queued jobs, so a long compile doesn't hold back the jobs added after it
+				scheduler.run(group, execute);
+			}
+			return job->id;
+		}
+
+		/** @brief Returns true if the pipelines created by the given job can be used */
+		bool ready(uint32_t job) const
+		{
+			for (auto &pendingJob : jobs) {
+				if (pendingJob->id == job) {
+					return pendingJob->finished.load(std::memory_order_acquire);
+				}
+			}
+			// Jobs are only removed once they have been finished
+			return job < nextId;
+		}
+
+		/**
+		* Removes the jobs finished since the last call
+		*
+		* @return True if jobs have been finished since the last call, i.e. if command buffers should be rebuilt to use the new pipelines
+		*/
+		bool update()
+		{
+			bool updated = false;
+			for (auto it = jobs.begin(); it != jobs.end();) {
+				if ((*it)->finished.load(std::memory_order_acquire)) {
+					// The worker doesn't access the job after setting finished
+					removedCount++;
+					removedBuildTime += (*it)->duration;
+					it = jobs.erase(it);
+					updated = true;
+				} else {
+					++it;
+				}
+			}
+			return updated;
+		}
+
+		/** @brief Accumulated time spent creating pipelines in milliseconds for all finished jobs */
+		double getBuildTime() const
+		{
+			double buildTime = removedBuildTime;
+			for (auto &job : jobs) {
+				if (job->finished.load(std::memory_order_acquire)) {
+					buildTime += job->duration;
+				}
+			}
+			return buildTime;
+		}
+
+		uint32_t getJobCount() const
+		{
+			return nextId;
+		}
+
+		uint32_t getReadyCount() const
+		{
+			uint32_t count = removedCount;
+			for (auto &job : jobs) {
+				if (job->finished.load(std::memory_order_acquire)) {
+					count++;
+				}
+			}
+			return count;
+		}
+
+		/** @brief Wait until all jobs have been finished */
+		void wait()
+		{
+			scheduler.wait(group);
+		}
+	};
+}
@@ -0,0 +1,210 @@
+/*
+* Task graph
+*
+* Declares a frame's CPU work as named nodes with dependencies, executed on a task scheduler
+* A node is queued as soon as all nodes it depends on have finished, so independent work overlaps without hand written synchronization
+* The graph is declared once and executed every frame, nodes that don't apply to a frame simply return
+* Every execution measures the nodes and determines the critical path, i.e. the chain of dependent nodes that bounds the graph's time
+*
+* Nodes may only depend on nodes declared before them, so a graph can't contain cycles
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <initializer_list>
+#include <cassert>
+#include "taskscheduler.hpp"
+#include "cpuprofiler.hpp"
+
+namespace vks
+{
+	class TaskGraph
+	{
+	public:
+		/** @brief Timing of a node in the last execution, in milliseconds since the start of the execution */
+		struct NodeTiming
+		{
+			const char *name;
+			double start;
+			double end;
+		};
+
+	private:
+		struct Node
+		{
+			// Must point to a string that outlives the graph and the CPU profiler, e.g. a string literal
+			const char *name;
+			std::function<void()> function;
+			std::vector<uint32_t> dependencies;
+			std::vector<uint32_t> dependents;
+			std::atomic<uint32_t> remainingDependencies{ 0 };
+			double start = 0.0;
+			double end = 0.0;
+		};
+		std::vector<std::unique_ptr<Node>> nodes;
+		std::vector<uint32_t> criticalPath;
+		double criticalPathTime = 0.0;
+		double elapsedTime = 0.0;
+
+		// Only valid during execute
+		TaskScheduler *scheduler = nullptr;
+		TaskGroup *group = nullptr;
+		std::chrono::high_resolution_clock::time_point executionStart;
+
+		double elapsed() const
+		{
+			return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - executionStart).count();
+		}
+
+		void queue(uint32_t index)
+		{
+			scheduler->run(*group, [this, index] { runNode(index); });
+		}
+
+		void runNode(uint32_t index)
+		{
+			Node &node = *nodes[index];
+			node.start = elapsed();
+			{
+				cpuprofiler::Scope scope(node.name);
+				node.function();
+			}
+			node.end = elapsed();
+			for (uint32_t dependent : node.dependents) {
+				if (nodes[dependent]->remainingDependencies.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					queue(dependent);
+				}
+			}
+		}
+
+		// Longest chain of dependent nodes by their measured time, nodes are in dependency order as they can only depend on earlier ones
+		void updateCriticalPath()
+		{
+			std::vector<double> pathTimes(nodes.size(), 0.0);
+			std::vector<uint32_t> predecessors(nodes.size(), UINT32_MAX);
+			uint32_t last = UINT32_MAX;
+			criticalPathTime = 0.0;
+			for (uint32_t i = 0; i < nodes.size(); i++) {
+				double dependencyTime = 0.0;
+				for (uint32_t dependency : nodes[i]->dependencies) {
+					if (pathTimes[dependency] > dependencyTime) {
+						dependencyTime = pathTimes[dependency];
+						predecessors[i] = dependency;
+					}
+				}
+				pathTimes[i] = dependencyTime + (nodes[i]->end - nodes[i]->start);
+				if ((last == UINT32_MAX) || (pathTimes[i] > criticalPathTime)) {
+					criticalPathTime = pathTimes[i];
+					last = i;
+				}
+			}
+			criticalPath.clear();
+			for (uint32_t i = last; i != UINT32_MAX; i = predecessors[i]) {
+				criticalPath.insert(criticalPath.begin(), i);
+			}
+		}
+
+	public:
+		/**
+		* Add a node to the graph
+		*
+		* @param name Name shown in the CPU profiler and the critical path, must outlive the graph (e.g. a string literal)
+		* @param function Work of the node, may run on any thread of the scheduler
+		* @param dependencies Nodes that have to be finished before this one starts
+		*
+		* @return Index of the node, used as a dependency of later nodes
+		*/
+		uint32_t addNode(const char *name, std::function<void()> function, std::initializer_list<uint32_t> dependencies = {})
+		{
+			uint32_t index = static_cast<uint32_t>(nodes.size());
+			nodes.push_back(std::unique_ptr<Node>(new Node()));
+			Node &node = *nodes.back();
+			node.name = name;
+			node.function = std::move(function);
+			for (uint32_t dependency : dependencies) {
+				assert((dependency < index) && "Nodes may only depend on nodes declared before them");
+				node.dependencies.push_back(dependency);
+				nodes[dependency]->dependents.push_back(index);
+			}
+			return index;
+		}
+
+		void clear()
+		{
+			nodes.clear();
+			criticalPath.clear();
+			criticalPathTime = 0.0;
+			elapsedTime = 0.0;
+		}
+
+		/** @brief Run all nodes and return once they have finished, the calling thread executes nodes as well */
+		void execute(TaskScheduler &taskScheduler)
+		{
+			if (nodes.empty()) {
+				return;
+			}
+			TaskGroup executionGroup;
+			scheduler = &taskScheduler;
+			group = &executionGroup;
+			executionStart = std::chrono::high_resolution_clock::now();
+			for (auto &node : nodes) {
+				node->remainingDependencies.store(static_cast<uint32_t>(node->dependencies.size()), std::memory_order_relaxed);
+			}
+			for (uint32_t i = 0; i < nodes.size(); i++) {
+				if (nodes[i]->dependencies.empty()) {
+					queue(i);
+				}
+			}
+			taskScheduler.wait(executionGroup);
+			elapsedTime = elapsed();
+			scheduler = nullptr;
+			group = nullptr;
+			updateCriticalPath();
+		}
+
+		/** @brief Time from the start of the last execution until all nodes had finished in milliseconds */
+		double getElapsedTime() const { return elapsedTime; }
+
+		/** @brief Summed time of all nodes in the last execution in milliseconds, compared to the elapsed time this shows how much work overlapped */
+		double getWorkTime() const
+		{
+			double workTime = 0.0;
+			for (auto &node : nodes) {
+				workTime += node->end - node->start;
+			}
+			return workTime;
+		}
+
+		/** @brief Summed time of the nodes on the critical path of the last execution in milliseconds, a lower bound for the elapsed time */
+		double getCriticalPathTime() const { return criticalPathTime; }
+
+		/** @brief Nodes on the critical path of the last execution in execution order */
+		std::vector<NodeTiming> getCriticalPath() const
+		{
+			std::vector<NodeTiming> path;
+			for (uint32_t index : criticalPath) {
+				path.push_back({ nodes[index]->name, nodes[index]->start, nodes[index]->end });
+			}
+			return path;
+		}
+
+		/** @brief Timing of all nodes in the last execution in declaration order */
+		std::vector<NodeTiming> getNodeTimings() const
+		{
+			std::vector<NodeTiming> timings;
+			for (auto &node : nodes) {
+				timings.push_back({ node->name, node->start, node->end });
+			}
+			return timings;
+		}
+	};
+}
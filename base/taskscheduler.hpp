@@ -0,0 +1,437 @@
+/*
+* Work stealing task scheduler
+*
+* Every thread taking part (the workers and the thread that created the scheduler) owns a Chase-Lev deque of jobs:
+* the owner pushes and pops jobs at the bottom without locks, idle threads steal the oldest jobs from the top of other threads' deques
+* So a long job only delays the jobs queued behind it until another thread steals them, instead of stalling a whole per-thread queue
+* Jobs are stored in fixed per-thread pools with a small inline buffer for the callable, submitting a job doesn't allocate
+* Threads waiting for a task group execute queued jobs in the meantime instead of blocking
+*
+* Jobs may be submitted from any thread. Threads that don't take part (e.g. workers of another scheduler) have no deque,
+* so their jobs are executed right away on the submitting thread, and they wait for groups without executing other jobs
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "cpuprofiler.hpp"
+
+namespace vks
+{
+	class TaskScheduler;
+
+	/** @brief Set of jobs that can be waited for as a whole, must not be destroyed while jobs of it are pending */
+	class TaskGroup
+	{
+		friend class TaskScheduler;
+	private:
+		std::atomic<uint32_t> pending{ 0 };
+		// Job queued once pending drops to zero (see TaskScheduler::then)
+		std::atomic<void*> continuation{ nullptr };
+	public:
+		TaskGroup() {}
+		TaskGroup(const TaskGroup&) = delete;
+		TaskGroup &operator=(const TaskGroup&) = delete;
+
+		/** @brief True if all jobs of the group have been finished */
+		bool done() const
+		{
+			return pending.load(std::memory_order_acquire) == 0;
+		}
+	};
+
+	class TaskScheduler
+	{
+	public:
+		/** @brief Size of the buffer a job's callable is stored in, larger callables are rejected at compile time (capture by reference instead) */
+		static const size_t jobStorageSize = 48;
+
+	private:
+		// Number of jobs per thread, both for the job pool and the deque (power of two)
+		static const uint32_t jobCapacity = 1024;
+
+		struct Job
+		{
+			typename std::aligned_storage<jobStorageSize>::type storage;
+			void (*invoke)(void *storage);
+			void (*destroy)(void *storage);
+			TaskGroup *group;
+			// Set once the job has been executed, only the owning thread takes free jobs from its pool
+			std::atomic<bool> free{ true };
+		};
+
+		// Chase-Lev work stealing deque with a fixed capacity
+		class Deque
+		{
+		private:
+			std::atomic<int64_t> top{ 0 };
+			std::atomic<int64_t> bottom{ 0 };
+			std::atomic<Job*> jobs[jobCapacity];
+		public:
+			/** @brief Owner only, returns false if the deque is full */
+			bool push(Job *job)
+			{
+				int64_t b = bottom.load(std::memory_order_relaxed);
+				int64_t t = top.load(std::memory_order_acquire);
+				if (b - t >= (int64_t)jobCapacity) {
+					return false;
+				}
+				jobs[b & (jobCapacity - 1)].store(job, std::memory_order_relaxed);
+				bottom.store(b + 1, std::memory_order_release);
+				return true;
+			}
+
+			/** @brief Owner only, takes the most recently pushed job */
+			Job *pop()
+			{
+				int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+				bottom.store(b, std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				int64_t t = top.load(std::memory_order_relaxed);
+				if (t > b) {
+					bottom.store(b + 1, std::memory_order_relaxed);
+					return nullptr;
+				}
+				Job *job = jobs[b & (jobCapacity - 1)].load(std::memory_order_relaxed);
+				if (t == b) {
+					// Last job, races with thieves
+					if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+						job = nullptr;
+					}
+					bottom.store(b + 1, std::memory_order_relaxed);
+				}
+				return job;
+			}
+
+			/** @brief Any thread, takes the oldest job */
+			Job *steal()
+			{
+				int64_t t = top.load(std::memory_order_acquire);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				int64_t b = bottom.load(std::memory_order_acquire);
+				if (t >= b) {
+					return nullptr;
+				}
+				Job *job = jobs[t & (jobCapacity - 1)].load(std::memory_order_acquire);
+				if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+					return nullptr;
+				}
+				return job;
+			}
+		};
+
+		// Deque and job pool of a thread taking part in the scheduling, index 0 is the thread that created the scheduler
+		struct Participant
+		{
+			Deque deque;
+			std::unique_ptr<Job[]> jobs{ new Job[jobCapacity] };
+			uint32_t nextJob = 0;
+		};
+
+		// Identifies the worker threads, the creating thread is found by its id
+		struct ThreadContext
+		{
+			TaskScheduler *scheduler = nullptr;
+			uint32_t index = 0;
+		};
+
+		std::vector<std::unique_ptr<Participant>> participants;
+		std::vector<std::thread> workers;
+		std::thread::id owner;
+		std::atomic<bool> stopping{ false };
+		// Jobs pushed but not taken yet, and workers waiting for jobs
+		std::atomic<int32_t> queuedJobs{ 0 };
+		std::atomic<int32_t> sleepingWorkers{ 0 };
+		std::mutex sleepMutex;
+		std::condition_variable sleepCondition;
+
+		static ThreadContext &threadContext()
+		{
+			static thread_local ThreadContext context;
+			return context;
+		}
+
+		// Index of a thread that doesn't take part in the scheduling
+		static const uint32_t externalThread = UINT32_MAX;
+
+		// A thread runs the jobs of at most one scheduler, so a single context per thread is enough
+		uint32_t currentIndex()
+		{
+			ThreadContext &context = threadContext();
+			if (context.scheduler == this) {
+				return context.index;
+			}
+			return (std::this_thread::get_id() == owner) ? 0 : externalThread;
+		}
+
+		// Returns a free job of the thread's pool or nullptr if all are in use (or the thread has no pool)
+		Job *allocate(uint32_t index)
+		{
+			if (index == externalThread) {
+				return nullptr;
+			}
+			Participant &participant = *participants[index];
+			for (uint32_t i = 0; i < jobCapacity; i++) {
+				Job *job = &participant.jobs[participant.nextJob];
+				participant.nextJob = (participant.nextJob + 1) & (jobCapacity - 1);
+				if (job->free.load(std::memory_order_acquire)) {
+					job->free.store(false, std::memory_order_relaxed);
+					return job;
+				}
+			}
+			return nullptr;
+		}
+
+		template<typename F>
+		static void store(Job *job, F &&function, TaskGroup *group)
+		{
+			typedef typename std::decay<F>::type Function;
+			static_assert(sizeof(Function) <= jobStorageSize, "Job callable is too large for the job storage, capture by reference instead");
+			static_assert(std::alignment_of<Function>::value <= std::alignment_of<decltype(job->storage)>::value, "Job callable needs a larger alignment than the job storage has");
+			new (&job->storage) Function(std::forward<F>(function));
+			job->invoke = [](void *storage) { (*static_cast<Function*>(storage))(); };
+			job->destroy = [](void *storage) { static_cast<Function*>(storage)->~Function(); };
+			job->group = group;
+		}
+
+		// A waiting thread may destroy the group as soon as its pending count is zero, so the continuation is taken out before the last job is counted
+		// If then() adds its count in between, this is not the last job anymore and the continuation is put back for whoever finishes last
+		void finish(TaskGroup *group)
+		{
+			if (!group) {
+				return;
+			}
+			uint32_t remaining = group->pending.load(std::memory_order_acquire);
+			while (true) {
+				if (remaining == 1) {
+					Job *continuation = static_cast<Job*>(group->continuation.exchange(nullptr, std::memory_order_acq_rel));
+					if (group->pending.compare_exchange_strong(remaining, 0, std::memory_order_acq_rel, std::memory_order_acquire)) {
+						if (continuation) {
+							enqueue(continuation);
+						}
+						return;
+					}
+					if (continuation) {
+						group->continuation.store(continuation, std::memory_order_release);
+					}
+				} else if (group->pending.compare_exchange_weak(remaining, remaining - 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+					return;
+				}
+			}
+		}
+
+		void execute(Job *job)
+		{
+			{
+				VKS_CPU_SCOPE("Task");
+				job->invoke(&job->storage);
+			}
+			job->destroy(&job->storage);
+			TaskGroup *group = job->group;
+			job->free.store(true, std::memory_order_release);
+			finish(group);
+		}
+
+		void enqueue(Job *job)
+		{
+			uint32_t index = currentIndex();
+			if ((index == externalThread) || !participants[index]->deque.push(job)) {
+				// No deque or deque is full, run the job right away
+				execute(job);
+				return;
+			}
+			queuedJobs.fetch_add(1, std::memory_order_seq_cst);
+			if (sleepingWorkers.load(std::memory_order_seq_cst) > 0) {
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				sleepCondition.notify_one();
+			}
+		}
+
+		// Own jobs first (most recent, still in cache), then the oldest jobs of the other threads
+		Job *findJob(uint32_t index)
+		{
+			Job *job = participants[index]->deque.pop();
+			for (uint32_t i = 1; !job && (i < participants.size()); i++) {
+				job = participants[(index + i) % participants.size()]->deque.steal();
+			}
+			if (job) {
+				queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+			}
+			return job;
+		}
+
+		void workerLoop(uint32_t index)
+		{
+			ThreadContext &context = threadContext();
+			context.scheduler = this;
+			context.index = index;
+			vks::cpuprofiler::setThreadName("Task worker");
+			while (!stopping.load(std::memory_order_acquire)) {
+				Job *job = findJob(index);
+				if (job) {
+					execute(job);
+					continue;
+				}
+				std::unique_lock<std::mutex> lock(sleepMutex);
+				sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+				sleepCondition.wait(lock, [this] { return stopping.load(std::memory_order_acquire) || (queuedJobs.load(std::memory_order_seq_cst) > 0); });
+				sleepingWorkers.fetch_sub(1, std::memory_order_seq_cst);
+			}
+		}
+
+		void stopWorkers()
+		{
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				stopping.store(true, std::memory_order_release);
+				sleepCondition.notify_all();
+			}
+			for (auto &worker : workers) {
+				worker.join();
+			}
+			workers.clear();
+			stopping.store(false, std::memory_order_release);
+		}
+
+	public:
+		/** @param workerCount Number of worker threads, the creating thread takes part in addition to them while it waits */
+		explicit TaskScheduler(uint32_t workerCount = 0)
+		{
+			owner = std::this_thread::get_id();
+			setWorkerCount(workerCount);
+		}
+
+		~TaskScheduler()
+		{
+			stopWorkers();
+		}
+
+		/** @brief Change the number of worker threads, must not be called while jobs are pending */
+		void setWorkerCount(uint32_t workerCount)
+		{
+			stopWorkers();
+			participants.clear();
+			for (uint32_t i = 0; i <= workerCount; i++) {
+				participants.push_back(std::unique_ptr<Participant>(new Participant()));
+			}
+			queuedJobs.store(0);
+			for (uint32_t i = 1; i <= workerCount; i++) {
+				workers.push_back(std::thread(&TaskScheduler::workerLoop, this, i));
+			}
+		}
+
+		uint32_t getWorkerCount() const
+		{
+			return static_cast<uint32_t>(workers.size());
+		}
+
+		/** @brief Number of threads executing jobs while the creating thread waits */
+		uint32_t getThreadCount() const
+		{
+			return static_cast<uint32_t>(participants.size());
+		}
+
+		/**
+		* Index of the calling thread (0 for the creating thread, below getThreadCount()), e.g. to select per-thread resources in jobs
+		*
+		* @note Only valid for the creating thread and the workers, other threads have no index
+		*/
+		uint32_t getCurrentThreadIndex()
+		{
+			uint32_t index = currentIndex();
+			assert((index != externalThread) && "Calling thread doesn't take part in this scheduler");
+			return index;
+		}
+
+		/** @brief Queue a job as part of a group */
+		template<typename F>
+		void run(TaskGroup &group, F &&function)
+		{
+			group.pending.fetch_add(1, std::memory_order_relaxed);
+			Job *job = allocate(currentIndex());
+			if (!job) {
+				// All jobs of this thread are in flight (or it has no job pool), run it right away
+				function();
+				finish(&group);
+				return;
+			}
+			store(job, std::forward<F>(function), &group);
+			enqueue(job);
+		}
+
+		/**
+		* Queue a job once all jobs of a group have been finished, right away if none are pending
+		*
+		* @param continuationGroup Optional group the continuation counts towards, so it can be waited for (e.g. to chain further continuations)
+		* @note Only one continuation per group, the group must not get new jobs until the continuation has been queued
+		*/
+		template<typename F>
+		void then(TaskGroup &group, F &&function, TaskGroup *continuationGroup = nullptr)
+		{
+			if (continuationGroup) {
+				continuationGroup->pending.fetch_add(1, std::memory_order_relaxed);
+			}
+			Job *job = allocate(currentIndex());
+			if (!job) {
+				wait(group);
+				function();
+				finish(continuationGroup);
+				return;
+			}
+			store(job, std::forward<F>(function), continuationGroup);
+			// Counts as a pending job until the continuation has been set, so the group's last job can't finish without seeing it
+			group.pending.fetch_add(1, std::memory_order_relaxed);
+			void *previous = group.continuation.exchange(job, std::memory_order_acq_rel);
+			assert(!previous && "Only one continuation per task group");
+			(void)previous;
+			finish(&group);
+		}
+
+		/** @brief Wait until all jobs of a group have been finished, executes queued jobs (of any group) in the meantime */
+		void wait(TaskGroup &group)
+		{
+			uint32_t index = currentIndex();
+			while (!group.done()) {
+				Job *job = (index != externalThread) ? findJob(index) : nullptr;
+				if (job) {
+					execute(job);
+				} else {
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		/**
+		* Call function(first, last) for consecutive ranges covering [0, count) in parallel, returns once all ranges have been processed
+		*
+		* @param grainSize Size of the ranges, zero picks one that gives about eight ranges per thread, so threads finishing early can steal from the others
+		*/
+		template<typename F>
+		void parallelFor(uint32_t count, const F &function, uint32_t grainSize = 0)
+		{
+			if (count == 0) {
+				return;
+			}
+			if (grainSize == 0) {
+				grainSize = std::max(count / (getThreadCount() * 8), 1u);
+			}
+			TaskGroup group;
+			for (uint32_t first = 0; first < count; first += grainSize) {
+				uint32_t last = std::min(first + grainSize, count);
+				run(group, [&function, first, last] { function(first, last); });
+			}
+			wait(group);
+		}
+	};
+}
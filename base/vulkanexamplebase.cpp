@@ -7,9 +7,18 @@
 */
 
 #include "vulkanexamplebase.h"
+#include <csignal>
 
 std::vector<const char*> VulkanExampleBase::args;
 
+// Set by SIGINT and SIGTERM, ends the headless render loop so the example is destroyed normally (and e.g. the pipeline cache is saved)
+static volatile std::sig_atomic_t headlessQuitRequested = 0;
+
+static void headlessSignalHandler(int)
+{
+	headlessQuitRequested = 1;
+}
+
 VkResult VulkanExampleBase::createInstance(bool enableValidation)
 {
 	this->settings.validation = enableValidation;
@@ -25,24 +34,27 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	appInfo.pEngineName = name.c_str();
 	appInfo.apiVersion = apiVersion;
 
-	std::vector<const char*> instanceExtensions = { VK_KHR_SURFACE_EXTENSION_NAME };
+	std::vector<const char*> instanceExtensions;
 
-	// Enable surface extensions depending on os
+	// Enable surface extensions depending on os (not required in headless mode as nothing is presented)
+	if (!settings.headless) {
+		instanceExtensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
 #if defined(_WIN32)
-	instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WIN32_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
-	instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_ANDROID_SURFACE_EXTENSION_NAME);
 #elif defined(_DIRECT2DISPLAY)
-	instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_DISPLAY_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_WAYLAND_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_KHR_XCB_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_IOS_MVK)
-	instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_IOS_SURFACE_EXTENSION_NAME);
 #elif defined(VK_USE_PLATFORM_MACOS_MVK)
-	instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
+		instanceExtensions.push_back(VK_MVK_MACOS_SURFACE_EXTENSION_NAME);
 #endif
+	}
 
 	if (enabledInstanceExtensions.size() > 0) {
 		for (auto enabledExtension : enabledInstanceExtensions) {
@@ -54,12 +66,12 @@ VkResult VulkanExampleBase::createInstance(bool enableValidation)
 	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	instanceCreateInfo.pNext = NULL;
 	instanceCreateInfo.pApplicationInfo = &appInfo;
+	if (settings.validation)
+	{
+		instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	}
 	if (instanceExtensions.size() > 0)
 	{
-		if (settings.validation)
-		{
-			instanceExtensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
-		}
 		instanceCreateInfo.enabledExtensionCount = (uint32_t)instanceExtensions.size();
 		instanceCreateInfo.ppEnabledExtensionNames = instanceExtensions.data();
 	}
@@ -95,7 +107,11 @@ void VulkanExampleBase::renderFrame()
 	VulkanExampleBase::prepareFrame();
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	gpuProfiler.submit(currentFrame, drawCmdBuffers[currentBuffer]);
+	{
+		VKS_CPU_SCOPE("Submit");
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	}
 	VulkanExampleBase::submitFrame();
 }
 
@@ -122,11 +138,21 @@ void VulkanExampleBase::createCommandBuffers()
 			static_cast<uint32_t>(drawCmdBuffers.size()));
 
 	VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, drawCmdBuffers.data()));
+
+	uiCmdBuffers.resize(swapChain.imageCount);
+	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, uiCmdBuffers.data()));
+	uiCmdBuffersOutdated.assign(uiCmdBuffers.size(), true);
+
+	// The overlay geometry is written per swap chain image, as the command buffers drawing it are
+	UIOverlay.setSlotCount(swapChain.imageCount, settings.maxFramesInFlight);
 }
 
 void VulkanExampleBase::destroyCommandBuffers()
 {
+	gpuProfiler.removeCommandBuffers(drawCmdBuffers);
 	vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(drawCmdBuffers.size()), drawCmdBuffers.data());
+	vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(uiCmdBuffers.size()), uiCmdBuffers.data());
 }
 
 std::string VulkanExampleBase::getShadersPath() const
@@ -134,11 +160,48 @@ std::string VulkanExampleBase::getShadersPath() const
 	return getAssetPath() + "shaders/" + shaderDir + "/";
 }
 
+std::string VulkanExampleBase::getPipelineCacheFilename()
+{
+#if defined(VK_USE_PLATFORM_ANDROID_KHR)
+	return std::string(androidApp->activity->internalDataPath) + "/" + name + ".pipelinecache";
+#else
+	return name + ".pipelinecache";
+#endif
+}
+
 void VulkanExampleBase::createPipelineCache()
 {
+	// Initialize the pipeline cache with the data stored by a previous run, if it was created for the same device and driver
+	std::vector<char> cacheData;
+	vks::pipelinecache::LoadResult loadResult = vks::pipelinecache::load(getPipelineCacheFilename(), deviceProperties, cacheData);
+	switch (loadResult) {
+	case vks::pipelinecache::Loaded:
+		pipelineCacheStatus = "loaded " + std::to_string(cacheData.size()) + " bytes";
+		break;
+	case vks::pipelinecache::NotFound:
+		pipelineCacheStatus = "not found";
+		break;
+	case vks::pipelinecache::Mismatch:
+		pipelineCacheStatus = "discarded, created with a different device or driver";
+		break;
+	case vks::pipelinecache::Invalid:
+		pipelineCacheStatus = "discarded, invalid data";
+		break;
+	}
+
 	VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
 	pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-	VK_CHECK_RESULT(vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+	pipelineCacheCreateInfo.initialDataSize = cacheData.size();
+	pipelineCacheCreateInfo.pInitialData = cacheData.data();
+	VkResult result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+	if ((result != VK_SUCCESS) && (cacheData.size() > 0)) {
+		// Fall back to an empty cache if the driver refuses the data
+		pipelineCacheStatus = "discarded, rejected by the driver";
+		pipelineCacheCreateInfo.initialDataSize = 0;
+		pipelineCacheCreateInfo.pInitialData = nullptr;
+		result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+	}
+	VK_CHECK_RESULT(result);
 }
 
 void VulkanExampleBase::prepare()
@@ -146,15 +209,35 @@ void VulkanExampleBase::prepare()
 	if (vulkanDevice->enableDebugMarkers) {
 		vks::debugmarker::setup(device);
 	}
-	initSwapchain();
-	createCommandPool();
-	setupSwapChain();
+	if (settings.headless) {
+		setupHeadlessTargets();
+		createCommandPool();
+	} else {
+		initSwapchain();
+		createCommandPool();
+		setupSwapChain();
+	}
 	createCommandBuffers();
 	createSynchronizationPrimitives();
 	setupDepthStencil();
 	setupRenderPass();
 	createPipelineCache();
 	setupFrameBuffer();
+	// Leave one core for the main thread, which keeps preparing the example while pipelines are compiled
+	uint32_t threadCount = std::thread::hardware_concurrency();
+	pipelineBuildQueue.setThreadCount(threadCount > 1 ? threadCount - 1 : 0);
+	// The main thread executes jobs as well while it waits for them
+	taskScheduler.setWorkerCount(threadCount > 1 ? threadCount - 1 : 0);
+	gpuProfiler.prepare(vulkanDevice, queue, settings.maxFramesInFlight);
+	uploadManager.prepare(vulkanDevice, transferQueue, transferQueueFamily, queue, vulkanDevice->queueFamilyIndices.graphics);
+	vulkanDevice->uploadManager = &uploadManager;
+	if (gpuProfiler.enabled) {
+		// Every debug marker region becomes a profiler scope
+		vks::debugmarker::beginRegionCallback = [this](VkCommandBuffer commandBuffer, const char *name) { gpuProfiler.beginScope(commandBuffer, name); };
+		vks::debugmarker::endRegionCallback = [this](VkCommandBuffer commandBuffer) { gpuProfiler.endScope(commandBuffer); };
+		// Results gathered while warming up are not representative
+		benchmark.onWarmupFinished = [this] { gpuProfiler.resetStatistics(); vks::cpuprofiler::clear(); };
+	}
 	settings.overlay = settings.overlay && (!benchmark.active);
 	if (settings.overlay) {
 		UIOverlay.device = vulkanDevice;
@@ -164,7 +247,7 @@ void VulkanExampleBase::prepare()
 			loadShader(getShadersPath() + "base/uioverlay.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT),
 		};
 		UIOverlay.prepareResources();
-		UIOverlay.preparePipeline(pipelineCache, renderPass);
+		uiPipelineJob = pipelineBuildQueue.add([this] { UIOverlay.preparePipeline(pipelineCache, renderPass); });
 	}
 }
 
@@ -174,30 +257,32 @@ VkPipelineShaderStageCreateInfo VulkanExampleBase::loadShader(std::string fileNa
 	shaderStage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	shaderStage.stage = stage;
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
-	shaderStage.module = vks::tools::loadShader(androidApp->activity->assetManager, fileName.c_str(), device);
+	shaderStage.module = shaderModuleCache.get(androidApp->activity->assetManager, fileName);
 #else
-	shaderStage.module = vks::tools::loadShader(fileName.c_str(), device);
+	shaderStage.module = shaderModuleCache.get(fileName);
 #endif
 	shaderStage.pName = "main"; // todo : make param
 	assert(shaderStage.module != VK_NULL_HANDLE);
-	shaderModules.push_back(shaderStage.module);
 	return shaderStage;
 }
 
 void VulkanExampleBase::nextFrame()
 {
+	VKS_CPU_SCOPE("Frame");
 	auto tStart = std::chrono::high_resolution_clock::now();
 	if (viewUpdated)
 	{
 		viewUpdated = false;
 		viewChanged();
 	}
+	cameraPath.record(getCameraPathFrame());
 
 	render();
 	frameCounter++;
 	auto tEnd = std::chrono::high_resolution_clock::now();
 	auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-	frameTimer = (float)tDiff / 1000.0f;
+	// Animations advance by the same amount every frame when replaying a camera path, independent of the actual frame time
+	frameTimer = cameraPath.replaying() ? cameraPath.timestep : (float)tDiff / 1000.0f;
 	camera.update(frameTimer);
 	if (camera.moving())
 	{
@@ -216,8 +301,12 @@ void VulkanExampleBase::nextFrame()
 	if (fpsTimer > 1000.0f)
 	{
 		lastFPS = static_cast<uint32_t>((float)frameCounter * (1000.0f / fpsTimer));
+		if (settings.headless) {
+			// There is no window title to display the frame rate in
+			std::cout << lastFPS << " fps" << std::endl;
+		}
 #if defined(_WIN32)
-		if (!settings.overlay)	{
+		if (!settings.overlay && !settings.headless)	{
 			std::string windowTitle = getWindowTitle();
 			SetWindowText(window, windowTitle.c_str());
 		}
@@ -225,24 +314,60 @@ void VulkanExampleBase::nextFrame()
 		frameCounter = 0;
 		lastTimestamp = tEnd;
 	}
-	// TODO: Cap UI overlay update rates
 	updateOverlay();
 }
 
 void VulkanExampleBase::renderLoop()
 {
-	if (benchmark.active) {
-		benchmark.run([=] { render(); }, vulkanDevice->properties);
+	auto tStartup = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupTimestamp).count();
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "startup: " << tStartup << " ms (pipelines ready: " << pipelineBuildQueue.getReadyCount() << "/" << pipelineBuildQueue.getJobCount() << ", pipeline creation: " << pipelineBuildQueue.getBuildTime() << " ms, pipeline cache: " << pipelineCacheStatus << ")" << std::endl;
+	std::cout << "shader modules: " << shaderModuleCache.getModuleCount() << " created, " << shaderModuleCache.reusedCount << " reused, " << shaderModuleCache.deduplicatedCount << " deduplicated" << std::endl;
+
+	if (cameraPath.replaying()) {
+		runCameraPathReplay();
+		pipelineBuildQueue.wait();
 		vkDeviceWaitIdle(device);
-		if (benchmark.filename != "") {
-			benchmark.saveResults();
+		saveProfilerResults();
+		return;
+	}
+
+	if (benchmark.active) {
+		std::cout << "frames in flight: " << settings.maxFramesInFlight << std::endl;
+		if (benchmarkSweep.active) {
+			runBenchmarkSweep();
+		} else {
+			runBenchmark();
+			if (benchmark.filename != "") {
+				benchmark.saveResults();
+			}
 		}
+		pipelineBuildQueue.wait();
+		vkDeviceWaitIdle(device);
+		saveProfilerResults();
 		return;
 	}
 
 	destWidth = width;
 	destHeight = height;
 	lastTimestamp = std::chrono::high_resolution_clock::now();
+	if (settings.headless) {
+		// There are no window events to process, so frames are rendered back to back until the frame limit is reached or the process is interrupted
+		// Use the benchmark mode for a run with a fixed duration
+		std::signal(SIGINT, headlessSignalHandler);
+		std::signal(SIGTERM, headlessSignalHandler);
+		uint32_t framesRendered = 0;
+		while (!headlessQuitRequested && ((settings.headlessFrames == 0) || (framesRendered < settings.headlessFrames))) {
+			nextFrame();
+			framesRendered++;
+		}
+		std::signal(SIGINT, SIG_DFL);
+		std::signal(SIGTERM, SIG_DFL);
+		// Flush device to make sure all resources can be freed
+		pipelineBuildQueue.wait();
+		vkDeviceWaitIdle(device);
+		return;
+	}
 #if defined(_WIN32)
 	MSG msg;
 	bool quitMessageReceived = false;
@@ -318,7 +443,6 @@ void VulkanExampleBase::renderLoop()
 				lastTimestamp = tEnd;
 			}
 
-			// TODO: Cap UI overlay update rates/only issue when update requested
 			updateOverlay();
 
 			bool updateView = false;
@@ -511,6 +635,7 @@ void VulkanExampleBase::renderLoop()
 	}
 #endif
 	// Flush device to make sure all resources can be freed
+	pipelineBuildQueue.wait();
 	if (device != VK_NULL_HANDLE) {
 		vkDeviceWaitIdle(device);
 	}
@@ -521,10 +646,30 @@ void VulkanExampleBase::updateOverlay()
 	if (!settings.overlay)
 		return;
 
+	// Building the overlay costs far more than drawing it, so it's only rebuilt on input, a new fps value, a resize, a change requested via UIOverlay.updated or at settings.overlayUpdateRate
+	// In between the draw data of the last rebuild stays valid and is drawn again from the recorded UI command buffers and the overlay's geometry slots
+	overlayState.elapsed += frameTimer;
+	bool inputChanged = (mousePos != overlayState.mousePos) || (mouseButtons.left != overlayState.mouseLeft) || (mouseButtons.right != overlayState.mouseRight);
+	bool statsChanged = (width != overlayState.width) || (height != overlayState.height) || (lastFPS != overlayState.fps);
+	bool intervalPassed = (settings.overlayUpdateRate <= 0.0f) || (overlayState.elapsed >= 1.0f / settings.overlayUpdateRate);
+	if (overlayState.valid && !UIOverlay.updated && !inputChanged && !statsChanged && !intervalPassed) {
+		return;
+	}
+	overlayState.valid = true;
+	overlayState.mousePos = mousePos;
+	overlayState.mouseLeft = mouseButtons.left;
+	overlayState.mouseRight = mouseButtons.right;
+	overlayState.width = width;
+	overlayState.height = height;
+	overlayState.fps = lastFPS;
+
+	VKS_CPU_SCOPE("UI update");
 	ImGuiIO& io = ImGui::GetIO();
 
 	io.DisplaySize = ImVec2((float)width, (float)height);
-	io.DeltaTime = frameTimer;
+	// Time since the last rebuild, not the last frame
+	io.DeltaTime = std::max(overlayState.elapsed, 1.0e-6f);
+	overlayState.elapsed = 0.0f;
 
 	io.MousePos = ImVec2(mousePos.x, mousePos.y);
 	io.MouseDown[0] = mouseButtons.left;
@@ -555,7 +700,14 @@ void VulkanExampleBase::updateOverlay()
 	ImGui::Render();
 
 	if (UIOverlay.update() || UIOverlay.updated) {
-		buildCommandBuffers();
+		if (uiSecondaryCommandBuffers) {
+			// Recorded again by executeUI once their swap chain image is used next, the example's command buffers stay untouched
+			uiCmdBuffersOutdated.assign(uiCmdBuffersOutdated.size(), true);
+		} else {
+			// The draw command buffers may still be in use by frames in flight
+			VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+			buildCommandBuffers();
+		}
 		UIOverlay.updated = false;
 	}
 
@@ -568,32 +720,298 @@ void VulkanExampleBase::updateOverlay()
 
 void VulkanExampleBase::drawUI(const VkCommandBuffer commandBuffer)
 {
-	if (settings.overlay) {
+	if (settings.overlay && pipelineBuildQueue.ready(uiPipelineJob)) {
+		vks::debugmarker::beginRegion(commandBuffer, "UI overlay", glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
 		const VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
 		const VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
 		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		UIOverlay.draw(commandBuffer);
+		// Draw from the geometry slot of the swap chain image the command buffer belongs to
+		uint32_t slot = currentBuffer;
+		for (uint32_t i = 0; i < drawCmdBuffers.size(); i++) {
+			if ((commandBuffer == drawCmdBuffers[i]) || (commandBuffer == uiCmdBuffers[i])) {
+				slot = i;
+				break;
+			}
+		}
+		UIOverlay.draw(commandBuffer, slot);
+		vks::debugmarker::endRegion(commandBuffer);
+	}
+}
+
+void VulkanExampleBase::executeUI(const VkCommandBuffer commandBuffer)
+{
+	if (!settings.overlay) {
+		return;
+	}
+	// prepareFrame has waited for the frame that last used the swap chain image, so its UI command buffer is no longer in use
+	if (uiCmdBuffersOutdated[currentBuffer]) {
+		VKS_CPU_SCOPE("Record UI");
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = UIOverlay.subpass;
+		inheritanceInfo.framebuffer = frameBuffers[currentBuffer];
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		cmdBufInfo.pInheritanceInfo = &inheritanceInfo;
+		VK_CHECK_RESULT(vkBeginCommandBuffer(uiCmdBuffers[currentBuffer], &cmdBufInfo));
+		drawUI(uiCmdBuffers[currentBuffer]);
+		VK_CHECK_RESULT(vkEndCommandBuffer(uiCmdBuffers[currentBuffer]));
+		uiCmdBuffersOutdated[currentBuffer] = false;
+	}
+	vkCmdExecuteCommands(commandBuffer, 1, &uiCmdBuffers[currentBuffer]);
+}
+
+void VulkanExampleBase::runBenchmark()
+{
+	benchmark.run([=] {
+		VKS_CPU_SCOPE("Frame");
+		auto tStart = std::chrono::high_resolution_clock::now();
+		frameWaitTime = 0.0;
+		render();
+		auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+		benchmark.addCpuTime(tDiff - frameWaitTime);
+	}, vulkanDevice->properties);
+	collectProfilerResults();
+	benchmark.printStatistics();
+}
+
+void VulkanExampleBase::runBenchmarkSweep()
+{
+	std::vector<vks::BenchmarkSweep::Scenario> scenarios = benchmarkSweep.getScenarios();
+	for (size_t i = 0; i < scenarios.size(); i++) {
+		std::cout << "---- Scenario " << (i + 1) << "/" << scenarios.size() << ": " << vks::BenchmarkSweep::toString(scenarios[i]) << " ----" << std::endl;
+		pipelineBuildQueue.wait();
+		VK_CHECK_RESULT(vkDeviceWaitIdle(device));
+		if (!applyBenchmarkScenario(scenarios[i])) {
+			std::cout << "Scenario is not supported by this example, skipped" << std::endl;
+			benchmarkSweep.addUnsupported(scenarios[i]);
+			continue;
+		}
+		// Pipelines recreated for the scenario are swapped in before measuring, instead of during the warm up
+		pipelineBuildQueue.wait();
+		if (pipelineBuildQueue.update()) {
+			pipelinesReady();
+		}
+		benchmark.reset();
+		runBenchmark();
+		benchmarkSweep.addResult(scenarios[i], benchmark);
+	}
+	std::string filename = benchmark.filename.empty() ? name + "_sweep.csv" : benchmark.filename;
+	if (benchmarkSweep.saveResults(filename)) {
+		std::cout << "Sweep results written to " << filename << std::endl;
+	} else {
+		std::cerr << "Could not write sweep results to " << filename << std::endl;
+	}
+}
+
+vks::CameraPath::Frame VulkanExampleBase::getCameraPathFrame()
+{
+	vks::CameraPath::Frame frame{};
+	frame.position = camera.position;
+	frame.rotation = camera.rotation;
+	frame.timer = timer;
+	frame.mousePos = mousePos;
+	frame.mouseButtons = (mouseButtons.left ? vks::CameraPath::MOUSE_BUTTON_LEFT : 0) | (mouseButtons.right ? vks::CameraPath::MOUSE_BUTTON_RIGHT : 0) | (mouseButtons.middle ? vks::CameraPath::MOUSE_BUTTON_MIDDLE : 0);
+	return frame;
+}
+
+void VulkanExampleBase::applyCameraPathFrame(const vks::CameraPath::Frame &frame)
+{
+	if ((camera.position != frame.position) || (camera.rotation != frame.rotation)) {
+		camera.setPosition(frame.position);
+		camera.setRotation(frame.rotation);
+		viewUpdated = true;
+	}
+	// The recorded camera state already includes all movement
+	camera.keys.left = camera.keys.right = camera.keys.up = camera.keys.down = false;
+	timer = frame.timer;
+	mousePos = frame.mousePos;
+	mouseButtons.left = (frame.mouseButtons & vks::CameraPath::MOUSE_BUTTON_LEFT) != 0;
+	mouseButtons.right = (frame.mouseButtons & vks::CameraPath::MOUSE_BUTTON_RIGHT) != 0;
+	mouseButtons.middle = (frame.mouseButtons & vks::CameraPath::MOUSE_BUTTON_MIDDLE) != 0;
+}
+
+void VulkanExampleBase::runCameraPathReplay()
+{
+	std::vector<double> frameTimes;
+	std::vector<double> cpuTimes;
+	lastTimestamp = std::chrono::high_resolution_clock::now();
+	for (uint32_t pass = 0; pass < cameraPath.warmupPasses + cameraPath.passes; pass++) {
+		bool measuring = (pass >= cameraPath.warmupPasses);
+		if (pass == cameraPath.warmupPasses) {
+			// Read back the GPU times of the frames still in flight, so only the measured passes end up in the results
+			collectProfilerResults();
+			gpuProfiler.resetStatistics();
+			vks::cpuprofiler::clear();
+		}
+		for (auto &frame : cameraPath.getFrames()) {
+			applyCameraPathFrame(frame);
+			auto tStart = std::chrono::high_resolution_clock::now();
+			frameWaitTime = 0.0;
+			nextFrame();
+			auto tDiff = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+			if (measuring) {
+				frameTimes.push_back(tDiff);
+				cpuTimes.push_back(tDiff - frameWaitTime);
+			}
+		}
+	}
+	collectProfilerResults();
+	cameraPath.computeResults(frameTimes, cpuTimes, gpuProfiler.frameTimes, benchmark);
+	cameraPath.printResults();
+	std::string filename = benchmark.filename.empty() ? name + "_replay.csv" : benchmark.filename;
+	if (cameraPath.saveResults(filename)) {
+		std::cout << "Replay results written to " << filename << std::endl;
+	} else {
+		std::cerr << "Could not write replay results to " << filename << std::endl;
+	}
+}
+
+void VulkanExampleBase::collectProfilerResults()
+{
+	if (!gpuProfiler.enabled || !prepared) {
+		return;
+	}
+	// Collect the results of all frames still in flight
+	VK_CHECK_RESULT(vkDeviceWaitIdle(device));
+	for (uint32_t i = 0; i < settings.maxFramesInFlight; i++) {
+		gpuProfiler.beginFrame(i);
+	}
+	benchmark.gpuTimes = gpuProfiler.frameTimes;
+	benchmark.gpuTimings.clear();
+	for (auto &scope : gpuProfiler.statistics) {
+		const vks::GpuProfiler::ScopeStatistics &scopeStatistics = scope.second;
+		benchmark.gpuTimings.push_back({ scope.first, scopeStatistics.count, scopeStatistics.min, scopeStatistics.max, scopeStatistics.total / (double)scopeStatistics.count });
 	}
 }
 
+void VulkanExampleBase::saveProfilerResults()
+{
+	if (!gpuProfiler.enabled || !prepared) {
+		return;
+	}
+	collectProfilerResults();
+	for (auto &scope : gpuProfiler.statistics) {
+		const vks::GpuProfiler::ScopeStatistics &scopeStatistics = scope.second;
+		std::cout << "gpu: " << scope.first << ": avg " << scopeStatistics.total / (double)scopeStatistics.count << " ms, min " << scopeStatistics.min << " ms, max " << scopeStatistics.max << " ms (" << scopeStatistics.count << " samples)" << std::endl;
+	}
+	// Only save once, in benchmark mode this is called before the destructor
+	gpuProfiler.enabled = false;
+	if (!writeProfile) {
+		// Enabled by the benchmark for the GPU frame times only
+		return;
+	}
+	if (profileFilename.empty()) {
+		profileFilename = name + "_trace.json";
+	}
+	// CPU scopes and GPU regions share one time base, so they are written to a single trace (can be viewed with chrome://tracing or https://ui.perfetto.dev)
+	std::ofstream trace(profileFilename, std::ios::out | std::ios::trunc);
+	if (trace.is_open()) {
+		trace << std::fixed << std::setprecision(3);
+		trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+		bool first = true;
+		vks::cpuprofiler::writeTraceEvents(trace, first);
+		gpuProfiler.writeTraceEvents(trace, first);
+		trace << std::endl << "]}" << std::endl;
+	}
+	if (!trace.good()) {
+		std::cerr << "Could not write profile to " << profileFilename << std::endl;
+	}
+	vks::cpuprofiler::get().enabled = false;
+}
+
 void VulkanExampleBase::prepareFrame()
 {
-	// Acquire the next image from the swap chain
-	VkResult result = swapChain.acquireNextImage(semaphores.presentComplete, &currentBuffer);
-	// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
-	if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
-		windowResize();
+	// Wait until the GPU has finished the frame that last used this frame's resources (semaphores, per-frame buffers, etc.)
+	{
+		VKS_CPU_SCOPE("Wait for frame fence");
+		auto tWait = std::chrono::high_resolution_clock::now();
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &waitFences[currentFrame], VK_TRUE, UINT64_MAX));
+		frameWaitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
+	}
+	// The timestamps written by that frame are available now, so reading them back doesn't stall
+	gpuProfiler.beginFrame(currentFrame);
+	// Swap in pipelines that have been created in the background since the last frame
+	if (pipelineBuildQueue.update()) {
+		VK_CHECK_RESULT(vkDeviceWaitIdle(device));
+		pipelinesReady();
+		if (pipelineBuildQueue.getReadyCount() == pipelineBuildQueue.getJobCount()) {
+			auto tReady = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startupTimestamp).count();
+			std::cout << "all pipelines ready: " << tReady << " ms after startup (pipeline creation: " << pipelineBuildQueue.getBuildTime() << " ms)" << std::endl;
+		}
+	}
+	if (settings.headless) {
+		// There is one offscreen target per frame in flight, so the frame's fence also guards its target
+		currentBuffer = currentFrame;
+		// Signal the semaphore that would otherwise be signaled by the image acquisition, so examples can wait on it unchanged
+		VkSubmitInfo signalSubmitInfo = vks::initializers::submitInfo();
+		signalSubmitInfo.signalSemaphoreCount = 1;
+		signalSubmitInfo.pSignalSemaphores = &semaphores[currentFrame].presentComplete;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &signalSubmitInfo, VK_NULL_HANDLE));
+	} else {
+		// Acquire the next image from the swap chain
+		VkResult result;
+		{
+			VKS_CPU_SCOPE("Acquire image");
+			auto tWait = std::chrono::high_resolution_clock::now();
+			result = swapChain.acquireNextImage(semaphores[currentFrame].presentComplete, &currentBuffer);
+			frameWaitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
+		}
+		// Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
+		if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
+			windowResize();
+		}
+		else {
+			VK_CHECK_RESULT(result);
+		}
+	}
+	// Draw command buffers are per swap chain image, so if an older frame is still using the acquired image (and its command buffer) wait for it too
+	if (imagesInFlight[currentBuffer] != VK_NULL_HANDLE) {
+		VKS_CPU_SCOPE("Wait for image fence");
+		auto tWait = std::chrono::high_resolution_clock::now();
+		VK_CHECK_RESULT(vkWaitForFences(device, 1, &imagesInFlight[currentBuffer], VK_TRUE, UINT64_MAX));
+		frameWaitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
 	}
-	else {
-		VK_CHECK_RESULT(result);
+	imagesInFlight[currentBuffer] = waitFences[currentFrame];
+	VK_CHECK_RESULT(vkResetFences(device, 1, &waitFences[currentFrame]));
+	// No frame in flight is reading the image's overlay geometry anymore
+	if (settings.overlay) {
+		UIOverlay.upload(currentBuffer);
 	}
+	// Submit pending uploads and make finished ones available to this frame's work
+	uploadManager.update();
+	// Point the default submit info at this frame's semaphores
+	submitInfo.pWaitSemaphores = &semaphores[currentFrame].presentComplete;
+	submitInfo.pSignalSemaphores = &semaphores[currentFrame].renderComplete;
 }
 
 void VulkanExampleBase::submitFrame()
 {
-	VkResult result = swapChain.queuePresent(queue, currentBuffer, semaphores.renderComplete);
+	if (settings.headless) {
+		// Nothing is presented, so the render complete semaphore is waited on by the fence signal submission instead
+		VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+		VkSubmitInfo fenceSubmitInfo = vks::initializers::submitInfo();
+		fenceSubmitInfo.waitSemaphoreCount = 1;
+		fenceSubmitInfo.pWaitSemaphores = &semaphores[currentFrame].renderComplete;
+		fenceSubmitInfo.pWaitDstStageMask = &waitStageMask;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &fenceSubmitInfo, waitFences[currentFrame]));
+		currentFrame = (currentFrame + 1) % settings.maxFramesInFlight;
+		return;
+	}
+	// Signal the frame's fence once all work submitted to the queue up to this point has been executed
+	// This is done with an empty submission so derived classes can keep submitting their command buffers without a fence
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 0, nullptr, waitFences[currentFrame]));
+	VkResult result;
+	{
+		VKS_CPU_SCOPE("Present");
+		auto tWait = std::chrono::high_resolution_clock::now();
+		result = swapChain.queuePresent(queue, currentBuffer, semaphores[currentFrame].renderComplete);
+		frameWaitTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tWait).count();
+	}
+	currentFrame = (currentFrame + 1) % settings.maxFramesInFlight;
 	if (!((result == VK_SUCCESS) || (result == VK_SUBOPTIMAL_KHR))) {
 		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 			// Swap chain is no longer compatible with the surface and needs to be recreated
@@ -603,11 +1021,12 @@ void VulkanExampleBase::submitFrame()
 			VK_CHECK_RESULT(result);
 		}
 	}
-	VK_CHECK_RESULT(vkQueueWaitIdle(queue));
 }
 
 VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 {
+	startupTimestamp = std::chrono::high_resolution_clock::now();
+
 #if !defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// Check for a valid asset path
 	struct stat info;
@@ -664,7 +1083,7 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 			benchmark.active = true;
 			vks::tools::errorModeSilent = true;
 		}
-		// Warmup time (in seconds)
+		// Maximum warmup time (in seconds), warm up ends earlier once frame times are stable
 		if ((args[i] == std::string("-bw")) || (args[i] == std::string("--benchwarmup"))) {
 			if (args.size() > i + 1) {
 				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
@@ -697,10 +1116,101 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 				}
 			}
 		}
+		// Run the benchmark for every combination of the parameters listed in the given file
+		if (args[i] == std::string("--benchsweep")) {
+			if (args.size() > i + 1) {
+				if (benchmarkSweep.load(args[i + 1])) {
+					benchmark.active = true;
+					vks::tools::errorModeSilent = true;
+				}
+			} else {
+				std::cerr << "Benchmark sweep requires a parameter file!" << std::endl;
+			}
+		}
+		// Stop the benchmark once the confidence interval of the mean frame time is within the given percentage of the mean
+		if ((args[i] == std::string("-bp")) || (args[i] == std::string("--benchprecision"))) {
+			if (args.size() > i + 1) {
+				double precision = strtod(args[i + 1], &numConvPtr);
+				if ((numConvPtr != args[i + 1]) && (precision > 0.0)) {
+					benchmark.targetPrecision = precision / 100.0;
+				} else {
+					std::cerr << "Benchmark precision must be specified as a percentage greater than zero!" << std::endl;
+				}
+			}
+		}
 		// Output frame times to benchmark result file
 		if ((args[i] == std::string("-bt")) || (args[i] == std::string("--benchframetimes"))) {
 			benchmark.outputFrameTimes = true;
 		}
+		// Number of frames in flight
+		if ((args[i] == std::string("-fif")) || (args[i] == std::string("--framesinflight"))) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if ((numConvPtr != args[i + 1]) && (num > 0)) {
+					settings.maxFramesInFlight = num;
+				} else {
+					std::cerr << "Number of frames in flight must be specified as a number greater than zero!" << std::endl;
+				}
+			}
+		}
+		// Render to offscreen targets without a window, surface or swap chain
+		if (args[i] == std::string("--headless")) {
+			settings.headless = true;
+		}
+		// Number of frames rendered in headless mode before exiting (0 = until interrupted)
+		if (args[i] == std::string("--frames")) {
+			if (args.size() > i + 1) {
+				uint32_t num = strtol(args[i + 1], &numConvPtr, 10);
+				if (numConvPtr != args[i + 1]) {
+					settings.headlessFrames = num;
+				} else {
+					std::cerr << "Number of headless frames must be specified as a number!" << std::endl;
+				}
+			}
+		}
+		// UI overlay rebuilds per second without input (0 = every frame)
+		if (args[i] == std::string("--overlayrate")) {
+			if (args.size() > i + 1) {
+				float rate = strtof(args[i + 1], &numConvPtr);
+				if ((numConvPtr != args[i + 1]) && (rate >= 0.0f)) {
+					settings.overlayUpdateRate = rate;
+				} else {
+					std::cerr << "UI overlay update rate must be specified as a number greater than or equal to zero!" << std::endl;
+				}
+			}
+		}
+		// Record the camera path to the given file, F2 starts a new segment
+		if (args[i] == std::string("--recordpath")) {
+			if ((args.size() > i + 1) && (args[i + 1][0] != '-')) {
+				cameraPath.startRecording(args[i + 1]);
+			} else {
+				std::cerr << "Camera path recording requires a filename!" << std::endl;
+			}
+		}
+		// Replay a recorded camera path with a fixed time step and report frame time statistics per segment
+		if (args[i] == std::string("--replaypath")) {
+			if (args.size() > i + 1) {
+				if (cameraPath.load(args[i + 1])) {
+					vks::tools::errorModeSilent = true;
+				}
+			} else {
+				std::cerr << "Camera path replay requires a filename!" << std::endl;
+			}
+		}
+		// Measure the CPU time of profiler scopes and the GPU time of debug marker regions and write them as a Chrome trace (optional filename)
+		if (args[i] == std::string("--profile")) {
+			gpuProfiler.enabled = true;
+			writeProfile = true;
+			vks::cpuprofiler::get().enabled = true;
+			vks::cpuprofiler::setThreadName("Main thread");
+			if ((args.size() > i + 1) && (args[i + 1][0] != '-')) {
+				profileFilename = args[i + 1];
+			}
+		}
+	}
+	// The benchmark and the camera path replay report the GPU time per frame, which is measured by the profiler
+	if (benchmark.active || cameraPath.replaying()) {
+		gpuProfiler.enabled = true;
 	}
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
@@ -710,9 +1220,13 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 #elif defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	initWaylandConnection();
+	if (!settings.headless) {
+		initWaylandConnection();
+	}
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	initxcbConnection();
+	if (!settings.headless) {
+		initxcbConnection();
+	}
 #endif
 
 #if defined(_WIN32)
@@ -729,7 +1243,18 @@ VulkanExampleBase::VulkanExampleBase(bool enableValidation)
 VulkanExampleBase::~VulkanExampleBase()
 {
 	// Clean up Vulkan resources
+	pipelineBuildQueue.wait();
+	saveProfilerResults();
+	if (cameraPath.recording()) {
+		cameraPath.save();
+	}
+	gpuProfiler.destroy();
+	vks::debugmarker::beginRegionCallback = nullptr;
+	vks::debugmarker::endRegionCallback = nullptr;
 	swapChain.cleanup();
+	for (auto& headlessTarget : headlessTargets) {
+		delete headlessTarget;
+	}
 	if (descriptorPool != VK_NULL_HANDLE)
 	{
 		vkDestroyDescriptorPool(device, descriptorPool, nullptr);
@@ -741,20 +1266,23 @@ VulkanExampleBase::~VulkanExampleBase()
 		vkDestroyFramebuffer(device, frameBuffers[i], nullptr);
 	}
 
-	for (auto& shaderModule : shaderModules)
-	{
-		vkDestroyShaderModule(device, shaderModule, nullptr);
-	}
+	shaderModuleCache.destroy();
 	vkDestroyImageView(device, depthStencil.view, nullptr);
 	vkDestroyImage(device, depthStencil.image, nullptr);
 	vkFreeMemory(device, depthStencil.mem, nullptr);
 
+	// Store the pipeline cache so the next run doesn't need to recompile the pipelines
+	if (!vks::pipelinecache::save(getPipelineCacheFilename(), deviceProperties, device, pipelineCache)) {
+		std::cerr << "Could not write pipeline cache to " << getPipelineCacheFilename() << std::endl;
+	}
 	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
 	vkDestroyCommandPool(device, cmdPool, nullptr);
 
-	vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
-	vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
+	for (auto& frameSemaphores : semaphores) {
+		vkDestroySemaphore(device, frameSemaphores.presentComplete, nullptr);
+		vkDestroySemaphore(device, frameSemaphores.renderComplete, nullptr);
+	}
 	for (auto& fence : waitFences) {
 		vkDestroyFence(device, fence, nullptr);
 	}
@@ -763,6 +1291,8 @@ VulkanExampleBase::~VulkanExampleBase()
 		UIOverlay.freeResources();
 	}
 
+	uploadManager.destroy();
+
 	delete vulkanDevice;
 
 	if (settings.validation)
@@ -775,23 +1305,27 @@ VulkanExampleBase::~VulkanExampleBase()
 #if defined(_DIRECT2DISPLAY)
 
 #elif defined(VK_USE_PLATFORM_WAYLAND_KHR)
-	xdg_toplevel_destroy(xdg_toplevel);
-	xdg_surface_destroy(xdg_surface);
-	wl_surface_destroy(surface);
-	if (keyboard)
-		wl_keyboard_destroy(keyboard);
-	if (pointer)
-		wl_pointer_destroy(pointer);
-	wl_seat_destroy(seat);
-	xdg_wm_base_destroy(shell);
-	wl_compositor_destroy(compositor);
-	wl_registry_destroy(registry);
-	wl_display_disconnect(display);
+	if (!settings.headless) {
+		xdg_toplevel_destroy(xdg_toplevel);
+		xdg_surface_destroy(xdg_surface);
+		wl_surface_destroy(surface);
+		if (keyboard)
+			wl_keyboard_destroy(keyboard);
+		if (pointer)
+			wl_pointer_destroy(pointer);
+		wl_seat_destroy(seat);
+		xdg_wm_base_destroy(shell);
+		wl_compositor_destroy(compositor);
+		wl_registry_destroy(registry);
+		wl_display_disconnect(display);
+	}
 #elif defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// todo : android cleanup (if required)
 #elif defined(VK_USE_PLATFORM_XCB_KHR)
-	xcb_destroy_window(connection, window);
-	xcb_disconnect(connection);
+	if (!settings.headless) {
+		xcb_destroy_window(connection, window);
+		xcb_disconnect(connection);
+	}
 #endif
 }
 
@@ -903,40 +1437,41 @@ bool VulkanExampleBase::initVulkan()
 	// This is handled by a separate class that gets a logical device representation
 	// and encapsulates functions related to a device
 	vulkanDevice = new vks::VulkanDevice(physicalDevice);
-	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, !settings.headless, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 	if (res != VK_SUCCESS) {
 		vks::tools::exitFatal("Could not create Vulkan device: \n" + vks::tools::errorString(res), res);
 		return false;
 	}
 	device = vulkanDevice->logicalDevice;
+	shaderModuleCache.setDevice(device);
 
 	// Get a graphics queue from the device
 	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.graphics, 0, &queue);
+	// Uploads run in parallel to rendering if there is a dedicated transfer queue (a queue is only created for it if its family differs from the graphics and compute families)
+	const auto &queueFamilyIndices = vulkanDevice->queueFamilyIndices;
+	if ((queueFamilyIndices.transfer != queueFamilyIndices.graphics) && (queueFamilyIndices.transfer != queueFamilyIndices.compute)) {
+		transferQueueFamily = queueFamilyIndices.transfer;
+		vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
+	} else {
+		transferQueueFamily = queueFamilyIndices.graphics;
+		transferQueue = queue;
+	}
 
 	// Find a suitable depth format
 	VkBool32 validDepthFormat = vks::tools::getSupportedDepthFormat(physicalDevice, &depthFormat);
 	assert(validDepthFormat);
 
-	swapChain.connect(instance, physicalDevice, device);
-
-	// Create synchronization objects
-	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
-	// Create a semaphore used to synchronize image presentation
-	// Ensures that the image is displayed before we start submitting new commands to the queu
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete));
-	// Create a semaphore used to synchronize command submission
-	// Ensures that the image is not presented until all commands have been sumbitted and executed
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete));
+	if (!settings.headless) {
+		swapChain.connect(instance, physicalDevice, device);
+	}
 
 	// Set up submit info structure
-	// Semaphores will stay the same during application lifetime
+	// The semaphores are set for the current frame in flight by prepareFrame
 	// Command buffer submission info is set by each example
 	submitInfo = vks::initializers::submitInfo();
 	submitInfo.pWaitDstStageMask = &submitPipelineStages;
 	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &semaphores.presentComplete;
 	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &semaphores.renderComplete;
 
 #if defined(VK_USE_PLATFORM_ANDROID_KHR)
 	// Get Android device name and manufacturer (to display along GPU name)
@@ -1125,6 +1660,9 @@ void VulkanExampleBase::handleMessages(HWND hWnd, UINT uMsg, WPARAM wParam, LPAR
 				UIOverlay.visible = !UIOverlay.visible;
 			}
 			break;
+		case KEY_F2:
+			cameraPath.addSegment();
+			break;
 		case KEY_ESCAPE:
 			PostQuitMessage(0);
 			break;
@@ -1563,6 +2101,10 @@ void VulkanExampleBase::keyboardKey(struct wl_keyboard *keyboard,
 		if (state && settings.overlay)
 			settings.overlay = !settings.overlay;
 		break;
+	case KEY_F2:
+		if (state)
+			cameraPath.addSegment();
+		break;
 	case KEY_ESC:
 		quit = true;
 		break;
@@ -1903,6 +2445,9 @@ void VulkanExampleBase::handleEvent(const xcb_generic_event_t *event)
 					settings.overlay = !settings.overlay;
 				}
 				break;
+			case KEY_F2:
+				cameraPath.addSegment();
+				break;
 		}
 	}
 	break;
@@ -1961,14 +2506,39 @@ void VulkanExampleBase::mouseMoved(double x, double y, bool & handled) {}
 
 void VulkanExampleBase::buildCommandBuffers() {}
 
+void VulkanExampleBase::pipelinesReady()
+{
+	// The UI pipeline may be among the new pipelines
+	uiCmdBuffersOutdated.assign(uiCmdBuffersOutdated.size(), true);
+	buildCommandBuffers();
+}
+
+bool VulkanExampleBase::applyBenchmarkScenario(const vks::BenchmarkSweep::Scenario &scenario)
+{
+	// Can be overriden in derived class
+	return false;
+}
+
 void VulkanExampleBase::createSynchronizationPrimitives()
 {
-	// Wait fences to sync command buffer access
+	VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+	semaphores.resize(settings.maxFramesInFlight);
+	for (auto& frameSemaphores : semaphores) {
+		// Create a semaphore used to synchronize image presentation
+		// Ensures that the image is displayed before we start submitting new commands to the queue
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frameSemaphores.presentComplete));
+		// Create a semaphore used to synchronize command submission
+		// Ensures that the image is not presented until all commands have been sumbitted and executed
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frameSemaphores.renderComplete));
+	}
+	// Wait fences to sync access to per-frame resources, created signaled so the first wait on each frame returns immediately
 	VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-	waitFences.resize(drawCmdBuffers.size());
+	waitFences.resize(settings.maxFramesInFlight);
 	for (auto& fence : waitFences) {
 		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
 	}
+	// No swap chain image is in use by a frame yet
+	imagesInFlight.assign(swapChain.imageCount, VK_NULL_HANDLE);
 }
 
 void VulkanExampleBase::createCommandPool()
@@ -2042,7 +2612,7 @@ void VulkanExampleBase::setupFrameBuffer()
 	frameBuffers.resize(swapChain.imageCount);
 	for (uint32_t i = 0; i < frameBuffers.size(); i++)
 	{
-		attachments[0] = swapChain.buffers[i].view;
+		attachments[0] = settings.headless ? headlessTargets[i]->attachments[0].view : swapChain.buffers[i].view;
 		VK_CHECK_RESULT(vkCreateFramebuffer(device, &frameBufferCreateInfo, nullptr, &frameBuffers[i]));
 	}
 }
@@ -2058,7 +2628,8 @@ void VulkanExampleBase::setupRenderPass()
 	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// Headless targets are not presented, but kept in a layout they can be copied from
+	attachments[0].finalLayout = settings.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 	// Depth attachment
 	attachments[1].format = depthFormat;
 	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -2162,6 +2733,9 @@ void VulkanExampleBase::windowResize()
 	createCommandBuffers();
 	buildCommandBuffers();
 
+	// The device is idle, so no swap chain image is in use by a frame (the image count may also have changed)
+	imagesInFlight.assign(swapChain.imageCount, VK_NULL_HANDLE);
+
 	vkDeviceWaitIdle(device);
 
 	if ((width > 0.0f) && (height > 0.0f)) {
@@ -2235,4 +2809,27 @@ void VulkanExampleBase::setupSwapChain()
 	swapChain.create(&width, &height, settings.vsync);
 }
 
+void VulkanExampleBase::setupHeadlessTargets()
+{
+	// One color target per frame in flight takes the place of the swap chain images
+	for (uint32_t i = 0; i < settings.maxFramesInFlight; i++) {
+		vks::Framebuffer *headlessTarget = new vks::Framebuffer(vulkanDevice);
+		headlessTarget->width = width;
+		headlessTarget->height = height;
+		vks::AttachmentCreateInfo attachmentInfo = {};
+		attachmentInfo.width = width;
+		attachmentInfo.height = height;
+		attachmentInfo.layerCount = 1;
+		attachmentInfo.format = VK_FORMAT_B8G8R8A8_UNORM;
+		// Transfer source so the rendered images can be read back (e.g. for comparisons)
+		attachmentInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		headlessTarget->addAttachment(attachmentInfo);
+		headlessTargets.push_back(headlessTarget);
+	}
+	// The frame buffers, render pass and command buffers are set up from the swap chain's properties
+	swapChain.colorFormat = VK_FORMAT_B8G8R8A8_UNORM;
+	swapChain.imageCount = static_cast<uint32_t>(headlessTargets.size());
+	swapChain.queueNodeIndex = vulkanDevice->queueFamilyIndices.graphics;
+}
+
 void VulkanExampleBase::OnUpdateUIOverlay(vks::UIOverlay *overlay) {}
\ No newline at end of file
@@ -50,9 +50,19 @@
 
 #include "VulkanInitializers.hpp"
 #include "VulkanDevice.hpp"
+#include "VulkanUploadManager.hpp"
 #include "VulkanSwapChain.hpp"
+#include "VulkanFrameBuffer.hpp"
+#include "VulkanPipelineCache.hpp"
+#include "pipelinebuildqueue.hpp"
+#include "taskgraph.hpp"
+#include "VulkanShaderModuleCache.hpp"
+#include "VulkanGpuProfiler.hpp"
+#include "cpuprofiler.hpp"
 #include "camera.hpp"
 #include "benchmark.hpp"
+#include "benchmarksweep.hpp"
+#include "camerapath.hpp"
 
 class VulkanExampleBase
 {
@@ -66,15 +76,47 @@ private:
 	void handleMouseMove(int32_t x, int32_t y);
 	void nextFrame();
 	void updateOverlay();
+	// Inputs of the last UI overlay rebuild, the overlay is only rebuilt if one of them changed or the update interval has passed
+	struct {
+		bool valid = false;
+		float elapsed = 0.0f;
+		glm::vec2 mousePos;
+		bool mouseLeft = false;
+		bool mouseRight = false;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t fps = 0;
+	} overlayState;
 	void createPipelineCache();
+	std::string getPipelineCacheFilename();
+	// Describes where the pipeline cache data came from, for the startup report
+	std::string pipelineCacheStatus;
+	std::chrono::time_point<std::chrono::high_resolution_clock> startupTimestamp;
+	// Build queue job creating the UI overlay pipeline
+	uint32_t uiPipelineJob = 0;
+	// File the CPU and GPU profiler results are written to on shutdown
+	std::string profileFilename;
+	// Set if the profiler results have been requested via command line (the profiler is also enabled by the benchmark)
+	bool writeProfile = false;
+	// Time the current frame spent waiting for the GPU and the swap chain in milliseconds, excluded from the benchmark's CPU time
+	double frameWaitTime = 0.0;
+	void collectProfilerResults();
+	void saveProfilerResults();
+	void runBenchmark();
+	void runBenchmarkSweep();
+	vks::CameraPath::Frame getCameraPathFrame();
+	void applyCameraPathFrame(const vks::CameraPath::Frame &frame);
+	void runCameraPathReplay();
 	void createCommandPool();
 	void createSynchronizationPrimitives();
 	void initSwapchain();
 	void setupSwapChain();
+	void setupHeadlessTargets();
 	void createCommandBuffers();
 	void destroyCommandBuffers();
-	std::string shaderDir = "glsl";
 protected:
+	// Shader language selected via command line, examples without HLSL shaders may reset it to glsl in their constructor
+	std::string shaderDir = "glsl";
 	// Returns the path to the root of the glsl or hlsl shader directory.
 	std::string getShadersPath() const;
 
@@ -103,6 +145,9 @@ protected:
 	VkDevice device;
 	// Handle to the device graphics queue that command buffers are submitted to
 	VkQueue queue;
+	// Handle to the queue uploads are submitted to, a dedicated transfer queue if the device has one, the graphics queue otherwise
+	VkQueue transferQueue;
+	uint32_t transferQueueFamily;
 	// Depth buffer format (selected during Vulkan initialization)
 	VkFormat depthFormat;
 	// Command buffer pool
@@ -113,6 +158,10 @@ protected:
 	VkSubmitInfo submitInfo;
 	// Command buffers used for rendering
 	std::vector<VkCommandBuffer> drawCmdBuffers;
+	// Secondary command buffers the UI overlay is recorded into, one per swap chain image (see executeUI)
+	std::vector<VkCommandBuffer> uiCmdBuffers;
+	// Set for the UI command buffers that have to be recorded again before they are executed next
+	std::vector<bool> uiCmdBuffersOutdated;
 	// Global render pass for frame buffer writes
 	VkRenderPass renderPass;
 	// List of available frame buffers (same as number of swap chain images)
@@ -121,20 +170,37 @@ protected:
 	uint32_t currentBuffer = 0;
 	// Descriptor set pool
 	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
-	// List of shader modules created (stored for cleanup)
-	std::vector<VkShaderModule> shaderModules;
-	// Pipeline cache object
+	// Shader modules loaded via loadShader, shared between pipelines using the same SPIR-V (owns the modules)
+	vks::ShaderModuleCache shaderModuleCache;
+	// Pipeline cache object, persisted to disk on shutdown
 	VkPipelineCache pipelineCache;
+	// Creates pipelines on worker threads into the shared pipeline cache, see pipelinesReady
+	vks::PipelineBuildQueue pipelineBuildQueue;
+	// Worker threads for per-frame CPU work (e.g. a vks::TaskGraph), jobs may only be submitted from the main thread and from jobs
+	vks::TaskScheduler taskScheduler;
+	// Measures the GPU time of debug marker regions (vks::debugmarker::beginRegion/endRegion), enabled via command line
+	vks::GpuProfiler gpuProfiler;
+	// Batches buffer and texture uploads into few submissions on the transfer queue, updated once per frame in prepareFrame
+	vks::UploadManager uploadManager;
 	// Wraps the swap chain to present images (framebuffers) to the windowing system
 	VulkanSwapChain swapChain;
+	// Offscreen color targets used in place of the swap chain images in headless mode (one per frame in flight)
+	std::vector<vks::Framebuffer*> headlessTargets;
 	// Synchronization semaphores
-	struct {
+	struct Semaphores {
 		// Swap chain image presentation
 		VkSemaphore presentComplete;
 		// Command buffer submission and execution
 		VkSemaphore renderComplete;
-	} semaphores;
+	};
+	// One set of semaphores per frame in flight
+	std::vector<Semaphores> semaphores;
+	// Fences signaled once the GPU has finished a frame, one per frame in flight
 	std::vector<VkFence> waitFences;
+	// Fence of the frame that last used a swap chain image (and its draw command buffer), one per swap chain image
+	std::vector<VkFence> imagesInFlight;
+	// Index of the active frame in flight, selects the per-frame resources (0..settings.maxFramesInFlight-1)
+	uint32_t currentFrame = 0;
 public:
 	bool prepared = false;
 	uint32_t width = 1280;
@@ -146,6 +212,9 @@ public:
 	float frameTimer = 1.0f;
 
 	vks::Benchmark benchmark;
+	vks::BenchmarkSweep benchmarkSweep;
+	// Records the camera and UI inputs of every frame or replays such a recording, see --recordpath and --replaypath
+	vks::CameraPath cameraPath;
 
 	/** @brief Encapsulated physical and logical vulkan device */
 	vks::VulkanDevice *vulkanDevice;
@@ -160,6 +229,14 @@ public:
 		bool vsync = false;
 		/** @brief Enable UI overlay */
 		bool overlay = false;
+		/** @brief Number of frames the CPU may record and submit ahead of the GPU (must be set in the derived constructor or via command line) */
+		uint32_t maxFramesInFlight = 2;
+		/** @brief Set to true if rendering to offscreen targets without a window, surface and swapchain has been requested via command line */
+		bool headless = false;
+		/** @brief Number of frames rendered in headless mode before the render loop returns, 0 renders until SIGINT or SIGTERM */
+		uint32_t headlessFrames = 0;
+		/** @brief Number of UI overlay rebuilds per second while there is no input, 0 rebuilds it every frame */
+		float overlayUpdateRate = 30.0f;
 	} settings;
 
 	VkClearColorValue defaultClearColor = { { 0.025f, 0.025f, 0.025f, 1.0f } };
@@ -324,8 +401,18 @@ public:
 	virtual void setupFrameBuffer();
 	/** @brief (Virtual) Setup a default renderpass */
 	virtual void setupRenderPass();
+	/** @brief (Virtual) Called when pipelines added to the pipeline build queue have become available (with the device idle), rebuilds the draw command buffers by default */
+	virtual void pipelinesReady();
 	/** @brief (Virtual) Called after the physical device features have been read, can be used to set features to enable on the device */
 	virtual void getEnabledFeatures();
+	/**
+	* (Virtual) Called with the device idle before each scenario of a benchmark sweep, to be implemented by the sample application
+	*
+	* @param scenario Parameter names and values of the scenario
+	*
+	* @return False if a parameter or value is not supported, the scenario is skipped
+	*/
+	virtual bool applyBenchmarkScenario(const vks::BenchmarkSweep::Scenario &scenario);
 
 	/** @brief Prepares all Vulkan resources and functions required to run the sample */
 	virtual void prepare();
@@ -338,10 +425,18 @@ public:
 
 	/** @brief Adds the drawing commands for the ImGui overlay to the given command buffer */
 	void drawUI(const VkCommandBuffer commandBuffer);
-
-	/** Prepare the next frame for workload sumbission by acquiring the next swap chain image */
+	/**
+	* Execute the UI overlay's secondary command buffer for the current swap chain image, recording it first if the UI has changed
+	* Used instead of drawUI if uiSecondaryCommandBuffers is set, the render pass must have been begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+	* @note The UI command buffer is re-recorded while the primary command buffer is recorded, so the primary command buffer has to be recorded every frame (after prepareFrame)
+	*/
+	void executeUI(const VkCommandBuffer commandBuffer);
+	/** @brief The example executes the UI via executeUI, so UI changes only re-record the UI command buffers instead of calling buildCommandBuffers */
+	bool uiSecondaryCommandBuffers = false;
+
+	/** Prepare the next frame for workload sumbission by waiting for the current frame's fence and acquiring the next swap chain image */
 	void prepareFrame();
-	/** @brief Presents the current image to the swap chain */
+	/** @brief Presents the current image to the swap chain and advances to the next frame in flight */
 	void submitFrame();
 	/** @brief (Virtual) Default image acquire + submission and command buffer submission function */
 	virtual void renderFrame();
@@ -368,7 +463,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int)									\
 	for (int32_t i = 0; i < __argc; i++) { VulkanExample::args.push_back(__argv[i]); };  			\
 	vulkanExample = new VulkanExample();															\
 	vulkanExample->initVulkan();																	\
-	vulkanExample->setupWindow(hInstance, WndProc);													\
+	if (!vulkanExample->settings.headless) vulkanExample->setupWindow(hInstance, WndProc);			\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
@@ -414,7 +509,7 @@ int main(const int argc, const char *argv[])													    \
 	for (size_t i = 0; i < argc; i++) { VulkanExample::args.push_back(argv[i]); };  				\
 	vulkanExample = new VulkanExample();															\
 	vulkanExample->initVulkan();																	\
-	vulkanExample->setupWindow();					 												\
+	if (!vulkanExample->settings.headless) vulkanExample->setupWindow();							\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
@@ -435,7 +530,7 @@ int main(const int argc, const char *argv[])													    \
 	for (size_t i = 0; i < argc; i++) { VulkanExample::args.push_back(argv[i]); };  				\
 	vulkanExample = new VulkanExample();															\
 	vulkanExample->initVulkan();																	\
-	vulkanExample->setupWindow();					 												\
+	if (!vulkanExample->settings.headless) vulkanExample->setupWindow();							\
 	vulkanExample->prepare();																		\
 	vulkanExample->renderLoop();																	\
 	delete(vulkanExample);																			\
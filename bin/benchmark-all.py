@@ -5,65 +5,17 @@ import os
 import platform
 
 EXAMPLES = [
-	"bloom",
-	"computecloth",
-	"computecullandlod",
-	"computenbody",
-	"computeparticles",
-	"computeshader",
-	"debugmarker",
-	"deferred",
-	"deferredmultisampling",
-	"deferredshadows",
-	"displacement",
-	"distancefieldfonts",
-	"dynamicuniformbuffer",
-	"gears",
-	"geometryshader",
-	"hdr",
-	"imgui",
-	"indirectdraw",
-	"instancing",
-	"mesh",
-	"multisampling",
-	"multithreading",
-	"occlusionquery",
-	"offscreen",
-	"parallaxmapping",
-	"particlefire",
-	"pbrbasic",
-	"pbribl",
-	"pbrtexture",
-	"pipelines",
-	"pushconstants",
-	"radialblur",
-	"raytracing",
-	"scenerendering",
-	"shadowmapping",
-	"shadowmappingomni",
-	"skeletalanimation",
-	"specializationconstants",
-	"sphericalenvmapping",
-	"ssao",
-	"stencilbuffer",
-	"subpasses",
-	"terraintessellation",
-	"tessellation",
-	"textoverlay",
-	"texture",
-	"texture3d",
-	"texturearray",
-	"texturecubemap",
-	"texturemipmapgen",
-	"texturesparseresidency",
-	"triangle",
-	"viewportarray",
-	"vulkanscene"
+	"computeraytracing"
 ]
 
+# Parameter files for examples that support benchmark sweeps (all scenarios are measured in a single run)
+SWEEPS = {
+	"computeraytracing": "../data/benchmarks/computeraytracing.sweep"
+}
+
 CURR_INDEX = 0
 
-ARGS = "-fullscreen -b"
+ARGS = "--fullscreen -b"
 
 print("Benchmarking all examples...")
 
@@ -71,10 +23,14 @@ os.makedirs("./benchmark", exist_ok=True)
 
 for example in EXAMPLES:
 	print("---- (%d/%d) Running %s in benchmark mode ----" % (CURR_INDEX+1, len(EXAMPLES), example))
+	EXAMPLE_ARGS = "%s -bf ./benchmark/%s.csv" % (ARGS, example)
+	if example in SWEEPS:
+		# Scenarios end as soon as the mean frame time is known within 2%, to keep the run time of large sweeps down
+		EXAMPLE_ARGS += " --benchsweep %s -bp 2" % SWEEPS[example]
 	if platform.system() == 'Linux':
-		RESULT_CODE = subprocess.call("./%s %s -bf ./benchmark/%s.csv 5" % (example, ARGS, example), shell=True)
+		RESULT_CODE = subprocess.call("./%s %s" % (example, EXAMPLE_ARGS), shell=True)
 	else:
-		RESULT_CODE = subprocess.call("%s %s -bf ./benchmark/%s.csv 5" % (example, ARGS, example))
+		RESULT_CODE = subprocess.call("%s %s" % (example, EXAMPLE_ARGS))
 	if RESULT_CODE == 0:
 		print("Results written to ./benchmark/%s.csv" % example)
 	else:
@@ -1,3 +1,5 @@
 glslangvalidator -V texture.frag -o texture.frag.spv
 glslangvalidator -V texture.vert -o texture.vert.spv
-glslangvalidator -V raytracing.comp -o raytracing.comp.spv
\ No newline at end of file
+glslangvalidator -V raytracing.comp -o raytracing.comp.spv
+glslangvalidator -V visibility.vert -o visibility.vert.spv
+glslangvalidator -V visibility.frag -o visibility.frag.spv
\ No newline at end of file
@@ -0,0 +1,14 @@
+#version 450
+
+layout (location = 0) in vec2 inBarycentrics;
+layout (location = 1) flat in uint inTriangle;
+
+// Zero is reserved for pixels not covered by any triangle (cleared)
+layout (location = 0) out uint outTriangle;
+layout (location = 1) out vec2 outBarycentrics;
+
+void main() 
+{
+	outTriangle = inTriangle + 1;
+	outBarycentrics = inBarycentrics;
+}
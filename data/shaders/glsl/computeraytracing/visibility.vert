@@ -0,0 +1,78 @@
+#version 450
+
+// Rasterizes the scene triangles with the same camera and sub pixel offset as the primary rays of the compute shader
+
+#define NEAR 0.01
+#define FAR 1000.0
+
+struct Camera 
+{
+	vec3 pos;   
+	vec3 lookat;
+	float fov; 
+};
+
+// Leading members of the compute shader's uniform block, shares its per-frame slots
+layout (binding = 0) uniform UBO 
+{
+	vec3 lightPos;
+	float aspectRatio;
+	vec4 fogColor;
+	Camera camera;
+	uint accumulationFrame;
+	uint accumulate;
+} ubo;
+
+struct Triangle 
+{
+	vec4 v1;
+	vec4 v2;
+	vec4 v3;
+	vec4 diffuse;
+	float radius;
+	float specular;
+	int id;
+};
+
+layout (std140, binding = 1) readonly buffer Triangles
+{
+	Triangle triangles[ ];
+};
+
+layout (push_constant) uniform PushConsts {
+	// Width and height of the visibility buffer
+	float resolution;
+} pushConsts;
+
+layout (location = 0) out vec2 outBarycentrics;
+layout (location = 1) flat out uint outTriangle;
+
+out gl_PerVertex 
+{
+	vec4 gl_Position;
+};
+
+// Must match the compute shader
+vec2 jitter(uint frame)
+{
+	return fract(vec2(0.5) + vec2(0.7548776662, 0.5698402910) * float(frame));
+}
+
+void main() 
+{
+	// Non-indexed draw with three vertices per triangle
+	uint index = gl_VertexIndex / 3;
+	uint corner = gl_VertexIndex % 3;
+	Triangle tri = triangles[index];
+	vec3 pos = (corner == 0) ? tri.v1.xyz : ((corner == 1) ? tri.v2.xyz : tri.v3.xyz);
+	// Weights of the second and third vertex, interpolated perspective correct
+	outBarycentrics = vec2((corner == 1) ? 1.0 : 0.0, (corner == 2) ? 1.0 : 0.0);
+	outTriangle = index;
+
+	// The compute shader's ray for pixel x passes through x + jitter, while rasterization samples pixel centers
+	vec2 offset = (ubo.accumulate != 0) ? jitter(ubo.accumulationFrame) : vec2(0.0);
+	offset = (1.0 - 2.0 * offset) / pushConsts.resolution;
+	vec3 viewPos = pos - ubo.camera.pos;
+	float depth = -viewPos.z;
+	gl_Position = vec4(viewPos.x / ubo.aspectRatio + offset.x * depth, viewPos.y + offset.y * depth, (depth - NEAR) * FAR / (FAR - NEAR), depth);
+}
@@ -11,6 +11,9 @@
 #include <string.h>
 #include <assert.h>
 #include <vector>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -20,6 +23,10 @@
 #include <vulkan/vulkan.h>
 #include "vulkanexamplebase.h"
 #include "VulkanTexture.hpp"
+#include "VulkanFrameBuffer.hpp"
+#include "bvh.hpp"
+#include "cpuraytracer.hpp"
+#include "VulkanParallelCommandRecorder.hpp"
 
 #define VERTEX_BUFFER_BIND_ID 0
 #define ENABLE_VALIDATION false
@@ -30,6 +37,9 @@
 #define TEX_DIM 2048
 #endif
 
+// Number of bins of the traversal cost histogram, must match the compute shader
+#define HISTOGRAM_BINS 32
+
 class VulkanExample : public VulkanExampleBase
 {
 public:
@@ -41,35 +51,164 @@ public:
 		VkDescriptorSet descriptorSetPreCompute;	// Raytraced image display shader bindings before compute shader image manipulation
 		VkDescriptorSet descriptorSet;				// Raytraced image display shader bindings after compute shader image manipulation
 		VkPipeline pipeline;						// Raytraced image display pipeline
+		uint32_t pipelineJob;						// Pipeline build queue job creating the display pipeline
 		VkPipelineLayout pipelineLayout;			// Layout of the graphics pipeline
+		std::vector<VkCommandBuffer> sceneCommandBuffers;	// Secondary command buffers displaying the ray traced image, one per swap chain image
 	} graphics;
 
 	// Resources for the compute part of the example
 	struct {
 		struct {
-			vks::Buffer triangles;				// Shader storage buffer object with scene triangles
+			vks::Buffer triangles;				// Shader storage buffer object with scene triangles (in BVH leaf order)
+			vks::Buffer bvhNodes;				// Shader storage buffer object with the nodes of the bounding volume hierarchy
 		} storageBuffers;
-		vks::Buffer uniformBuffer;					// Uniform buffer object containing scene data
+		vks::Buffer uniformBuffer;					// Uniform buffer object containing scene data, split into one slot per frame in flight
+		VkDeviceSize uniformSlotSize;				// Size of a single (aligned) per-frame slot in the uniform buffer
 		VkQueue queue;								// Separate queue for compute commands (queue family may differ from the one used for graphics)
 		VkCommandPool commandPool;					// Use a separate command pool (queue family may differ from the one used for graphics)
-		VkCommandBuffer commandBuffer;				// Command buffer storing the dispatch commands and barriers
-		VkFence fence;								// Synchronization fence to avoid rewriting compute CB if still in use
+		std::vector<VkCommandBuffer> commandBuffers;	// Command buffers storing the dispatch commands, one per frame in flight (each binds its own uniform slot)
+		std::vector<bool> dispatchRecorded;			// True if the frame's command buffer contains the ray tracing dispatch (not the case until the pipeline has been created)
+		struct {
+			VkSemaphore ready;						// Signaled by the graphics queue once the ray traced image has been sampled and can be overwritten
+			VkSemaphore complete;					// Signaled by the compute queue once the ray traced image has been written
+		} semaphores;
 		VkDescriptorSetLayout descriptorSetLayout;	// Compute shader binding layout
 		VkDescriptorSet descriptorSet;				// Compute shader bindings
 		VkPipelineLayout pipelineLayout;			// Layout of the compute pipeline
 		VkPipeline pipeline;						// Compute raytracing pipeline
+		uint32_t pipelineJob;						// Pipeline build queue job creating the compute pipeline
 		struct UBOCompute {							// Compute shader uniform block object
 			glm::vec3 lightPos;
 			float aspectRatio;						// Aspect ratio of the viewport
 			glm::vec4 fogColor = glm::vec4(0.0f);
-			struct {
+			struct {								// Padded to match the std140 layout of the shader
 				glm::vec3 pos = glm::vec3(0.0f, 0.0f, 4.0f);
+				float _pad;
 				glm::vec3 lookat = glm::vec3(0.0f, 0.5f, 0.0f);
 				float fov = 10.0f;
 			} camera;
+			uint32_t accumulationFrame = 0;			// Number of frames accumulated into the ray traced image so far
+			uint32_t accumulate = 0;				// Accumulate jittered samples over frames (anti aliasing) instead of tracing a new image every frame
+			uint32_t heatmap = 0;					// Output the traversal cost of each pixel instead of the shaded color (see HeatmapMode)
+			float heatmapMax = 64.0f;				// Cost mapped to the end of the heatmap's color ramp and to the last histogram bin
+			uint32_t hybrid = 0;					// Read the primary hits from the visibility buffer instead of tracing primary rays (set per frame in draw())
+			uint32_t aoSamples = 2;					// Number of ambient occlusion rays per pixel
+			float aoRadius = 0.5f;					// Maximum distance of occluders for ambient occlusion
+			float reflectionStrength = 0.25f;		// Share of the reflected color, no reflection rays are traced if zero
+			uint32_t hitCache = 0;					// Store the primary hits or shade the stored hits (see HitCacheMode, set per frame in draw())
 		} ubo;
 	} compute;
 
+	// Resources for the hybrid mode, which rasterizes the primary visibility instead of tracing primary rays
+	// The compute shader then only traces the secondary rays from the visible surfaces
+	struct {
+		vks::Framebuffer *framebuffer = nullptr;	// Visibility buffer: triangle index + 1, barycentrics and depth, same size as the ray traced image
+		VkDescriptorSetLayout descriptorSetLayout;	// Visibility pass binding layout
+		VkDescriptorSet descriptorSet;				// Visibility pass bindings (uniform buffer and triangles shared with the compute shader)
+		VkPipelineLayout pipelineLayout;
+		VkPipeline pipeline;
+		uint32_t pipelineJob;						// Pipeline build queue job creating the visibility pipeline
+		std::vector<VkCommandBuffer> commandBuffers;	// Command buffers for the graphics queue, one per frame in flight
+		VkSemaphore complete;						// Signaled once the visibility buffer has been written, waited on by the compute submission
+		// The scene's draw is split into batches that are recorded into secondary command buffers in parallel
+		vks::ParallelCommandRecorder recorder;		// Per-thread command pools, one set per frame in flight
+		std::vector<VkCommandBuffer> batchCommandBuffers;
+		uint32_t batchSize = 16384;					// Triangles per batch
+	} visibility;
+
+	// Scene and render settings, can be changed by benchmark sweep scenarios
+	struct {
+		uint32_t resolution = TEX_DIM;				// Width and height of the ray traced image
+		uint32_t triangleCount = 1;					// Number of triangles in the scene
+		uint32_t workgroupSize = 16;				// Width and height of a compute shader work group
+		bool rayCounters = false;					// Count rays, visited BVH nodes and triangle tests (specialization constant, no cost if disabled)
+		bool hybrid = false;						// Rasterize the primary visibility and only trace secondary rays
+		bool hitCache = true;						// Reuse the primary hits of the previous frame while the camera and the geometry don't change
+		uint32_t backend = 0;						// Where the image is traced (see Backend)
+	} options;
+
+	enum Backend : uint32_t {
+		BACKEND_GPU = 0,							// Compute shader only
+		BACKEND_CPU = 1,							// CPU ray tracer, the image is copied to the displayed texture instead of dispatching the compute shader
+		BACKEND_SPLIT = 2							// The compute shader traces the upper rows and the CPU the lower ones at the same time (see split)
+	};
+
+	enum HeatmapMode : uint32_t {
+		HEATMAP_OFF = 0,
+		HEATMAP_NODES = 1,							// Number of BVH nodes visited by all rays of a pixel
+		HEATMAP_TRIANGLES = 2						// Number of triangles tested by all rays of a pixel
+	};
+
+	enum HitCacheMode : uint32_t {
+		HIT_CACHE_OFF = 0,
+		HIT_CACHE_WRITE = 1,						// Find the primary hits and store them
+		HIT_CACHE_READ = 2							// Shade the stored primary hits, no primary rays are traced or rasterized
+	};
+
+	// Primary hits (triangle, distance and barycentrics) of every pixel, kept on the GPU
+	// Only the light moves from frame to frame, so as long as the camera, the geometry and the resolution stay the same the hits can be reused
+	struct {
+		vks::Buffer buffer;							// Device local storage buffer, one PrimaryHit (16 bytes) per pixel
+		bool valid = false;							// True if a frame storing the hits for the current geometry has been submitted
+		glm::vec3 cameraPos;						// View the stored hits were found for
+		float aspectRatio;
+		uint32_t reusedFrames = 0;					// Number of consecutive frames shaded from the stored hits
+	} hitCache;
+
+	// Totals written by the compute shader if ray counters are enabled
+	struct RayCounters {
+		uint32_t rays;
+		uint32_t nodesVisited;
+		uint32_t triangleTests;
+		uint32_t histogram[HISTOGRAM_BINS];			// Pixels per traversal cost range, only written in heatmap mode
+	};
+
+	// Ray counters are read back without stalling: each frame in flight has its own slot, which is read once the frame's fence has been waited on
+	struct {
+		vks::Buffer buffer;							// Host visible storage buffer, one slot per frame in flight
+		VkDeviceSize slotSize;						// Size of a single (aligned) slot
+		std::vector<bool> slotWritten;				// True if a frame with counters enabled has been submitted since the slot was read
+		RayCounters last = {};						// Counters of the most recently completed frame
+		double raysPerSecond = 0.0;
+		double frameTime = 0.0;						// Seconds between the last two readbacks
+		std::chrono::high_resolution_clock::time_point lastReadback;
+	} counters;
+
+	// Acceleration structure for the scene triangles, built on the CPU
+	vks::BVH bvh;
+
+	// CPU ray tracing backend, traces the same triangles and hierarchy as the compute shader
+	vks::CpuRayTracer cpuRayTracer;
+	struct {
+		vks::Buffer stagingBuffer;					// Host visible buffer the CPU traces into, one slot per frame in flight, copied to the displayed texture on the compute queue
+		VkDeviceSize slotSize = 0;					// Size of a single slot, zero until the buffer has been created
+	} cpu;
+
+	// Split frame rendering: the compute shader and the CPU trace disjoint row ranges of the image at the same time
+	// The split is moved every frame so both sides take about equally long, based on the rows per millisecond each of them managed in a previous frame
+	struct SplitTiming {
+		uint32_t gpuRows;							// Rows given to the compute shader, zero if the frame wasn't timed
+		double cpuMilliseconds;						// Time the CPU took for the remaining rows
+	};
+	struct {
+		float gpuShare = 0.5f;						// Smoothed share of the rows traced by the compute shader
+		uint32_t gpuRows = 0;						// Rows traced by the compute shader in the current frame, a multiple of the work group size (or the whole image)
+		VkQueryPool queryPool = VK_NULL_HANDLE;		// Timestamps around the dispatch, two per frame in flight
+		std::vector<VkCommandBuffer> copyCommandBuffers;	// Copy the CPU rows from the staging slot to the image, submitted once the CPU has traced them, one per frame in flight
+		std::vector<SplitTiming> slotTimings;		// Timing of the last frame that used a slot
+		double gpuMilliseconds = 0.0;				// Last measured dispatch time
+		double combinedRaysPerSecond = 0.0;			// CPU and GPU rays, requires the ray counters for the GPU part
+	} split;
+
+	// Per-frame CPU work as a graph of dependent nodes, see prepareFrameGraph
+	vks::TaskGraph frameGraph;
+	// Values determined by the frame graph's nodes and used by later nodes of the same frame
+	struct {
+		bool hybrid = false;
+		bool splitCopy = false;					// The CPU rows of a split frame are copied by a separate submission after they have been traced
+		vks::CpuRayTracer::Settings cpuTraceSettings;
+	} frame;
+
 	
 	struct Triangle
 	{        // Shader uses std140 layout (so we only use vec4 instead of vec3)
@@ -97,6 +236,13 @@ public:
 	{
 		title = "Compute shader ray tracing";
 		settings.overlay = true;
+		// The shaders of this example are only maintained in GLSL
+		if (shaderDir == "hlsl") {
+			std::cerr << "No HLSL shaders for this example, using the GLSL shaders instead" << std::endl;
+			shaderDir = "glsl";
+		}
+		// The primary command buffers are recorded every frame anyway (see recordGraphicsCommandBuffer), UI changes only re-record the UI
+		uiSecondaryCommandBuffers = true;
 		compute.ubo.aspectRatio = (float)width / (float)height;
 		timerSpeed *= 0.25f;
 
@@ -119,10 +265,31 @@ public:
 		vkDestroyPipeline(device, compute.pipeline, nullptr);
 		vkDestroyPipelineLayout(device, compute.pipelineLayout, nullptr);
 		vkDestroyDescriptorSetLayout(device, compute.descriptorSetLayout, nullptr);
-		vkDestroyFence(device, compute.fence, nullptr);
+		vkDestroySemaphore(device, compute.semaphores.ready, nullptr);
+		vkDestroySemaphore(device, compute.semaphores.complete, nullptr);
 		vkDestroyCommandPool(device, compute.commandPool, nullptr);
+		compute.uniformBuffer.unmap();
 		compute.uniformBuffer.destroy();
 		compute.storageBuffers.triangles.destroy();
+		compute.storageBuffers.bvhNodes.destroy();
+		counters.buffer.unmap();
+		counters.buffer.destroy();
+
+		// Hybrid mode
+		vkDestroyPipeline(device, visibility.pipeline, nullptr);
+		vkDestroyPipelineLayout(device, visibility.pipelineLayout, nullptr);
+		vkDestroyDescriptorSetLayout(device, visibility.descriptorSetLayout, nullptr);
+		vkDestroySemaphore(device, visibility.complete, nullptr);
+		visibility.recorder.destroy();
+		delete visibility.framebuffer;
+		hitCache.buffer.destroy();
+
+		// CPU ray tracing
+		if (cpu.slotSize > 0) {
+			cpu.stagingBuffer.unmap();
+			cpu.stagingBuffer.destroy();
+		}
+		vkDestroyQueryPool(device, split.queryPool, nullptr);
 
 		textureComputeTarget.destroy();
 	}
@@ -149,19 +316,18 @@ public:
 		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		// Image will be sampled in the fragment shader and used as storage target in the compute shader
-		imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+		// Image will be sampled in the fragment shader and used as storage target in the compute shader (or copy target for the CPU traced image)
+		imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 		imageCreateInfo.flags = 0;
 
-		VkMemoryAllocateInfo memAllocInfo = vks::initializers::memoryAllocateInfo();
 		VkMemoryRequirements memReqs;
 
 		VK_CHECK_RESULT(vkCreateImage(device, &imageCreateInfo, nullptr, &tex->image));
 		vkGetImageMemoryRequirements(device, tex->image, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-		VK_CHECK_RESULT(vkAllocateMemory(device, &memAllocInfo, nullptr, &tex->deviceMemory));
-		VK_CHECK_RESULT(vkBindImageMemory(device, tex->image, tex->deviceMemory, 0));
+		// Large targets get memory of their own, smaller ones share a block with other images
+		VK_CHECK_RESULT(vulkanDevice->memoryAllocator.allocate(memReqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, &tex->allocation));
+		tex->deviceMemory = tex->allocation.memory;
+		VK_CHECK_RESULT(vkBindImageMemory(device, tex->image, tex->deviceMemory, tex->allocation.offset));
 
 		VkCommandBuffer layoutCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
@@ -207,9 +373,128 @@ public:
 		tex->device = vulkanDevice;
 	}
 
+	// Prepare the visibility buffer the primary hits are rasterized to in hybrid mode
+	// The attachments are always created, as the compute shader's descriptors need to be valid even if the mode is disabled
+	void prepareVisibilityFramebuffer()
+	{
+		visibility.framebuffer = new vks::Framebuffer(vulkanDevice);
+		visibility.framebuffer->width = options.resolution;
+		visibility.framebuffer->height = options.resolution;
+
+		vks::AttachmentCreateInfo attachmentInfo = {};
+		attachmentInfo.width = options.resolution;
+		attachmentInfo.height = options.resolution;
+		attachmentInfo.layerCount = 1;
+		attachmentInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		// Attachment 0: Index of the visible triangle plus one, zero for background
+		attachmentInfo.format = VK_FORMAT_R32_UINT;
+		visibility.framebuffer->addAttachment(attachmentInfo);
+		// Attachment 1: Barycentrics of the visible point (weights of the second and third vertex)
+		attachmentInfo.format = VK_FORMAT_R32G32_SFLOAT;
+		visibility.framebuffer->addAttachment(attachmentInfo);
+		// Attachment 2: Depth
+		attachmentInfo.format = depthFormat;
+		attachmentInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		visibility.framebuffer->addAttachment(attachmentInfo);
+
+		// Integer attachments can't be filtered, the compute shader fetches texels directly
+		VK_CHECK_RESULT(visibility.framebuffer->createSampler(VK_FILTER_NEAREST, VK_FILTER_NEAREST, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE));
+		VK_CHECK_RESULT(visibility.framebuffer->createRenderPass());
+
+		// The compute shader's descriptors expect the layout the render pass leaves the attachments in, even before the first visibility pass
+		VkCommandBuffer layoutCmd = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		for (uint32_t i = 0; i < 2; i++) {
+			vks::tools::setImageLayout(
+				layoutCmd,
+				visibility.framebuffer->attachments[i].image,
+				VK_IMAGE_ASPECT_COLOR_BIT,
+				VK_IMAGE_LAYOUT_UNDEFINED,
+				VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		}
+		vulkanDevice->flushCommandBuffer(layoutCmd, queue, true);
+	}
+
+	// Storage buffer for the primary hit cache, sized for the ray traced image
+	void prepareHitCacheBuffer()
+	{
+		// Matches the std430 layout of PrimaryHit { uint triangle; float t; vec2 barycentrics; }
+		const VkDeviceSize hitSize = 16;
+		vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			&hitCache.buffer,
+			hitSize * options.resolution * options.resolution);
+		hitCache.valid = false;
+	}
+
+	// Point the compute shader's visibility buffer bindings to the current attachments
+	void updateVisibilityDescriptors()
+	{
+		VkDescriptorImageInfo triangleDescriptor = vks::initializers::descriptorImageInfo(visibility.framebuffer->sampler, visibility.framebuffer->attachments[0].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		VkDescriptorImageInfo barycentricsDescriptor = vks::initializers::descriptorImageInfo(visibility.framebuffer->sampler, visibility.framebuffer->attachments[1].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			// Binding 5: Visible triangles
+			vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 5, &triangleDescriptor),
+			// Binding 6: Barycentrics of the visible points
+			vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 6, &barycentricsDescriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+	}
+
+	// Records the display of the ray traced image into secondary command buffers, executed by the primary command buffers recorded every frame
+	// None of the swap chain images may be in use
 	void buildCommandBuffers()
 	{
+		VKS_CPU_SCOPE("Record command buffers");
+		if (graphics.sceneCommandBuffers.size() != drawCmdBuffers.size()) {
+			// The number of swap chain images may have changed with a recreated swap chain
+			if (!graphics.sceneCommandBuffers.empty()) {
+				vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(graphics.sceneCommandBuffers.size()), graphics.sceneCommandBuffers.data());
+			}
+			graphics.sceneCommandBuffers.resize(drawCmdBuffers.size());
+			VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, static_cast<uint32_t>(graphics.sceneCommandBuffers.size()));
+			VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, graphics.sceneCommandBuffers.data()));
+		}
+
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		cmdBufInfo.pInheritanceInfo = &inheritanceInfo;
+
+		for (int32_t i = 0; i < graphics.sceneCommandBuffers.size(); ++i)
+		{
+			inheritanceInfo.framebuffer = frameBuffers[i];
+			VK_CHECK_RESULT(vkBeginCommandBuffer(graphics.sceneCommandBuffers[i], &cmdBufInfo));
+
+			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
+			vkCmdSetViewport(graphics.sceneCommandBuffers[i], 0, 1, &viewport);
+
+			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
+			vkCmdSetScissor(graphics.sceneCommandBuffers[i], 0, 1, &scissor);
+
+			// Display ray traced image generated by compute shader as a full screen quad
+			// Quad vertices are generated in the vertex shader
+			// Skipped until the pipeline has been created, the command buffers are rebuilt once it's ready
+			if (pipelineBuildQueue.ready(graphics.pipelineJob)) {
+				vkCmdBindDescriptorSets(graphics.sceneCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
+				vkCmdBindPipeline(graphics.sceneCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
+				vkCmdDraw(graphics.sceneCommandBuffers[i], 3, 1, 0, 0);
+			}
+
+			VK_CHECK_RESULT(vkEndCommandBuffer(graphics.sceneCommandBuffers[i]));
+		}
+	}
+
+	// Records the current swap chain image's primary command buffer, it only executes the scene and UI secondary command buffers
+	// Recorded every frame, as re-recording the UI's secondary command buffer invalidates the primary command buffers it has been executed in
+	void recordGraphicsCommandBuffer()
+	{
+		VkCommandBuffer commandBuffer = drawCmdBuffers[currentBuffer];
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
 		VkClearValue clearValues[2];
 		clearValues[0].color = defaultClearColor;
@@ -217,6 +502,7 @@ public:
 
 		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
 		renderPassBeginInfo.renderPass = renderPass;
+		renderPassBeginInfo.framebuffer = frameBuffers[currentBuffer];
 		renderPassBeginInfo.renderArea.offset.x = 0;
 		renderPassBeginInfo.renderArea.offset.y = 0;
 		renderPassBeginInfo.renderArea.extent.width = width;
@@ -224,66 +510,186 @@ public:
 		renderPassBeginInfo.clearValueCount = 2;
 		renderPassBeginInfo.pClearValues = clearValues;
 
-		for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-		{
-			// Set target frame buffer
-			renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-			VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
-
-			// Image memory barrier to make sure that compute shader writes are finished before sampling from the texture
-			VkImageMemoryBarrier imageMemoryBarrier = {};
-			imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-			imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-			imageMemoryBarrier.image = textureComputeTarget.image;
-			imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-			imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-			imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-			vkCmdPipelineBarrier(
-				drawCmdBuffers[i],
-				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-				VK_FLAGS_NONE,
-				0, nullptr,
-				0, nullptr,
-				1, &imageMemoryBarrier);
-
-			vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-			VkViewport viewport = vks::initializers::viewport((float)width, (float)height, 0.0f, 1.0f);
-			vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
-
-			VkRect2D scissor = vks::initializers::rect2D(width, height, 0, 0);
-			vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
-
-			// Display ray traced image generated by compute shader as a full screen quad
-			// Quad vertices are generated in the vertex shader
-			vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipelineLayout, 0, 1, &graphics.descriptorSet, 0, NULL);
-			vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphics.pipeline);
-			vkCmdDraw(drawCmdBuffers[i], 3, 1, 0, 0);
+		VK_CHECK_RESULT(vkBeginCommandBuffer(commandBuffer, &cmdBufInfo));
+		gpuProfiler.beginCommandBuffer(commandBuffer, vulkanDevice->queueFamilyIndices.graphics);
+
+		// Image memory barrier to make sure that compute shader writes (or the copy of the CPU traced image) are finished before sampling from the texture
+		VkImageMemoryBarrier imageMemoryBarrier = {};
+		imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageMemoryBarrier.image = textureComputeTarget.image;
+		imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+		imageMemoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		imageMemoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_FLAGS_NONE,
+			0, nullptr,
+			0, nullptr,
+			1, &imageMemoryBarrier);
+
+		// Only vkCmdExecuteCommands may be recorded inside the render pass, so the debug marker region encloses it (including the UI)
+		vks::debugmarker::beginRegion(commandBuffer, "Fullscreen pass", glm::vec4(0.0f, 0.5f, 1.0f, 1.0f));
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(commandBuffer, 1, &graphics.sceneCommandBuffers[currentBuffer]);
+		executeUI(commandBuffer);
+		vkCmdEndRenderPass(commandBuffer);
+		vks::debugmarker::endRegion(commandBuffer);
+
+		VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer));
+	}
 
-			drawUI(drawCmdBuffers[i]);
+	void buildComputeCommandBuffers()
+	{
+		VKS_CPU_SCOPE("Record compute command buffers");
+		for (uint32_t i = 0; i < compute.commandBuffers.size(); i++)
+		{
+			recordComputeCommandBuffer(i);
+		}
+	}
 
-			vkCmdEndRenderPass(drawCmdBuffers[i]);
+	void recordComputeCommandBuffer(uint32_t i)
+	{
+		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
+		VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffers[i], &cmdBufInfo));
+		gpuProfiler.beginCommandBuffer(compute.commandBuffers[i], vulkanDevice->queueFamilyIndices.compute);
+
+		// Rows traced by the compute shader, the rows below are traced on the CPU
+		uint32_t gpuRows = textureComputeTarget.height;
+		if (options.backend == BACKEND_CPU) {
+			gpuRows = 0;
+		} else if (options.backend == BACKEND_SPLIT) {
+			gpuRows = std::min(split.gpuRows, textureComputeTarget.height);
+		}
+		bool timed = (options.backend == BACKEND_SPLIT) && (split.queryPool != VK_NULL_HANDLE);
+
+		// Skipped until the pipeline has been created, the command buffers are rebuilt once it's ready
+		compute.dispatchRecorded[i] = (gpuRows > 0) && pipelineBuildQueue.ready(compute.pipelineJob);
+		if (compute.dispatchRecorded[i]) {
+			// Each frame in flight reads the uniform data from and writes the ray counters to its own slot
+			uint32_t dynamicOffsets[2] = { static_cast<uint32_t>(i * compute.uniformSlotSize), static_cast<uint32_t>(i * counters.slotSize) };
+			vkCmdBindPipeline(compute.commandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
+			vkCmdBindDescriptorSets(compute.commandBuffers[i], VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 2, dynamicOffsets);
+
+			if (timed) {
+				vkCmdResetQueryPool(compute.commandBuffers[i], split.queryPool, i * 2, 2);
+				vkCmdWriteTimestamp(compute.commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, split.queryPool, i * 2);
+			}
+			vks::debugmarker::beginRegion(compute.commandBuffers[i], "Ray tracing dispatch", glm::vec4(1.0f, 0.5f, 0.0f, 1.0f));
+			vkCmdDispatch(compute.commandBuffers[i], (textureComputeTarget.width + options.workgroupSize - 1) / options.workgroupSize, (gpuRows + options.workgroupSize - 1) / options.workgroupSize, 1);
+			vks::debugmarker::endRegion(compute.commandBuffers[i]);
+			if (timed) {
+				vkCmdWriteTimestamp(compute.commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, split.queryPool, i * 2 + 1);
+			}
+
+			// Make the counters visible to the host once the frame's fence has been signaled
+			// Always recorded, as the heatmap histogram is enabled via the uniform buffer without rebuilding the command buffers
+			VkBufferMemoryBarrier bufferBarrier = vks::initializers::bufferMemoryBarrier();
+			bufferBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			bufferBarrier.buffer = counters.buffer.buffer;
+			bufferBarrier.offset = i * counters.slotSize;
+			bufferBarrier.size = sizeof(RayCounters);
+			vkCmdPipelineBarrier(compute.commandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_FLAGS_NONE, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+		}
 
-			VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
+		if (gpuRows < textureComputeTarget.height) {
+			// In CPU mode the image has been traced into the frame's staging slot before submission, the GPU only copies it
+			// In split mode the CPU traces its rows while the dispatch is running, so the copy goes into a separate command buffer that is submitted once they're done
+			// (a device side wait for the host would stall the compute queue for a whole CPU frame)
+			VkCommandBuffer copyCommandBuffer = compute.commandBuffers[i];
+			if (options.backend == BACKEND_SPLIT) {
+				copyCommandBuffer = split.copyCommandBuffers[i];
+				VK_CHECK_RESULT(vkBeginCommandBuffer(copyCommandBuffer, &cmdBufInfo));
+				gpuProfiler.beginCommandBuffer(copyCommandBuffer, vulkanDevice->queueFamilyIndices.compute);
+			}
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.bufferOffset = i * cpu.slotSize + (VkDeviceSize)gpuRows * textureComputeTarget.width * 4;
+			copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			copyRegion.imageOffset = { 0, static_cast<int32_t>(gpuRows), 0 };
+			copyRegion.imageExtent = { textureComputeTarget.width, textureComputeTarget.height - gpuRows, 1 };
+			vks::debugmarker::beginRegion(copyCommandBuffer, "CPU ray traced image upload", glm::vec4(1.0f, 0.5f, 0.0f, 1.0f));
+			vkCmdCopyBufferToImage(copyCommandBuffer, cpu.stagingBuffer.buffer, textureComputeTarget.image, VK_IMAGE_LAYOUT_GENERAL, 1, &copyRegion);
+			vks::debugmarker::endRegion(copyCommandBuffer);
+			if (copyCommandBuffer != compute.commandBuffers[i]) {
+				vkEndCommandBuffer(copyCommandBuffer);
+			}
 		}
 
+		vkEndCommandBuffer(compute.commandBuffers[i]);
 	}
 
-	void buildComputeCommandBuffer()
+	// Rebuilds the command buffers of all frames in flight, so none of them may be in use
+	void buildVisibilityCommandBuffers()
 	{
+		VKS_CPU_SCOPE("Record visibility command buffers");
 		VkCommandBufferBeginInfo cmdBufInfo = vks::initializers::commandBufferBeginInfo();
 
-		VK_CHECK_RESULT(vkBeginCommandBuffer(compute.commandBuffer, &cmdBufInfo));
+		VkClearValue clearValues[3];
+		clearValues[0].color.uint32[0] = 0;
+		clearValues[1].color = { { 0.0f, 0.0f, 0.0f, 0.0f } };
+		clearValues[2].depthStencil = { 1.0f, 0 };
 
-		vkCmdBindPipeline(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipeline);
-		vkCmdBindDescriptorSets(compute.commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compute.pipelineLayout, 0, 1, &compute.descriptorSet, 0, 0);
+		VkRenderPassBeginInfo renderPassBeginInfo = vks::initializers::renderPassBeginInfo();
+		renderPassBeginInfo.renderPass = visibility.framebuffer->renderPass;
+		renderPassBeginInfo.framebuffer = visibility.framebuffer->framebuffer;
+		renderPassBeginInfo.renderArea.extent.width = visibility.framebuffer->width;
+		renderPassBeginInfo.renderArea.extent.height = visibility.framebuffer->height;
+		renderPassBeginInfo.clearValueCount = 3;
+		renderPassBeginInfo.pClearValues = clearValues;
 
-		vkCmdDispatch(compute.commandBuffer, textureComputeTarget.width / 16, textureComputeTarget.height / 16, 1);
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = visibility.framebuffer->renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = visibility.framebuffer->framebuffer;
 
-		vkEndCommandBuffer(compute.commandBuffer);
+		float resolution = (float)visibility.framebuffer->width;
+		uint32_t triangleCount = static_cast<uint32_t>(bvh.indices.size());
+		// Triangles are stored in BVH leaf order, so each batch covers a spatially coherent part of the scene
+		uint32_t batchCount = (triangleCount + visibility.batchSize - 1) / visibility.batchSize;
+
+		for (uint32_t i = 0; i < visibility.commandBuffers.size(); i++)
+		{
+			VK_CHECK_RESULT(vkBeginCommandBuffer(visibility.commandBuffers[i], &cmdBufInfo));
+			gpuProfiler.beginCommandBuffer(visibility.commandBuffers[i], vulkanDevice->queueFamilyIndices.graphics);
+
+			// Skipped until the pipeline has been created, the hybrid mode isn't used before that (see draw)
+			if (pipelineBuildQueue.ready(visibility.pipelineJob)) {
+				// The previous batches of this frame in flight are no longer referenced once its primary command buffer is recorded again
+				visibility.recorder.reset(i);
+				// Reads the camera from the same uniform slot as the frame's compute dispatch
+				uint32_t dynamicOffset = static_cast<uint32_t>(i * compute.uniformSlotSize);
+				visibility.recorder.record(taskScheduler, i, inheritanceInfo, batchCount, [&](VkCommandBuffer commandBuffer, uint32_t batch) {
+					// Dynamic state is not inherited from the primary command buffer
+					VkViewport viewport = vks::initializers::viewport((float)visibility.framebuffer->width, (float)visibility.framebuffer->height, 0.0f, 1.0f);
+					vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+					VkRect2D scissor = vks::initializers::rect2D(visibility.framebuffer->width, visibility.framebuffer->height, 0, 0);
+					vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+					vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibility.pipeline);
+					vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, visibility.pipelineLayout, 0, 1, &visibility.descriptorSet, 1, &dynamicOffset);
+					vkCmdPushConstants(commandBuffer, visibility.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(float), &resolution);
+					// Vertices are fetched from the triangle storage buffer in the vertex shader
+					uint32_t firstTriangle = batch * visibility.batchSize;
+					uint32_t batchTriangles = std::min(visibility.batchSize, triangleCount - firstTriangle);
+					vkCmdDraw(commandBuffer, batchTriangles * 3, 1, firstTriangle * 3, 0);
+				}, visibility.batchCommandBuffers);
+
+				// Only vkCmdExecuteCommands may be recorded inside the render pass, so the debug marker region encloses it
+				vks::debugmarker::beginRegion(visibility.commandBuffers[i], "Visibility pass", glm::vec4(0.0f, 1.0f, 0.5f, 1.0f));
+				vkCmdBeginRenderPass(visibility.commandBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+				if (batchCount > 0) {
+					vkCmdExecuteCommands(visibility.commandBuffers[i], batchCount, visibility.batchCommandBuffers.data());
+				}
+				vkCmdEndRenderPass(visibility.commandBuffers[i]);
+				vks::debugmarker::endRegion(visibility.commandBuffers[i]);
+			}
+
+			VK_CHECK_RESULT(vkEndCommandBuffer(visibility.commandBuffers[i]));
+		}
 	}
 
 	uint32_t currentId = 0;	// Id used to identify objects by the ray tracing shader
@@ -317,50 +723,167 @@ public:
 		
 		std::vector<Triangle> tris;
 		//tris.push_back(newTriangles(glm::vec4(1.75f, -0.5f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, -0.5f, 0.0f), glm::vec4(-1.75f, -0.75f, -0.5f, 0.0f), 1.0f, glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), 32.0f));
-		tris.push_back(newTriangles(glm::vec4(0.0,0.0, 0.0f, 0.0f), glm::vec4(1.0f, 0.0, 0.0, 0.0f), glm::vec4(1.0,1.0,0.0, 0.0f), 1.0f, glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), 32.0f));
-		VkDeviceSize storageBufferSize = tris.size() * sizeof(Triangle);
+		currentId = 0;
+		if (options.triangleCount <= 1) {
+			tris.push_back(newTriangles(glm::vec4(0.0,0.0, 0.0f, 0.0f), glm::vec4(1.0f, 0.0, 0.0, 0.0f), glm::vec4(1.0,1.0,0.0, 0.0f), 1.0f, glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), 32.0f));
+		} else {
+			// Larger scenes are made of a grid of small triangles covering the same area, with slightly varying depth
+			uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt((float)options.triangleCount)));
+			float cellSize = 2.0f / (float)gridSize;
+			for (uint32_t i = 0; i < options.triangleCount; i++) {
+				float x = -1.0f + (float)(i % gridSize) * cellSize;
+				float y = -1.0f + (float)(i / gridSize) * cellSize;
+				float z = -0.25f * (float)(i % 7) / 7.0f;
+				tris.push_back(newTriangles(glm::vec4(x, y, z, 0.0f), glm::vec4(x + cellSize * 0.9f, y, z, 0.0f), glm::vec4(x, y + cellSize * 0.9f, z, 0.0f), 1.0f, glm::vec4(0.0f, 1.0f, 0.0f, 0.0f), 32.0f));
+			}
+		}
+
+		// The shader traverses a bounding volume hierarchy instead of testing every triangle
+		std::vector<glm::vec3> vertices;
+		vertices.reserve(tris.size() * 3);
+		for (auto &tri : tris) {
+			vertices.push_back(glm::vec3(tri.v1));
+			vertices.push_back(glm::vec3(tri.v2));
+			vertices.push_back(glm::vec3(tri.v3));
+		}
+		bvh.build(vertices, &taskScheduler);
+		bvh.reorder(tris);
 
-		// Stage
-		vks::Buffer stagingBuffer;
+		createDeviceLocalStorageBuffer(&compute.storageBuffers.triangles, tris.data(), tris.size() * sizeof(Triangle));
+		createDeviceLocalStorageBuffer(&compute.storageBuffers.bvhNodes, bvh.nodes.data(), bvh.nodes.size() * sizeof(vks::BVH::Node));
+		// Both buffers are uploaded with a single submission, which is waited on as the compute queue has no semaphore dependency on the upload
+		uploadManager.wait(uploadManager.flush());
 
-		vulkanDevice->createBuffer(
-		    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		    &stagingBuffer,
-		    storageBufferSize,
-		    tris.data());
+		cpuRayTracer.setScene(tris, bvh);
+	}
+
+	// Timestamp queries for split frame rendering, one set per frame in flight
+	void prepareSplitFrame()
+	{
+		split.slotTimings.assign(settings.maxFramesInFlight, { 0, 0.0 });
+		// Without timestamps on the compute queue the split can't be balanced and stays at its initial share
+		if ((vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.compute].timestampValidBits == 0) || (deviceProperties.limits.timestampPeriod == 0.0f)) {
+			std::cerr << "Compute queue doesn't support timestamps, the split between GPU and CPU rows is not balanced" << std::endl;
+			return;
+		}
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = settings.maxFramesInFlight * 2;
+		VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolInfo, nullptr, &split.queryPool));
+	}
+
+	// Create the host visible buffer the CPU ray tracer writes to, with one RGBA8 image per frame in flight
+	void prepareCpuStagingBuffer()
+	{
+		if (cpu.slotSize > 0) {
+			cpu.stagingBuffer.unmap();
+			cpu.stagingBuffer.destroy();
+		}
+		cpu.slotSize = (VkDeviceSize)options.resolution * options.resolution * 4;
+		VK_CHECK_RESULT(vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&cpu.stagingBuffer,
+			cpu.slotSize * settings.maxFramesInFlight));
+		VK_CHECK_RESULT(cpu.stagingBuffer.map());
+	}
 
+	// Create a device local storage buffer and record the upload of its data, the upload has to be waited on before the buffer is used
+	void createDeviceLocalStorageBuffer(vks::Buffer *buffer, void *data, VkDeviceSize size)
+	{
 		vulkanDevice->createBuffer(
 		    // The SSBO will be used as a storage buffer for the compute pipeline and as a vertex buffer in the graphics pipeline
 		    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
 		    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		    &compute.storageBuffers.triangles,
-		    storageBufferSize);
+		    buffer,
+		    size);
+		uploadManager.uploadBuffer(buffer->buffer, data, size);
+	}
 
-		// Copy to staging buffer
-		VkCommandBuffer copyCmd    = vulkanDevice->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		VkBufferCopy    copyRegion = {};
-		copyRegion.size            = storageBufferSize;
-		vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, compute.storageBuffers.triangles.buffer, 1, &copyRegion);
-		vulkanDevice->flushCommandBuffer(copyCmd, queue, true);
+	// Host visible buffer the compute shader writes the ray counters to, one slot per frame in flight
+	void prepareCounterBuffer()
+	{
+		VkDeviceSize alignment = vulkanDevice->properties.limits.minStorageBufferOffsetAlignment;
+		counters.slotSize = sizeof(RayCounters);
+		if (alignment > 0) {
+			counters.slotSize = (counters.slotSize + alignment - 1) & ~(alignment - 1);
+		}
+		vulkanDevice->createBuffer(
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			&counters.buffer,
+			counters.slotSize * settings.maxFramesInFlight);
+		// The descriptor covers a single slot, the slot is selected with a dynamic offset
+		counters.buffer.setupDescriptor(sizeof(RayCounters));
+		VK_CHECK_RESULT(counters.buffer.map());
+		memset(counters.buffer.mapped, 0, counters.slotSize * settings.maxFramesInFlight);
+		counters.slotWritten.assign(settings.maxFramesInFlight, false);
+	}
 
-		stagingBuffer.destroy();
+	// Read the counters of the frame that last used the current frame's slot and clear them for the next frame
+	// Must be called after the frame's fence has been waited on
+	void readRayCounters()
+	{
+		auto tNow = std::chrono::high_resolution_clock::now();
+		double frameTime = std::chrono::duration<double>(tNow - counters.lastReadback).count();
+		counters.lastReadback = tNow;
+		counters.frameTime = frameTime;
+		if (!counters.slotWritten[currentFrame]) {
+			return;
+		}
+		RayCounters *slot = (RayCounters*)((char*)counters.buffer.mapped + currentFrame * counters.slotSize);
+		counters.last = *slot;
+		memset(slot, 0, sizeof(RayCounters));
+		counters.slotWritten[currentFrame] = false;
+		// Frames are pipelined, so the time between two readbacks is the time per frame
+		counters.raysPerSecond = (frameTime > 0.0) ? (double)counters.last.rays / frameTime : 0.0;
+		if (counters.last.rays > 0) {
+			benchmark.addMetric("Mrays/s", counters.raysPerSecond / 1.0e6);
+			benchmark.addMetric("nodes visited/ray", (double)counters.last.nodesVisited / (double)counters.last.rays);
+			benchmark.addMetric("triangle tests/ray", (double)counters.last.triangleTests / (double)counters.last.rays);
+		}
+		if (compute.ubo.heatmap != HEATMAP_OFF) {
+			benchmark.addMetric("heatmap cost p50", getHistogramPercentile(50.0f));
+			benchmark.addMetric("heatmap cost p95", getHistogramPercentile(95.0f));
+			benchmark.addMetric("heatmap cost p99", getHistogramPercentile(99.0f));
+		}
+	}
 
+	// Traversal cost below which the given percentage (0..100) of the pixels lie, based on the last histogram (resolution is one bin)
+	float getHistogramPercentile(float percentage)
+	{
+		uint32_t pixels = 0;
+		for (uint32_t i = 0; i < HISTOGRAM_BINS; i++) {
+			pixels += counters.last.histogram[i];
+		}
+		uint32_t sum = 0;
+		for (uint32_t i = 0; i < HISTOGRAM_BINS; i++) {
+			sum += counters.last.histogram[i];
+			if ((float)sum >= percentage / 100.0f * (float)pixels) {
+				// Upper end of the bin's cost range
+				return (float)(i + 1) * compute.ubo.heatmapMax / (float)HISTOGRAM_BINS;
+			}
+		}
+		return compute.ubo.heatmapMax;
 	}
+
 	// Setup and fill the compute shader storage buffers containing primitives for the raytraced scene
 	void prepareStorageBuffers()
 	{
 		prepareTriangleStorageBuffer();
+		prepareCounterBuffer();
 	}
 
 	void setupDescriptorPool()
 	{
 		std::vector<VkDescriptorPoolSize> poolSizes =
 		{
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2),			// Compute UBO
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4),	// Graphics image samplers
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2),	// Compute UBO (one slot per frame in flight), also read by the visibility pass
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4),	// Graphics image samplers and the visibility buffer
 			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1),				// Storage image for ray traced image output
-			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2),			// Storage buffer for the scene primitives
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4),			// Storage buffers for the scene primitives (compute and visibility pass), the BVH nodes and the primary hit cache
+			vks::initializers::descriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1),	// Ray counters (one slot per frame in flight)
 		};
 
 		VkDescriptorPoolCreateInfo descriptorPoolInfo =
@@ -423,85 +946,196 @@ public:
 
 	void preparePipelines()
 	{
-		VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
-			vks::initializers::pipelineInputAssemblyStateCreateInfo(
-				VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-				0,
-				VK_FALSE);
-
-		VkPipelineRasterizationStateCreateInfo rasterizationState =
-			vks::initializers::pipelineRasterizationStateCreateInfo(
-				VK_POLYGON_MODE_FILL,
-				VK_CULL_MODE_FRONT_BIT,
-				VK_FRONT_FACE_COUNTER_CLOCKWISE,
-				0);
-
-		VkPipelineColorBlendAttachmentState blendAttachmentState =
-			vks::initializers::pipelineColorBlendAttachmentState(
-				0xf,
-				VK_FALSE);
-
-		VkPipelineColorBlendStateCreateInfo colorBlendState =
-			vks::initializers::pipelineColorBlendStateCreateInfo(
-				1,
-				&blendAttachmentState);
-
-		VkPipelineDepthStencilStateCreateInfo depthStencilState =
-			vks::initializers::pipelineDepthStencilStateCreateInfo(
-				VK_FALSE,
-				VK_FALSE,
-				VK_COMPARE_OP_LESS_OR_EQUAL);
-
-		VkPipelineViewportStateCreateInfo viewportState =
-			vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
-
-		VkPipelineMultisampleStateCreateInfo multisampleState =
-			vks::initializers::pipelineMultisampleStateCreateInfo(
-				VK_SAMPLE_COUNT_1_BIT,
-				0);
-
-		std::vector<VkDynamicState> dynamicStateEnables = {
-			VK_DYNAMIC_STATE_VIEWPORT,
-			VK_DYNAMIC_STATE_SCISSOR
-		};
-		VkPipelineDynamicStateCreateInfo dynamicState =
-			vks::initializers::pipelineDynamicStateCreateInfo(
-				dynamicStateEnables.data(),
-				dynamicStateEnables.size(),
-				0);
-
-		// Display pipeline
+		// Shaders are loaded up front, as loading them isn't thread safe
 		std::array<VkPipelineShaderStageCreateInfo,2> shaderStages;
-
 		shaderStages[0] = loadShader(getShadersPath() + "computeraytracing/texture.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
 		shaderStages[1] = loadShader(getShadersPath() + "computeraytracing/texture.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
 
-		VkGraphicsPipelineCreateInfo pipelineCreateInfo =
-			vks::initializers::pipelineCreateInfo(
-				graphics.pipelineLayout,
-				renderPass,
-				0);
+		// The pipeline is created on a worker thread, all state is set up inside the job
+		graphics.pipelineJob = pipelineBuildQueue.add([this, shaderStages] {
+			VkPipelineInputAssemblyStateCreateInfo inputAssemblyState =
+				vks::initializers::pipelineInputAssemblyStateCreateInfo(
+					VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+					0,
+					VK_FALSE);
+
+			VkPipelineRasterizationStateCreateInfo rasterizationState =
+				vks::initializers::pipelineRasterizationStateCreateInfo(
+					VK_POLYGON_MODE_FILL,
+					VK_CULL_MODE_FRONT_BIT,
+					VK_FRONT_FACE_COUNTER_CLOCKWISE,
+					0);
+
+			VkPipelineColorBlendAttachmentState blendAttachmentState =
+				vks::initializers::pipelineColorBlendAttachmentState(
+					0xf,
+					VK_FALSE);
+
+			VkPipelineColorBlendStateCreateInfo colorBlendState =
+				vks::initializers::pipelineColorBlendStateCreateInfo(
+					1,
+					&blendAttachmentState);
+
+			VkPipelineDepthStencilStateCreateInfo depthStencilState =
+				vks::initializers::pipelineDepthStencilStateCreateInfo(
+					VK_FALSE,
+					VK_FALSE,
+					VK_COMPARE_OP_LESS_OR_EQUAL);
+
+			VkPipelineViewportStateCreateInfo viewportState =
+				vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+
+			VkPipelineMultisampleStateCreateInfo multisampleState =
+				vks::initializers::pipelineMultisampleStateCreateInfo(
+					VK_SAMPLE_COUNT_1_BIT,
+					0);
+
+			std::vector<VkDynamicState> dynamicStateEnables = {
+				VK_DYNAMIC_STATE_VIEWPORT,
+				VK_DYNAMIC_STATE_SCISSOR
+			};
+			VkPipelineDynamicStateCreateInfo dynamicState =
+				vks::initializers::pipelineDynamicStateCreateInfo(
+					dynamicStateEnables.data(),
+					dynamicStateEnables.size(),
+					0);
+
+			// Display pipeline
+			VkGraphicsPipelineCreateInfo pipelineCreateInfo =
+				vks::initializers::pipelineCreateInfo(
+					graphics.pipelineLayout,
+					renderPass,
+					0);
+
+			VkPipelineVertexInputStateCreateInfo emptyInputState{};
+			emptyInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+			emptyInputState.vertexAttributeDescriptionCount = 0;
+			emptyInputState.pVertexAttributeDescriptions = nullptr;
+			emptyInputState.vertexBindingDescriptionCount = 0;
+			emptyInputState.pVertexBindingDescriptions = nullptr;
+			pipelineCreateInfo.pVertexInputState = &emptyInputState;
+
+			pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+			pipelineCreateInfo.pRasterizationState = &rasterizationState;
+			pipelineCreateInfo.pColorBlendState = &colorBlendState;
+			pipelineCreateInfo.pMultisampleState = &multisampleState;
+			pipelineCreateInfo.pViewportState = &viewportState;
+			pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+			pipelineCreateInfo.pDynamicState = &dynamicState;
+			pipelineCreateInfo.stageCount = shaderStages.size();
+			pipelineCreateInfo.pStages = shaderStages.data();
+			pipelineCreateInfo.renderPass = renderPass;
+
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
+		});
+	}
 
-		VkPipelineVertexInputStateCreateInfo emptyInputState{};
-		emptyInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-		emptyInputState.vertexAttributeDescriptionCount = 0;
-		emptyInputState.pVertexAttributeDescriptions = nullptr;
-		emptyInputState.vertexBindingDescriptionCount = 0;
-		emptyInputState.pVertexBindingDescriptions = nullptr;
-		pipelineCreateInfo.pVertexInputState = &emptyInputState;
+	void createComputePipeline(VkComputePipelineCreateInfo computePipelineCreateInfo)
+	{
+		// The work group size and the enabled features are passed as specialization constants
+		struct {
+			uint32_t workgroupSize[2];
+			VkBool32 rayCounters;
+		} specializationData = { { options.workgroupSize, options.workgroupSize }, static_cast<VkBool32>(options.rayCounters ? VK_TRUE : VK_FALSE) };
+		std::array<VkSpecializationMapEntry, 3> specializationMapEntries = {
+			vks::initializers::specializationMapEntry(0, 0, sizeof(uint32_t)),
+			vks::initializers::specializationMapEntry(1, sizeof(uint32_t), sizeof(uint32_t)),
+			vks::initializers::specializationMapEntry(2, offsetof(decltype(specializationData), rayCounters), sizeof(VkBool32)),
+		};
+		VkSpecializationInfo specializationInfo = vks::initializers::specializationInfo(static_cast<uint32_t>(specializationMapEntries.size()), specializationMapEntries.data(), sizeof(specializationData), &specializationData);
+		computePipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
+	}
 
-		pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
-		pipelineCreateInfo.pRasterizationState = &rasterizationState;
-		pipelineCreateInfo.pColorBlendState = &colorBlendState;
-		pipelineCreateInfo.pMultisampleState = &multisampleState;
-		pipelineCreateInfo.pViewportState = &viewportState;
-		pipelineCreateInfo.pDepthStencilState = &depthStencilState;
-		pipelineCreateInfo.pDynamicState = &dynamicState;
-		pipelineCreateInfo.stageCount = shaderStages.size();
-		pipelineCreateInfo.pStages = shaderStages.data();
-		pipelineCreateInfo.renderPass = renderPass;
+	// Recreate the compute pipeline after changing options that are passed as specialization constants
+	// The device must be idle, the pipeline is swapped in by pipelinesReady once it has been built
+	void recreateComputePipeline()
+	{
+		pipelineBuildQueue.wait();
+		vkDestroyPipeline(device, compute.pipeline, nullptr);
+		// Hits are stored again by the new pipeline once it has been swapped in
+		hitCache.valid = false;
+		VkComputePipelineCreateInfo computePipelineCreateInfo = vks::initializers::computePipelineCreateInfo(compute.pipelineLayout, 0);
+		// Served from the shader module cache
+		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computeraytracing/raytracing.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
+		compute.pipelineJob = pipelineBuildQueue.add([this, computePipelineCreateInfo] {
+			createComputePipeline(computePipelineCreateInfo);
+		});
+	}
 
-		VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &graphics.pipeline));
+	// Prepare the raster pass writing the visibility buffer for the hybrid mode
+	void prepareVisibility()
+	{
+		std::vector<VkDescriptorSetLayoutBinding> setLayoutBindings = {
+			// Binding 0: Uniform buffer block of the compute shader (camera), dynamic
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0),
+			// Binding 1: Scene triangles
+			vks::initializers::descriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 1),
+		};
+		VkDescriptorSetLayoutCreateInfo descriptorLayout = vks::initializers::descriptorSetLayoutCreateInfo(setLayoutBindings.data(), static_cast<uint32_t>(setLayoutBindings.size()));
+		VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &descriptorLayout, nullptr, &visibility.descriptorSetLayout));
+
+		// The size of the visibility buffer is passed as a push constant
+		VkPushConstantRange pushConstantRange = vks::initializers::pushConstantRange(VK_SHADER_STAGE_VERTEX_BIT, sizeof(float), 0);
+		VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = vks::initializers::pipelineLayoutCreateInfo(&visibility.descriptorSetLayout, 1);
+		pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+		pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+		VK_CHECK_RESULT(vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, nullptr, &visibility.pipelineLayout));
+
+		VkDescriptorSetAllocateInfo allocInfo = vks::initializers::descriptorSetAllocateInfo(descriptorPool, &visibility.descriptorSetLayout, 1);
+		VK_CHECK_RESULT(vkAllocateDescriptorSets(device, &allocInfo, &visibility.descriptorSet));
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			vks::initializers::writeDescriptorSet(visibility.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, &compute.uniformBuffer.descriptor),
+			vks::initializers::writeDescriptorSet(visibility.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.storageBuffers.triangles.descriptor),
+		};
+		vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+
+		std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
+		shaderStages[0] = loadShader(getShadersPath() + "computeraytracing/visibility.vert.spv", VK_SHADER_STAGE_VERTEX_BIT);
+		shaderStages[1] = loadShader(getShadersPath() + "computeraytracing/visibility.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT);
+
+		// Render passes recreated for a different resolution have the same attachment formats, so the pipeline stays compatible
+		VkRenderPass renderPass = visibility.framebuffer->renderPass;
+		visibility.pipelineJob = pipelineBuildQueue.add([this, shaderStages, renderPass] {
+			VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = vks::initializers::pipelineInputAssemblyStateCreateInfo(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, 0, VK_FALSE);
+			// Rays hit both sides of a triangle
+			VkPipelineRasterizationStateCreateInfo rasterizationState = vks::initializers::pipelineRasterizationStateCreateInfo(VK_POLYGON_MODE_FILL, VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE, 0);
+			std::array<VkPipelineColorBlendAttachmentState, 2> blendAttachmentStates = {
+				vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE),
+				vks::initializers::pipelineColorBlendAttachmentState(0xf, VK_FALSE),
+			};
+			VkPipelineColorBlendStateCreateInfo colorBlendState = vks::initializers::pipelineColorBlendStateCreateInfo(static_cast<uint32_t>(blendAttachmentStates.size()), blendAttachmentStates.data());
+			VkPipelineDepthStencilStateCreateInfo depthStencilState = vks::initializers::pipelineDepthStencilStateCreateInfo(VK_TRUE, VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+			VkPipelineViewportStateCreateInfo viewportState = vks::initializers::pipelineViewportStateCreateInfo(1, 1, 0);
+			VkPipelineMultisampleStateCreateInfo multisampleState = vks::initializers::pipelineMultisampleStateCreateInfo(VK_SAMPLE_COUNT_1_BIT, 0);
+			std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+			VkPipelineDynamicStateCreateInfo dynamicState = vks::initializers::pipelineDynamicStateCreateInfo(dynamicStateEnables.data(), static_cast<uint32_t>(dynamicStateEnables.size()), 0);
+			VkPipelineVertexInputStateCreateInfo emptyInputState = vks::initializers::pipelineVertexInputStateCreateInfo();
+
+			VkGraphicsPipelineCreateInfo pipelineCreateInfo = vks::initializers::pipelineCreateInfo(visibility.pipelineLayout, renderPass, 0);
+			pipelineCreateInfo.pVertexInputState = &emptyInputState;
+			pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+			pipelineCreateInfo.pRasterizationState = &rasterizationState;
+			pipelineCreateInfo.pColorBlendState = &colorBlendState;
+			pipelineCreateInfo.pMultisampleState = &multisampleState;
+			pipelineCreateInfo.pViewportState = &viewportState;
+			pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+			pipelineCreateInfo.pDynamicState = &dynamicState;
+			pipelineCreateInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+			pipelineCreateInfo.pStages = shaderStages.data();
+			VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineCreateInfo, nullptr, &visibility.pipeline));
+		});
+
+		// Submitted to the graphics queue before the compute dispatch
+		visibility.commandBuffers.resize(settings.maxFramesInFlight);
+		VkCommandBufferAllocateInfo cmdBufAllocateInfo = vks::initializers::commandBufferAllocateInfo(cmdPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, static_cast<uint32_t>(visibility.commandBuffers.size()));
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, visibility.commandBuffers.data()));
+		visibility.recorder.prepare(device, vulkanDevice->queueFamilyIndices.graphics, settings.maxFramesInFlight, taskScheduler.getThreadCount());
+
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &visibility.complete));
+
+		buildVisibilityCommandBuffers();
 	}
 
 	// Prepare the compute pipeline that generates the ray traced image
@@ -524,16 +1158,41 @@ public:
 				VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
 				VK_SHADER_STAGE_COMPUTE_BIT,
 				0),
-			// Binding 1: Uniform buffer block
+			// Binding 1: Uniform buffer block (dynamic, offset selects the slot of the current frame in flight)
 			vks::initializers::descriptorSetLayoutBinding(
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 				VK_SHADER_STAGE_COMPUTE_BIT,
 				1),
 			// binding : Shader storage for the triangles
 		    vks::initializers::descriptorSetLayoutBinding(
 		        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 		        VK_SHADER_STAGE_COMPUTE_BIT,
-		        2)
+		        2),
+			// Binding 3: Shader storage for the BVH nodes
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				3),
+			// Binding 4: Ray counters (dynamic, offset selects the slot of the current frame in flight)
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				4),
+			// Binding 5: Visible triangles of the hybrid mode
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				5),
+			// Binding 6: Barycentrics of the visible points of the hybrid mode
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				6),
+			// Binding 7: Primary hit cache
+			vks::initializers::descriptorSetLayoutBinding(
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				VK_SHADER_STAGE_COMPUTE_BIT,
+				7)
 
 		};
 
@@ -570,7 +1229,7 @@ public:
 			// Binding 1: Uniform buffer block
 			vks::initializers::writeDescriptorSet(
 				compute.descriptorSet,
-				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 				1,
 				&compute.uniformBuffer.descriptor),
 			// Binding 2: Shader storage buffer for the triangles
@@ -578,10 +1237,29 @@ public:
 				compute.descriptorSet,
 				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
 				2,
-				&compute.storageBuffers.triangles.descriptor)
+				&compute.storageBuffers.triangles.descriptor),
+			// Binding 3: Shader storage buffer for the BVH nodes
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				3,
+				&compute.storageBuffers.bvhNodes.descriptor),
+			// Binding 4: Ray counters
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+				4,
+				&counters.buffer.descriptor),
+			// Binding 7: Primary hit cache
+			vks::initializers::writeDescriptorSet(
+				compute.descriptorSet,
+				VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+				7,
+				&hitCache.buffer.descriptor)
 		};
 
 		vkUpdateDescriptorSets(device, computeWriteDescriptorSets.size(), computeWriteDescriptorSets.data(), 0, NULL);
+		updateVisibilityDescriptors();
 
 		// Create compute shader pipelines
 		VkComputePipelineCreateInfo computePipelineCreateInfo =
@@ -590,7 +1268,10 @@ public:
 				0);
 
 		computePipelineCreateInfo.stage = loadShader(getShadersPath() + "computeraytracing/raytracing.comp.spv", VK_SHADER_STAGE_COMPUTE_BIT);
-		VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache, 1, &computePipelineCreateInfo, nullptr, &compute.pipeline));
+		// Compiled on a worker thread, concurrently with the display pipeline
+		compute.pipelineJob = pipelineBuildQueue.add([this, computePipelineCreateInfo] {
+			createComputePipeline(computePipelineCreateInfo);
+		});
 
 		// Separate command pool as queue family for compute may be different than graphics
 		VkCommandPoolCreateInfo cmdPoolInfo = {};
@@ -599,81 +1280,346 @@ public:
 		cmdPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 		VK_CHECK_RESULT(vkCreateCommandPool(device, &cmdPoolInfo, nullptr, &compute.commandPool));
 
-		// Create a command buffer for compute operations
+		// Create one command buffer for compute operations per frame in flight
+		compute.commandBuffers.resize(settings.maxFramesInFlight);
+		compute.dispatchRecorded.resize(settings.maxFramesInFlight, false);
 		VkCommandBufferAllocateInfo cmdBufAllocateInfo =
 			vks::initializers::commandBufferAllocateInfo(
 				compute.commandPool,
 				VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-				1);
+				static_cast<uint32_t>(compute.commandBuffers.size()));
 
-		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, &compute.commandBuffer));
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, compute.commandBuffers.data()));
 
-		// Fence for compute CB sync
-		VkFenceCreateInfo fenceCreateInfo = vks::initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &compute.fence));
+		// Split frames copy the CPU rows with a separate command buffer per frame in flight, submitted once the CPU has traced them
+		split.copyCommandBuffers.resize(settings.maxFramesInFlight);
+		VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, split.copyCommandBuffers.data()));
 
-		// Build a single command buffer containing the compute dispatch commands
-		buildComputeCommandBuffer();
+		// Semaphores for graphics and compute queue sync
+		VkSemaphoreCreateInfo semaphoreCreateInfo = vks::initializers::semaphoreCreateInfo();
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &compute.semaphores.ready));
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &compute.semaphores.complete));
+
+		// Signal the ready semaphore once, so the first compute submission doesn't wait for a graphics submission that never happened
+		VkSubmitInfo signalSubmitInfo = vks::initializers::submitInfo();
+		signalSubmitInfo.signalSemaphoreCount = 1;
+		signalSubmitInfo.pSignalSemaphores = &compute.semaphores.ready;
+		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &signalSubmitInfo, VK_NULL_HANDLE));
+
+		// Build the command buffers containing the compute dispatch commands
+		buildComputeCommandBuffers();
 	}
 
 	// Prepare and initialize uniform buffer containing shader uniforms
 	void prepareUniformBuffers()
 	{
+		// Each frame in flight gets its own slot, so the CPU never overwrites data the GPU may still be reading
+		VkDeviceSize alignment = vulkanDevice->properties.limits.minUniformBufferOffsetAlignment;
+		compute.uniformSlotSize = sizeof(compute.ubo);
+		if (alignment > 0) {
+			compute.uniformSlotSize = (compute.uniformSlotSize + alignment - 1) & ~(alignment - 1);
+		}
+
 		// Compute shader parameter uniform buffer block
 		vulkanDevice->createBuffer(
 			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
 			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 			&compute.uniformBuffer,
-			sizeof(compute.ubo));
+			compute.uniformSlotSize * settings.maxFramesInFlight);
+		// The descriptor covers a single slot, the slot is selected with a dynamic offset
+		compute.uniformBuffer.setupDescriptor(sizeof(compute.ubo));
+		// Keep the buffer mapped for the lifetime of the example
+		VK_CHECK_RESULT(compute.uniformBuffer.map());
 
 		updateUniformBuffers();
 	}
 
+	// Updates the host copy of the uniform data, which is copied to the current frame's slot in draw()
 	void updateUniformBuffers()
 	{
 		compute.ubo.lightPos.x = 0.0f + sin(glm::radians(timer * 360.0f)) * cos(glm::radians(timer * 360.0f)) * 2.0f;
 		compute.ubo.lightPos.y = 0.0f + sin(glm::radians(timer * 360.0f)) * 2.0f;
 		compute.ubo.lightPos.z = 0.0f + cos(glm::radians(timer * 360.0f)) * 2.0f;
-		compute.ubo.camera.pos = camera.position * -1.0f;
-		VK_CHECK_RESULT(compute.uniformBuffer.map());
-		memcpy(compute.uniformBuffer.mapped, &compute.ubo, sizeof(compute.ubo));
-		compute.uniformBuffer.unmap();
+		glm::vec3 cameraPos = camera.position * -1.0f;
+		if (cameraPos != compute.ubo.camera.pos) {
+			// Samples accumulated for a different view can't be reused
+			compute.ubo.accumulationFrame = 0;
+		}
+		compute.ubo.camera.pos = cameraPos;
 	}
 
-	void draw()
+	// Select whether this frame finds and stores the primary hits or shades the stored ones
+	// Frames are executed in submission order (each compute submission waits for the previous graphics submission), so hits stored by the previous frame are complete when the next one reads them
+	void updateHitCache()
 	{
-		VulkanExampleBase::prepareFrame();
+		// Accumulation jitters the primary rays every frame, so there is nothing to reuse
+		// The heatmap visualizes the cost of the full traversal, which the cached primary hits would skip
+		// The CPU tracer doesn't use the compute shader's hit buffer, stored hits would be stale for rows that change sides
+		if (!options.hitCache || compute.ubo.accumulate || (compute.ubo.heatmap != HEATMAP_OFF) || (options.backend != BACKEND_GPU)) {
+			compute.ubo.hitCache = HIT_CACHE_OFF;
+			hitCache.valid = false;
+			hitCache.reusedFrames = 0;
+			return;
+		}
+		if (hitCache.valid && (hitCache.cameraPos == compute.ubo.camera.pos) && (hitCache.aspectRatio == compute.ubo.aspectRatio)) {
+			compute.ubo.hitCache = HIT_CACHE_READ;
+			hitCache.reusedFrames++;
+		} else {
+			compute.ubo.hitCache = HIT_CACHE_WRITE;
+			// Only valid once a frame has actually stored the hits, the command buffer has no dispatch until the compute pipeline has been created
+			hitCache.valid = compute.dispatchRecorded[currentFrame];
+			hitCache.cameraPos = compute.ubo.camera.pos;
+			hitCache.aspectRatio = compute.ubo.aspectRatio;
+			hitCache.reusedFrames = 0;
+		}
+	}
 
-		// Command buffer to be sumitted to the queue
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
-		VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+	// True if the compute shader writes to the counter buffer
+	bool countersActive()
+	{
+		return (options.backend != BACKEND_CPU) && (options.rayCounters || (compute.ubo.heatmap != HEATMAP_OFF));
+	}
 
-		VulkanExampleBase::submitFrame();
+	// CPU ray tracer settings matching the compute shader's uniform data of the current frame
+	vks::CpuRayTracer::Settings getCpuTraceSettings()
+	{
+		vks::CpuRayTracer::Settings traceSettings;
+		traceSettings.cameraPos = compute.ubo.camera.pos;
+		traceSettings.aspectRatio = compute.ubo.aspectRatio;
+		traceSettings.lightPos = compute.ubo.lightPos;
+		traceSettings.background = glm::vec3(compute.ubo.fogColor);
+		traceSettings.accumulationFrame = compute.ubo.accumulationFrame;
+		traceSettings.accumulate = (compute.ubo.accumulate != 0);
+		traceSettings.aoSamples = compute.ubo.aoSamples;
+		traceSettings.aoRadius = compute.ubo.aoRadius;
+		traceSettings.reflectionStrength = compute.ubo.reflectionStrength;
+		return traceSettings;
+	}
 
-		// Submit compute commands
-		// Use a fence to ensure that compute command buffer has finished executing before using it again
-		vkWaitForFences(device, 1, &compute.fence, VK_TRUE, UINT64_MAX);
-		vkResetFences(device, 1, &compute.fence);
+	// Trace the frame's image (from the given row on) into its staging slot, the slot is no longer read by the GPU once the frame's fence has been waited on
+	void traceOnCpu(const vks::CpuRayTracer::Settings &traceSettings, uint32_t firstRow)
+	{
+		cpuRayTracer.render(traceSettings, options.resolution, options.resolution, (uint8_t*)cpu.stagingBuffer.mapped + currentFrame * cpu.slotSize, firstRow);
 
-		VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
-		computeSubmitInfo.commandBufferCount = 1;
-		computeSubmitInfo.pCommandBuffers = &compute.commandBuffer;
+		const vks::CpuRayTracer::Statistics &statistics = cpuRayTracer.getStatistics();
+		if ((statistics.rays > 0) && (statistics.milliseconds > 0.0)) {
+			benchmark.addMetric("CPU trace (ms)", statistics.milliseconds);
+			benchmark.addMetric("CPU Mrays/s", (double)statistics.rays / (statistics.milliseconds * 1.0e3));
+		}
+	}
 
-		VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, compute.fence));
+	// Move the split so the compute shader and the CPU take about equally long for their rows
+	// Must be called after the frame's fence has been waited on, as it reads the frame's dispatch timestamps
+	void balanceSplit()
+	{
+		const uint32_t height = textureComputeTarget.height;
+		if (!pipelineBuildQueue.ready(compute.pipelineJob)) {
+			// The CPU traces everything until the compute pipeline has been created
+			split.gpuRows = 0;
+			return;
+		}
+
+		// Rows per millisecond of both sides in the last frame that used this frame's slot
+		SplitTiming timing = split.slotTimings[currentFrame];
+		split.slotTimings[currentFrame].gpuRows = 0;
+		uint64_t timestamps[2];
+		if ((split.queryPool != VK_NULL_HANDLE) && (timing.gpuRows > 0) && (timing.gpuRows < height) && (vkGetQueryPoolResults(device, split.queryPool, currentFrame * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)) {
+			uint32_t validBits = vulkanDevice->queueFamilyProperties[vulkanDevice->queueFamilyIndices.compute].timestampValidBits;
+			uint64_t mask = (validBits >= 64) ? ~0ULL : ((1ULL << validBits) - 1);
+			split.gpuMilliseconds = (double)((timestamps[1] - timestamps[0]) & mask) * deviceProperties.limits.timestampPeriod / 1.0e6;
+			if ((split.gpuMilliseconds > 0.0) && (timing.cpuMilliseconds > 0.0)) {
+				double gpuRate = (double)timing.gpuRows / split.gpuMilliseconds;
+				double cpuRate = (double)(height - timing.gpuRows) / timing.cpuMilliseconds;
+				// Smoothed, so a single slow frame on either side doesn't make the split jump
+				split.gpuShare += 0.25f * ((float)(gpuRate / (gpuRate + cpuRate)) - split.gpuShare);
+			}
+		}
+
+		// Samples accumulated for rows that change sides would be lost, so the split is held while accumulating
+		if (compute.ubo.accumulate && (compute.ubo.accumulationFrame > 0) && (split.gpuRows > 0)) {
+			return;
+		}
+		// Rows are handed out in bands of one work group, both sides keep at least one band so both can still be measured
+		const uint32_t band = options.workgroupSize;
+		const uint32_t bands = height / band;
+		if (bands < 2) {
+			split.gpuRows = height;
+			return;
+		}
+		uint32_t gpuBands = static_cast<uint32_t>(split.gpuShare * (float)height / (float)band + 0.5f);
+		split.gpuRows = std::min(std::max(gpuBands, 1u), bands - 1) * band;
+	}
+
+	// CPU work of a frame, declared once and executed every frame on the task scheduler (see draw)
+	// Nodes that don't apply to the current backend return right away
+	void prepareFrameGraph()
+	{
+		// Reads the counters of the frame that last used this frame's slot, before the slot is written again by this frame's submission
+		uint32_t readCounters = frameGraph.addNode("Read ray counters", [this] {
+			if (countersActive()) {
+				readRayCounters();
+			}
+		});
+		uint32_t frameSettings = frameGraph.addNode("Frame settings", [this] {
+			updateHitCache();
+			// Falls back to tracing primary rays until the visibility pipeline has been created
+			// The visibility pass is skipped if the primary hits are taken from the cache
+			frame.hybrid = (options.backend != BACKEND_CPU) && options.hybrid && pipelineBuildQueue.ready(visibility.pipelineJob) && (compute.ubo.hitCache != HIT_CACHE_READ);
+			frame.cpuTraceSettings = getCpuTraceSettings();
+		});
+		uint32_t cpuTrace = frameGraph.addNode("CPU trace", [this] {
+			if (options.backend == BACKEND_CPU) {
+				traceOnCpu(frame.cpuTraceSettings, 0);
+			}
+		}, { frameSettings });
+		uint32_t recordCompute = frameGraph.addNode("Record compute", [this] {
+			frame.splitCopy = false;
+			if (options.backend == BACKEND_SPLIT) {
+				balanceSplit();
+				frame.splitCopy = (split.gpuRows < textureComputeTarget.height);
+				// The split changes from frame to frame, the frame's command buffer is no longer in use and can be recorded again
+				recordComputeCommandBuffer(currentFrame);
+			}
+		}, { frameSettings });
+		// The split is balanced on the accumulation frame before it's advanced
+		uint32_t uploadUniforms = frameGraph.addNode("Upload uniforms", [this] {
+			compute.ubo.hybrid = frame.hybrid ? 1 : 0;
+			// The frame's fence has been waited on in prepareFrame, so its uniform slot and compute command buffer are no longer in use
+			memcpy((char*)compute.uniformBuffer.mapped + currentFrame * compute.uniformSlotSize, &compute.ubo, sizeof(compute.ubo));
+			if (compute.ubo.accumulate) {
+				compute.ubo.accumulationFrame++;
+			}
+		}, { frameSettings, recordCompute });
+		uint32_t submitCompute = frameGraph.addNode("Submit compute", [this] {
+			// Rasterize the primary visibility on the graphics queue
+			// Ordered after the previous frame's graphics submission, which in turn waited for the compute shader to finish reading the visibility buffer
+			if (frame.hybrid) {
+				VkSubmitInfo visibilitySubmitInfo = vks::initializers::submitInfo();
+				visibilitySubmitInfo.commandBufferCount = 1;
+				visibilitySubmitInfo.pCommandBuffers = &visibility.commandBuffers[currentFrame];
+				visibilitySubmitInfo.signalSemaphoreCount = 1;
+				visibilitySubmitInfo.pSignalSemaphores = &visibility.complete;
+				gpuProfiler.submit(currentFrame, visibility.commandBuffers[currentFrame]);
+				{
+					VKS_CPU_SCOPE("Submit visibility");
+					VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &visibilitySubmitInfo, VK_NULL_HANDLE));
+				}
+			}
+
+			// Submit compute commands
+			// Waits until the graphics queue has finished sampling the ray traced image of the previous frame, and for the visibility buffer in hybrid mode
+			VkSemaphore computeWaitSemaphores[] = { compute.semaphores.ready, visibility.complete };
+			VkPipelineStageFlags computeWaitStageMasks[] = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+			// The wait also covers the later submission copying the CPU rows of a split frame, as it's ordered after this one on the queue
+			VkSubmitInfo computeSubmitInfo = vks::initializers::submitInfo();
+			computeSubmitInfo.waitSemaphoreCount = frame.hybrid ? 2 : 1;
+			computeSubmitInfo.pWaitSemaphores = computeWaitSemaphores;
+			computeSubmitInfo.pWaitDstStageMask = computeWaitStageMasks;
+			computeSubmitInfo.commandBufferCount = 1;
+			computeSubmitInfo.pCommandBuffers = &compute.commandBuffers[currentFrame];
+			// With CPU rows the graphics queue is signaled by the copy submission, which comes later in submission order and so covers the dispatch as well
+			computeSubmitInfo.signalSemaphoreCount = frame.splitCopy ? 0 : 1;
+			computeSubmitInfo.pSignalSemaphores = &compute.semaphores.complete;
+			gpuProfiler.submit(currentFrame, compute.commandBuffers[currentFrame]);
+			{
+				VKS_CPU_SCOPE("Submit compute");
+				VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &computeSubmitInfo, VK_NULL_HANDLE));
+			}
+			if (countersActive()) {
+				counters.slotWritten[currentFrame] = true;
+			}
+		}, { readCounters, cpuTrace, uploadUniforms });
+		uint32_t traceCpuRows = frameGraph.addNode("Trace CPU rows", [this] {
+			// Trace the CPU rows while the GPU works on its rows, then submit the copy of the CPU rows
+			// Host writes made before a submission are visible to it, so the staging slot needs no barrier
+			if (frame.splitCopy) {
+				traceOnCpu(frame.cpuTraceSettings, split.gpuRows);
+				VkSubmitInfo copySubmitInfo = vks::initializers::submitInfo();
+				copySubmitInfo.commandBufferCount = 1;
+				copySubmitInfo.pCommandBuffers = &split.copyCommandBuffers[currentFrame];
+				copySubmitInfo.signalSemaphoreCount = 1;
+				copySubmitInfo.pSignalSemaphores = &compute.semaphores.complete;
+				gpuProfiler.submit(currentFrame, split.copyCommandBuffers[currentFrame]);
+				{
+					VKS_CPU_SCOPE("Submit CPU rows");
+					VK_CHECK_RESULT(vkQueueSubmit(compute.queue, 1, &copySubmitInfo, VK_NULL_HANDLE));
+				}
+				const vks::CpuRayTracer::Statistics &statistics = cpuRayTracer.getStatistics();
+				split.slotTimings[currentFrame] = { split.gpuRows, statistics.milliseconds };
+				benchmark.addMetric("GPU rows (%)", 100.0 * (double)split.gpuRows / (double)textureComputeTarget.height);
+				if (split.gpuMilliseconds > 0.0) {
+					benchmark.addMetric("GPU dispatch (ms)", split.gpuMilliseconds);
+				}
+				// The GPU rays are only known with the ray counters enabled
+				split.combinedRaysPerSecond = 0.0;
+				if (options.rayCounters && (counters.last.rays > 0) && (counters.frameTime > 0.0)) {
+					split.combinedRaysPerSecond = (double)(counters.last.rays + statistics.rays) / counters.frameTime;
+					benchmark.addMetric("combined Mrays/s", split.combinedRaysPerSecond / 1.0e6);
+				}
+			}
+		}, { submitCompute });
+		// Animates the uniform data of the next frame, overlaps with the CPU rows of a split frame
+		frameGraph.addNode("Update uniforms", [this] {
+			if (!paused) {
+				updateUniformBuffers();
+			}
+		}, { uploadUniforms });
+		// Runs after the compute submission, as the GPU profiler must not be used by two nodes at the same time
+		uint32_t recordGraphics = frameGraph.addNode("Record graphics", [this] {
+			recordGraphicsCommandBuffer();
+		}, { submitCompute });
+		frameGraph.addNode("Submit graphics", [this] {
+			// Command buffer to be sumitted to the queue
+			// Waits for image acquisition and the compute shader writes, signals presentation and the next compute submission
+			VkSemaphore graphicsWaitSemaphores[] = { semaphores[currentFrame].presentComplete, compute.semaphores.complete };
+			VkPipelineStageFlags graphicsWaitStageMasks[] = { submitPipelineStages, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT };
+			VkSemaphore graphicsSignalSemaphores[] = { semaphores[currentFrame].renderComplete, compute.semaphores.ready };
+			VkSubmitInfo graphicsSubmitInfo = submitInfo;
+			graphicsSubmitInfo.waitSemaphoreCount = 2;
+			graphicsSubmitInfo.pWaitSemaphores = graphicsWaitSemaphores;
+			graphicsSubmitInfo.pWaitDstStageMask = graphicsWaitStageMasks;
+			graphicsSubmitInfo.signalSemaphoreCount = 2;
+			graphicsSubmitInfo.pSignalSemaphores = graphicsSignalSemaphores;
+			graphicsSubmitInfo.commandBufferCount = 1;
+			graphicsSubmitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
+			gpuProfiler.submit(currentFrame, drawCmdBuffers[currentBuffer]);
+			{
+				VKS_CPU_SCOPE("Submit graphics");
+				VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &graphicsSubmitInfo, VK_NULL_HANDLE));
+			}
+		}, { recordGraphics, traceCpuRows });
+	}
+
+	void draw()
+	{
+		VulkanExampleBase::prepareFrame();
+
+		frameGraph.execute(taskScheduler);
+		benchmark.addMetric("frame graph (ms)", frameGraph.getElapsedTime());
+		benchmark.addMetric("frame graph critical path (ms)", frameGraph.getCriticalPathTime());
+		benchmark.addMetric("frame graph work (ms)", frameGraph.getWorkTime());
+
+		VulkanExampleBase::submitFrame();
 	}
 
 	void prepare()
 	{
 		VulkanExampleBase::prepare();
+		// The CPU trace runs as a node of the frame graph, it shares the graph's threads
+		cpuRayTracer.setScheduler(&taskScheduler);
 		prepareStorageBuffers();
 		prepareUniformBuffers();
-		prepareTextureTarget(&textureComputeTarget, TEX_DIM, TEX_DIM, VK_FORMAT_R8G8B8A8_UNORM);
+		prepareTextureTarget(&textureComputeTarget, options.resolution, options.resolution, VK_FORMAT_R8G8B8A8_UNORM);
+		prepareVisibilityFramebuffer();
+		prepareHitCacheBuffer();
 		setupDescriptorSetLayout();
 		preparePipelines();
 		setupDescriptorPool();
 		setupDescriptorSet();
 		prepareCompute();
+		prepareVisibility();
+		prepareSplitFrame();
+		prepareFrameGraph();
 		buildCommandBuffers();
 		prepared = true;
 	}
@@ -682,16 +1628,273 @@ public:
 	{
 		if (!prepared)
 			return;
+		// Also animates the uniform data for the next frame
 		draw();
-		if (!paused)
-		{
-			updateUniformBuffers();
+	}
+
+	virtual void pipelinesReady()
+	{
+		VulkanExampleBase::pipelinesReady();
+		// Hits stored before the pipelines were swapped in are not reused
+		hitCache.valid = false;
+		buildComputeCommandBuffers();
+		buildVisibilityCommandBuffers();
+	}
+
+	virtual bool applyBenchmarkScenario(const vks::BenchmarkSweep::Scenario &scenario)
+	{
+		auto toUint = [](const std::string &value, uint32_t &result) {
+			char *end;
+			unsigned long number = strtoul(value.c_str(), &end, 10);
+			if ((end == value.c_str()) || (*end != '\0') || (number == 0)) {
+				return false;
+			}
+			result = static_cast<uint32_t>(number);
+			return true;
+		};
+		// Validate all parameters before changing any resources
+		uint32_t resolution = options.resolution;
+		uint32_t triangleCount = options.triangleCount;
+		uint32_t workgroupSize = options.workgroupSize;
+		uint32_t accumulate = compute.ubo.accumulate;
+		bool rayCounters = options.rayCounters;
+		uint32_t heatmap = compute.ubo.heatmap;
+		bool hybrid = options.hybrid;
+		bool useHitCache = options.hitCache;
+		uint32_t backend = options.backend;
+		bool packetTraversal = cpuRayTracer.packetTraversal;
+		for (auto &parameter : scenario) {
+			bool valid = false;
+			if (parameter.first == "resolution") {
+				valid = toUint(parameter.second, resolution) && (resolution <= deviceProperties.limits.maxImageDimension2D);
+			} else if (parameter.first == "triangles") {
+				valid = toUint(parameter.second, triangleCount);
+			} else if (parameter.first == "workgroupsize") {
+				const VkPhysicalDeviceLimits &limits = deviceProperties.limits;
+				valid = toUint(parameter.second, workgroupSize) && (workgroupSize <= limits.maxComputeWorkGroupSize[0]) && (workgroupSize <= limits.maxComputeWorkGroupSize[1]) && (workgroupSize * workgroupSize <= limits.maxComputeWorkGroupInvocations);
+			} else if (parameter.first == "accumulation") {
+				valid = (parameter.second == "on") || (parameter.second == "off");
+				accumulate = (parameter.second == "on") ? 1 : 0;
+			} else if (parameter.first == "counters") {
+				valid = (parameter.second == "on") || (parameter.second == "off");
+				rayCounters = (parameter.second == "on");
+			} else if (parameter.first == "heatmap") {
+				const std::vector<std::string> modes = { "off", "nodes", "triangles" };
+				auto mode = std::find(modes.begin(), modes.end(), parameter.second);
+				valid = (mode != modes.end());
+				heatmap = static_cast<uint32_t>(mode - modes.begin());
+			} else if (parameter.first == "hybrid") {
+				valid = (parameter.second == "on") || (parameter.second == "off");
+				hybrid = (parameter.second == "on");
+			} else if (parameter.first == "hitcache") {
+				valid = (parameter.second == "on") || (parameter.second == "off");
+				useHitCache = (parameter.second == "on");
+			} else if (parameter.first == "backend") {
+				const std::vector<std::string> backends = { "gpu", "cpu", "split" };
+				auto mode = std::find(backends.begin(), backends.end(), parameter.second);
+				valid = (mode != backends.end());
+				backend = static_cast<uint32_t>(mode - backends.begin());
+			} else if (parameter.first == "packets") {
+				valid = (parameter.second == "on") || (parameter.second == "off");
+				packetTraversal = (parameter.second == "on");
+			}
+			if (!valid) {
+				std::cerr << "Unsupported benchmark parameter " << parameter.first << " = " << parameter.second << std::endl;
+				return false;
+			}
+		}
+
+		// The device is idle, so resources can be replaced directly
+		if (resolution != options.resolution) {
+			options.resolution = resolution;
+			textureComputeTarget.destroy();
+			prepareTextureTarget(&textureComputeTarget, resolution, resolution, VK_FORMAT_R8G8B8A8_UNORM);
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(graphics.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &textureComputeTarget.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 0, &textureComputeTarget.descriptor),
+			};
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+			delete visibility.framebuffer;
+			prepareVisibilityFramebuffer();
+			updateVisibilityDescriptors();
+			hitCache.buffer.destroy();
+			prepareHitCacheBuffer();
+			VkWriteDescriptorSet hitCacheWriteDescriptorSet = vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &hitCache.buffer.descriptor);
+			vkUpdateDescriptorSets(device, 1, &hitCacheWriteDescriptorSet, 0, nullptr);
+			if (cpu.slotSize > 0) {
+				prepareCpuStagingBuffer();
+			}
+		}
+		if (triangleCount != options.triangleCount) {
+			options.triangleCount = triangleCount;
+			compute.storageBuffers.triangles.destroy();
+			compute.storageBuffers.bvhNodes.destroy();
+			prepareTriangleStorageBuffer();
+			std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+				vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &compute.storageBuffers.triangles.descriptor),
+				vks::initializers::writeDescriptorSet(compute.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &compute.storageBuffers.bvhNodes.descriptor),
+				vks::initializers::writeDescriptorSet(visibility.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, &compute.storageBuffers.triangles.descriptor),
+			};
+			vkUpdateDescriptorSets(device, static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, nullptr);
+			// Cached hits refer to the old triangles
+			hitCache.valid = false;
+		}
+		if ((workgroupSize != options.workgroupSize) || (rayCounters != options.rayCounters)) {
+			options.workgroupSize = workgroupSize;
+			setRayCounters(rayCounters);
+			recreateComputePipeline();
+		}
+		compute.ubo.accumulate = accumulate;
+		compute.ubo.heatmap = heatmap;
+		compute.ubo.accumulationFrame = 0;
+		options.hybrid = hybrid;
+		options.hitCache = useHitCache;
+		setBackend(backend);
+		cpuRayTracer.packetTraversal = packetTraversal;
+
+		// Updated descriptor sets invalidate the command buffers they have been bound in
+		buildComputeCommandBuffers();
+		buildVisibilityCommandBuffers();
+		buildCommandBuffers();
+		return true;
+	}
+
+	// Enable or disable the ray counters, the compute pipeline needs to be recreated afterwards
+	void setRayCounters(bool enabled)
+	{
+		options.rayCounters = enabled;
+		// Slots written before the change are stale
+		memset(counters.buffer.mapped, 0, counters.slotSize * settings.maxFramesInFlight);
+		counters.slotWritten.assign(settings.maxFramesInFlight, false);
+		counters.last = {};
+		counters.raysPerSecond = 0.0;
+	}
+
+	// Switch between the compute shader, the CPU ray tracer and both, the compute command buffers need to be rebuilt afterwards
+	void setBackend(uint32_t backend)
+	{
+		if ((backend != BACKEND_GPU) && (cpu.slotSize == 0)) {
+			prepareCpuStagingBuffer();
+		}
+		if (backend != options.backend) {
+			compute.ubo.accumulationFrame = 0;
+			// Timings of the previous backend don't tell anything about the split
+			split.gpuShare = 0.5f;
+			split.gpuRows = 0;
+			split.slotTimings.assign(settings.maxFramesInFlight, { 0, 0.0 });
+		}
+		options.backend = backend;
+	}
+
+	virtual void OnUpdateUIOverlay(vks::UIOverlay *overlay)
+	{
+		if (overlay->header("Rendering")) {
+			int32_t backend = static_cast<int32_t>(options.backend);
+			if (overlay->comboBox("Backend", &backend, { "GPU", "CPU", "GPU + CPU split" })) {
+				VK_CHECK_RESULT(vkDeviceWaitIdle(device));
+				setBackend(static_cast<uint32_t>(backend));
+				buildComputeCommandBuffers();
+			}
+			if (options.backend == BACKEND_SPLIT) {
+				overlay->text("GPU %u rows in %.1f ms", split.gpuRows, split.gpuMilliseconds);
+				overlay->text("CPU %u rows", textureComputeTarget.height - split.gpuRows);
+				if (options.rayCounters) {
+					overlay->text("%.1f Mrays/s combined", split.combinedRaysPerSecond / 1.0e6);
+				}
+			}
+			if (options.backend != BACKEND_GPU) {
+				const vks::CpuRayTracer::Statistics &statistics = cpuRayTracer.getStatistics();
+				overlay->text("%.1f ms on %u threads", statistics.milliseconds, cpuRayTracer.getThreadCount());
+				overlay->text("%.1f Mrays/s", (statistics.milliseconds > 0.0) ? (double)statistics.rays / (statistics.milliseconds * 1.0e3) : 0.0);
+				overlay->checkBox("Primary ray packets", &cpuRayTracer.packetTraversal);
+				if (cpuRayTracer.packetTraversal) {
+					overlay->text("%llu single ray fallbacks", (unsigned long long)statistics.packetFallbacks);
+				}
+			}
+			// Switched per frame in draw, no command buffers need to be rebuilt
+			overlay->checkBox("Rasterize primary visibility", &options.hybrid);
+			if (options.hybrid) {
+				overlay->text("%u batches recorded on %u threads", static_cast<uint32_t>(visibility.batchCommandBuffers.size()), taskScheduler.getThreadCount());
+			}
+			overlay->checkBox("Cache primary hits", &options.hitCache);
+			if (compute.ubo.hitCache == HIT_CACHE_READ) {
+				overlay->text("Primary hits reused for %u frames", hitCache.reusedFrames);
+			}
+			int32_t aoSamples = static_cast<int32_t>(compute.ubo.aoSamples);
+			if (overlay->sliderInt("AO rays", &aoSamples, 0, 16)) {
+				compute.ubo.aoSamples = static_cast<uint32_t>(aoSamples);
+				compute.ubo.accumulationFrame = 0;
+			}
+			if (overlay->sliderFloat("AO radius", &compute.ubo.aoRadius, 0.05f, 2.0f)) {
+				compute.ubo.accumulationFrame = 0;
+			}
+			if (overlay->sliderFloat("Reflection", &compute.ubo.reflectionStrength, 0.0f, 1.0f)) {
+				compute.ubo.accumulationFrame = 0;
+			}
+		}
+		if (overlay->header("Performance counters")) {
+			bool rayCounters = options.rayCounters;
+			if (overlay->checkBox("Ray counters", &rayCounters)) {
+				VK_CHECK_RESULT(vkDeviceWaitIdle(device));
+				setRayCounters(rayCounters);
+				recreateComputePipeline();
+				buildComputeCommandBuffers();
+			}
+			if (options.rayCounters) {
+				const RayCounters &last = counters.last;
+				float rays = (float)std::max(last.rays, 1u);
+				overlay->text("%.1f Mrays/s", counters.raysPerSecond / 1.0e6);
+				overlay->text("%u rays/frame", last.rays);
+				overlay->text("%.1f nodes visited/ray", (float)last.nodesVisited / rays);
+				overlay->text("%.1f triangle tests/ray", (float)last.triangleTests / rays);
+			}
+		}
+		if (overlay->header("Frame graph")) {
+			overlay->text("%.2f ms, %.2f ms of work", frameGraph.getElapsedTime(), frameGraph.getWorkTime());
+			overlay->text("Critical path %.2f ms:", frameGraph.getCriticalPathTime());
+			for (auto &node : frameGraph.getCriticalPath()) {
+				overlay->text("  %s %.2f ms", node.name, node.end - node.start);
+			}
+		}
+		if (overlay->header("Device memory")) {
+			const vks::DeviceMemoryAllocator::Statistics memory = vulkanDevice->memoryAllocator.getStatistics();
+			overlay->text("%u resources in %u blocks (%.1f MB)", memory.allocationCount, memory.blockCount, memory.blockBytes / 1048576.0f);
+			overlay->text("%u dedicated (%.1f MB)", memory.dedicatedCount, memory.dedicatedBytes / 1048576.0f);
+			overlay->text("Fragmentation: %.0f%% internal, %.0f%% external", memory.internalFragmentation() * 100.0f, memory.externalFragmentation() * 100.0f);
+			overlay->text("%llu uploads (%.1f MB) in %llu submissions", (unsigned long long)uploadManager.getUploadCount(), uploadManager.getUploadedBytes() / 1048576.0f, (unsigned long long)uploadManager.getSubmissionCount());
+			overlay->text("Upload queue: %s", uploadManager.usesTransferQueue() ? "dedicated transfer" : "graphics");
+		}
+		if (overlay->header("Traversal cost heatmap")) {
+			int32_t heatmap = static_cast<int32_t>(compute.ubo.heatmap);
+			if (overlay->comboBox("Heatmap", &heatmap, { "Off", "BVH nodes visited", "Triangle tests" })) {
+				compute.ubo.heatmap = static_cast<uint32_t>(heatmap);
+				compute.ubo.accumulationFrame = 0;
+			}
+			if (compute.ubo.heatmap != HEATMAP_OFF) {
+				int32_t heatmapMax = static_cast<int32_t>(compute.ubo.heatmapMax);
+				if (overlay->sliderInt("Maximum cost", &heatmapMax, HISTOGRAM_BINS / 4, 1024)) {
+					compute.ubo.heatmapMax = (float)heatmapMax;
+					compute.ubo.accumulationFrame = 0;
+				}
+				// Share of the pixels per cost range, the last bin includes everything above the maximum
+				float histogram[HISTOGRAM_BINS];
+				float pixels = 0.0f;
+				for (uint32_t i = 0; i < HISTOGRAM_BINS; i++) {
+					pixels += (float)counters.last.histogram[i];
+				}
+				for (uint32_t i = 0; i < HISTOGRAM_BINS; i++) {
+					histogram[i] = (pixels > 0.0f) ? (float)counters.last.histogram[i] / pixels : 0.0f;
+				}
+				ImGui::PlotHistogram("##histogram", histogram, HISTOGRAM_BINS, 0, nullptr, 0.0f, 1.0f, ImVec2(0.0f, 60.0f * overlay->scale));
+				overlay->text("p50 %.0f, p95 %.0f, p99 %.0f", getHistogramPercentile(50.0f), getHistogramPercentile(95.0f), getHistogramPercentile(99.0f));
+			}
 		}
 	}
 
 	virtual void viewChanged()
 	{
 		compute.ubo.aspectRatio = (float)width / (float)height;
+		compute.ubo.accumulationFrame = 0;
 		updateUniformBuffers();
 	}
 };
@@ -0,0 +1,162 @@
+/*
+* Tests for the buddy allocator used to place resources in device memory blocks
+*
+* Doesn't call Vulkan, so it runs without a device
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include "VulkanMemoryAllocator.hpp"
+
+static uint32_t failures = 0;
+
+#define CHECK(condition)																				\
+{																										\
+	if (!(condition)) {																					\
+		std::cerr << "Check failed: " << #condition << " in " << __FILE__ << " at line " << __LINE__ << std::endl; \
+		failures++;																						\
+	}																									\
+}
+
+// Allocating the smallest node splits the space into free halves, the next allocations take the smallest halves that fit
+void testSplit()
+{
+	vks::BuddyAllocator buddy;
+	buddy.init(1024, 64);
+	uint64_t offset = 0, nodeSize = 0;
+	CHECK(buddy.allocate(64, 1, &offset, &nodeSize));
+	CHECK((offset == 0) && (nodeSize == 64));
+	CHECK(buddy.getUsedSize() == 64);
+	CHECK(buddy.getLargestFreeSize() == 512);
+	// Rounded up to the next power of two
+	CHECK(buddy.allocate(100, 1, &offset, &nodeSize));
+	CHECK((offset == 128) && (nodeSize == 128));
+	CHECK(buddy.allocate(1, 1, &offset, &nodeSize));
+	CHECK((offset == 64) && (nodeSize == 64));
+	CHECK(buddy.getAllocationCount() == 3);
+	CHECK(buddy.getUsedSize() == 256);
+	CHECK(buddy.getFreeSize() == 768);
+}
+
+// Freed nodes are merged with their buddies, until the whole space is a single free node again
+void testMerge()
+{
+	vks::BuddyAllocator buddy;
+	buddy.init(1024, 64);
+	uint64_t offsets[4];
+	for (uint32_t i = 0; i < 4; i++) {
+		CHECK(buddy.allocate(256, 1, &offsets[i]));
+	}
+	CHECK(buddy.getLargestFreeSize() == 0);
+	// Not buddies, no merge
+	buddy.free(offsets[1]);
+	buddy.free(offsets[2]);
+	CHECK(buddy.getLargestFreeSize() == 256);
+	buddy.free(offsets[0]);
+	CHECK(buddy.getLargestFreeSize() == 512);
+	buddy.free(offsets[3]);
+	CHECK(buddy.empty());
+	CHECK(buddy.getUsedSize() == 0);
+	CHECK(buddy.getLargestFreeSize() == 1024);
+	uint64_t offset = 0;
+	CHECK(buddy.allocate(1024, 1, &offset));
+	CHECK(offset == 0);
+}
+
+// Alignments larger than the requested size are met by reserving a node as large as the alignment
+void testAlignment()
+{
+	vks::BuddyAllocator buddy;
+	buddy.init(4096, 64);
+	uint64_t offset = 0, nodeSize = 0;
+	CHECK(buddy.allocate(64, 1, &offset, &nodeSize));
+	CHECK(offset == 0);
+	CHECK(buddy.allocate(10, 512, &offset, &nodeSize));
+	CHECK((offset % 512 == 0) && (offset != 0) && (nodeSize == 512));
+	CHECK(buddy.allocate(300, 256, &offset, &nodeSize));
+	CHECK((offset % 512 == 0) && (nodeSize == 512));
+	CHECK(buddy.allocate(64, 2048, &offset, &nodeSize));
+	CHECK((offset == 2048) && (nodeSize == 2048));
+	// Larger than the space
+	CHECK(!buddy.allocate(64, 8192, &offset));
+}
+
+// Allocations fail once no free node is large enough, even if there are enough free bytes in total
+void testExhaustion()
+{
+	vks::BuddyAllocator buddy;
+	buddy.init(1024, 64);
+	uint64_t offsets[16];
+	for (uint32_t i = 0; i < 16; i++) {
+		CHECK(buddy.allocate(64, 1, &offsets[i]));
+	}
+	uint64_t offset = 0;
+	CHECK(!buddy.allocate(64, 1, &offset));
+	CHECK(!buddy.allocate(2048, 1, &offset));
+	CHECK(buddy.getFreeSize() == 0);
+	// Two free nodes that are not buddies
+	buddy.free(offsets[0]);
+	buddy.free(offsets[2]);
+	CHECK(buddy.getFreeSize() == 128);
+	CHECK(!buddy.allocate(128, 1, &offset));
+	CHECK(buddy.allocate(64, 1, &offset));
+	CHECK((offset == offsets[0]) || (offset == offsets[2]));
+}
+
+// Random allocations and frees never overlap, and freeing everything restores a single free node
+void testRandom()
+{
+	struct Range { uint64_t offset; uint64_t size; };
+	vks::BuddyAllocator buddy;
+	buddy.init(1 << 20, 256);
+	std::mt19937 random(4096);
+	std::vector<Range> ranges;
+	for (uint32_t i = 0; i < 10000; i++) {
+		if (ranges.empty() || (random() % 3 != 0)) {
+			uint64_t size = 1 + random() % 16384;
+			uint64_t alignment = 1ull << (random() % 13);
+			Range range;
+			if (buddy.allocate(size, alignment, &range.offset, &range.size)) {
+				CHECK((range.offset % alignment == 0) && (range.size >= size) && (range.offset + range.size <= buddy.getSize()));
+				ranges.push_back(range);
+			}
+		} else {
+			size_t index = random() % ranges.size();
+			buddy.free(ranges[index].offset);
+			ranges.erase(ranges.begin() + index);
+		}
+	}
+	std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) { return a.offset < b.offset; });
+	uint64_t usedSize = 0;
+	for (size_t i = 0; i < ranges.size(); i++) {
+		usedSize += ranges[i].size;
+		if (i > 0) {
+			CHECK(ranges[i - 1].offset + ranges[i - 1].size <= ranges[i].offset);
+		}
+	}
+	CHECK(buddy.getUsedSize() == usedSize);
+	for (auto &range : ranges) {
+		buddy.free(range.offset);
+	}
+	CHECK(buddy.empty());
+	CHECK(buddy.getLargestFreeSize() == buddy.getSize());
+}
+
+int main()
+{
+	testSplit();
+	testMerge();
+	testAlignment();
+	testExhaustion();
+	testRandom();
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}
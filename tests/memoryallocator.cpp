@@ -0,0 +1,208 @@
+/*
+* Smoke test for the device memory sub-allocator
+*
+* Places buffers and images on the first physical device, a software implementation can be selected with the loader, e.g.:
+* VK_ICD_FILENAMES=/usr/share/vulkan/icd.d/lvp_icd.x86_64.json ./memoryallocator
+* Skipped (exit code 77) if there is no Vulkan device
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include "VulkanMemoryAllocator.hpp"
+
+static uint32_t failures = 0;
+
+#define CHECK(condition)																				\
+{																										\
+	if (!(condition)) {																					\
+		std::cerr << "Check failed: " << #condition << " in " << __FILE__ << " at line " << __LINE__ << std::endl; \
+		failures++;																						\
+	}																									\
+}
+
+static const int SKIPPED = 77;
+
+struct TestBuffer
+{
+	VkBuffer buffer = VK_NULL_HANDLE;
+	vks::Allocation allocation;
+};
+
+VkBuffer createBuffer(VkDevice device, VkDeviceSize size, VkMemoryRequirements *memReqs)
+{
+	VkBufferCreateInfo bufferCreateInfo = vks::initializers::bufferCreateInfo(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
+	VkBuffer buffer;
+	VK_CHECK_RESULT(vkCreateBuffer(device, &bufferCreateInfo, nullptr, &buffer));
+	vkGetBufferMemoryRequirements(device, buffer, memReqs);
+	return buffer;
+}
+
+// Ranges placed in the same memory must not overlap
+void checkOverlap(std::vector<const vks::Allocation*> allocations)
+{
+	std::sort(allocations.begin(), allocations.end(), [](const vks::Allocation *a, const vks::Allocation *b) {
+		return (a->memory != b->memory) ? (a->memory < b->memory) : (a->offset < b->offset);
+	});
+	for (size_t i = 1; i < allocations.size(); i++) {
+		if (allocations[i - 1]->memory == allocations[i]->memory) {
+			CHECK(allocations[i - 1]->offset + allocations[i - 1]->size <= allocations[i]->offset);
+		}
+	}
+}
+
+int main()
+{
+	VkApplicationInfo appInfo = {};
+	appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+	appInfo.pApplicationName = "memoryallocator";
+	appInfo.apiVersion = VK_API_VERSION_1_0;
+	VkInstanceCreateInfo instanceCreateInfo = {};
+	instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	instanceCreateInfo.pApplicationInfo = &appInfo;
+	VkInstance instance;
+	if (vkCreateInstance(&instanceCreateInfo, nullptr, &instance) != VK_SUCCESS) {
+		std::cout << "Could not create a Vulkan instance, skipped" << std::endl;
+		return SKIPPED;
+	}
+	uint32_t physicalDeviceCount = 1;
+	VkPhysicalDevice physicalDevice;
+	VkResult result = vkEnumeratePhysicalDevices(instance, &physicalDeviceCount, &physicalDevice);
+	if (((result != VK_SUCCESS) && (result != VK_INCOMPLETE)) || (physicalDeviceCount == 0)) {
+		std::cout << "No Vulkan device found, skipped" << std::endl;
+		vkDestroyInstance(instance, nullptr);
+		return SKIPPED;
+	}
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	std::cout << "Device: " << properties.deviceName << std::endl;
+
+	// No queue is used, but a device needs one from any family that exposes queues
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilyProperties(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilyProperties.data());
+	auto queueFamily = std::find_if(queueFamilyProperties.begin(), queueFamilyProperties.end(), [](const VkQueueFamilyProperties &family) { return family.queueCount > 0; });
+	if (queueFamily == queueFamilyProperties.end()) {
+		std::cout << "Device has no queues, skipped" << std::endl;
+		vkDestroyInstance(instance, nullptr);
+		return SKIPPED;
+	}
+
+	const float queuePriority = 1.0f;
+	VkDeviceQueueCreateInfo queueCreateInfo = {};
+	queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueCreateInfo.queueFamilyIndex = static_cast<uint32_t>(std::distance(queueFamilyProperties.begin(), queueFamily));
+	queueCreateInfo.queueCount = 1;
+	queueCreateInfo.pQueuePriorities = &queuePriority;
+	VkDeviceCreateInfo deviceCreateInfo = {};
+	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceCreateInfo.queueCreateInfoCount = 1;
+	deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+	VkDevice device;
+	VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &deviceCreateInfo, nullptr, &device));
+
+	const VkDeviceSize blockSize = 1024 * 1024;
+	vks::DeviceMemoryAllocator allocator;
+	allocator.prepare(physicalDevice, device, blockSize);
+	std::vector<const vks::Allocation*> allocations;
+
+	// Small host visible buffers share a block
+	std::vector<TestBuffer> buffers(32);
+	for (uint32_t i = 0; i < buffers.size(); i++) {
+		VkMemoryRequirements memReqs;
+		buffers[i].buffer = createBuffer(device, 1000 + i * 100, &memReqs);
+		VK_CHECK_RESULT(allocator.allocate(memReqs, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, false, &buffers[i].allocation));
+		const vks::Allocation &allocation = buffers[i].allocation;
+		CHECK(allocation.offset % memReqs.alignment == 0);
+		CHECK(allocation.size >= memReqs.size);
+		CHECK(allocation.mapped != nullptr);
+		CHECK(vkBindBufferMemory(device, buffers[i].buffer, allocation.memory, allocation.offset) == VK_SUCCESS);
+		if (allocation.mapped) {
+			memset(allocation.mapped, i, static_cast<size_t>(memReqs.size));
+			CHECK(allocator.flush(allocation) == VK_SUCCESS);
+		}
+		allocations.push_back(&allocation);
+	}
+	// Each buffer still holds its own pattern, so no write overlapped another buffer
+	for (uint32_t i = 0; i < buffers.size(); i++) {
+		const uint8_t *data = static_cast<const uint8_t*>(buffers[i].allocation.mapped);
+		if (data) {
+			CHECK((data[0] == (uint8_t)i) && (data[buffers[i].allocation.requestedSize - 1] == (uint8_t)i));
+		}
+	}
+
+	// Larger than half a block, gets memory of its own
+	TestBuffer largeBuffer;
+	VkMemoryRequirements largeMemReqs;
+	largeBuffer.buffer = createBuffer(device, blockSize, &largeMemReqs);
+	VK_CHECK_RESULT(allocator.allocate(largeMemReqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false, &largeBuffer.allocation));
+	CHECK(largeBuffer.allocation.offset == 0);
+	CHECK(vkBindBufferMemory(device, largeBuffer.buffer, largeBuffer.allocation.memory, largeBuffer.allocation.offset) == VK_SUCCESS);
+
+	// Optimal tiling images are placed in blocks of their own, apart from the buffers
+	VkImageCreateInfo imageCreateInfo = vks::initializers::imageCreateInfo();
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	imageCreateInfo.extent = { 64, 64, 1 };
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	std::vector<VkImage> images(4);
+	std::vector<vks::Allocation> imageAllocations(images.size());
+	for (uint32_t i = 0; i < images.size(); i++) {
+		VK_CHECK_RESULT(vkCreateImage(device, &imageCreateInfo, nullptr, &images[i]));
+		VkMemoryRequirements memReqs;
+		vkGetImageMemoryRequirements(device, images[i], &memReqs);
+		VK_CHECK_RESULT(allocator.allocate(memReqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, true, &imageAllocations[i]));
+		CHECK(imageAllocations[i].offset % memReqs.alignment == 0);
+		CHECK(vkBindImageMemory(device, images[i], imageAllocations[i].memory, imageAllocations[i].offset) == VK_SUCCESS);
+		for (auto &buffer : buffers) {
+			CHECK(imageAllocations[i].memory != buffer.allocation.memory);
+		}
+		allocations.push_back(&imageAllocations[i]);
+	}
+	checkOverlap(allocations);
+
+	vks::DeviceMemoryAllocator::Statistics statistics = allocator.getStatistics();
+	std::cout << "Device memory allocations: " << statistics.deviceMemoryCount << " (" << statistics.blockCount << " blocks, " << statistics.dedicatedCount << " dedicated)" << std::endl;
+	std::cout << "Internal fragmentation: " << statistics.internalFragmentation() * 100.0f << "%, external fragmentation: " << statistics.externalFragmentation() * 100.0f << "%" << std::endl;
+	CHECK(statistics.allocationCount == buffers.size() + images.size());
+	CHECK(statistics.dedicatedCount == 1);
+	CHECK(statistics.deviceMemoryCount < statistics.allocationCount);
+	CHECK(statistics.usedBytes >= statistics.requestedBytes);
+	CHECK(statistics.usedBytes + statistics.freeBytes == statistics.blockBytes);
+
+	// Freeing everything keeps one block per memory type and tiling, but no dedicated memory
+	for (auto &buffer : buffers) {
+		vkDestroyBuffer(device, buffer.buffer, nullptr);
+		allocator.free(buffer.allocation);
+	}
+	vkDestroyBuffer(device, largeBuffer.buffer, nullptr);
+	allocator.free(largeBuffer.allocation);
+	for (uint32_t i = 0; i < images.size(); i++) {
+		vkDestroyImage(device, images[i], nullptr);
+		allocator.free(imageAllocations[i]);
+	}
+	statistics = allocator.getStatistics();
+	CHECK(statistics.allocationCount == 0);
+	CHECK(statistics.dedicatedCount == 0);
+	CHECK(statistics.usedBytes == 0);
+	CHECK(statistics.requestedBytes == 0);
+
+	allocator.destroy();
+	vkDestroyDevice(device, nullptr);
+	vkDestroyInstance(instance, nullptr);
+
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+* Tests for the work stealing task scheduler
+*
+* Continuations are added while the last job of their group finishes, a lost continuation makes the test hang (see the ctest timeout)
+* Jobs of one scheduler also submit jobs to another one
+*
+* This code is licensed under the MIT license (MIT) (http://opensource.org/licenses/MIT)
+*/
+
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include "taskscheduler.hpp"
+
+static uint32_t failures = 0;
+
+#define CHECK(condition)																				\
+{																										\
+	if (!(condition)) {																					\
+		std::cerr << "Check failed: " << #condition << " in " << __FILE__ << " at line " << __LINE__ << std::endl; \
+		failures++;																						\
+	}																									\
+}
+
+// Busy wait of varying length, so the job finishes at different points of then()
+void spin(uint32_t iterations)
+{
+	volatile uint32_t counter = 0;
+	for (uint32_t i = 0; i < iterations; i++) {
+		counter = counter + 1;
+	}
+}
+
+// Every job of a parallelFor runs exactly once
+void testParallelFor(vks::TaskScheduler &scheduler)
+{
+	std::vector<std::atomic<uint32_t>> visits(100000);
+	for (auto &visit : visits) {
+		visit.store(0);
+	}
+	scheduler.parallelFor(static_cast<uint32_t>(visits.size()), [&visits](uint32_t first, uint32_t last) {
+		for (uint32_t i = first; i < last; i++) {
+			visits[i].fetch_add(1);
+		}
+	});
+	uint32_t wrong = 0;
+	for (auto &visit : visits) {
+		wrong += (visit.load() != 1) ? 1 : 0;
+	}
+	CHECK(wrong == 0);
+}
+
+// then() races with the last job of the group finishing on a worker, the continuation must run exactly once
+void testContinuationRace(vks::TaskScheduler &scheduler)
+{
+	const uint32_t iterations = 50000;
+	uint32_t missing = 0;
+	for (uint32_t i = 0; i < iterations; i++) {
+		vks::TaskGroup group;
+		vks::TaskGroup continuationGroup;
+		std::atomic<uint32_t> continuations{ 0 };
+		uint32_t length = (i * 7) % 256;
+		scheduler.run(group, [length] { spin(length); });
+		spin(i % 64);
+		scheduler.then(group, [&continuations] { continuations.fetch_add(1); }, &continuationGroup);
+		scheduler.wait(continuationGroup);
+		scheduler.wait(group);
+		missing += (continuations.load() != 1) ? 1 : 0;
+	}
+	CHECK(missing == 0);
+}
+
+// then() called from jobs on the workers while the groups' jobs finish on other threads
+void testContinuationFromJobs(vks::TaskScheduler &scheduler)
+{
+	const uint32_t groupCount = 64;
+	uint32_t missing = 0;
+	for (uint32_t i = 0; i < 500; i++) {
+		std::vector<vks::TaskGroup> groups(groupCount);
+		vks::TaskGroup setup;
+		vks::TaskGroup continuationGroup;
+		std::atomic<uint32_t> continuations{ 0 };
+		for (uint32_t j = 0; j < groupCount; j++) {
+			vks::TaskGroup *group = &groups[j];
+			vks::TaskGroup *continuationGroupPtr = &continuationGroup;
+			std::atomic<uint32_t> *continuationsPtr = &continuations;
+			scheduler.run(*group, [j] { spin(j * 5); });
+			scheduler.run(setup, [&scheduler, group, continuationGroupPtr, continuationsPtr] {
+				scheduler.then(*group, [continuationsPtr] { continuationsPtr->fetch_add(1); }, continuationGroupPtr);
+			});
+		}
+		scheduler.wait(setup);
+		scheduler.wait(continuationGroup);
+		for (auto &group : groups) {
+			scheduler.wait(group);
+		}
+		missing += groupCount - continuations.load();
+	}
+	CHECK(missing == 0);
+}
+
+// Jobs of one scheduler submit to another one, whose jobs are then executed on the submitting thread
+void testOtherScheduler(vks::TaskScheduler &scheduler)
+{
+	vks::TaskScheduler other(2);
+	std::atomic<uint32_t> executed{ 0 };
+	std::atomic<uint32_t> *executedPtr = &executed;
+	vks::TaskScheduler *otherPtr = &other;
+	vks::TaskGroup group;
+	for (uint32_t i = 0; i < 64; i++) {
+		scheduler.run(group, [otherPtr, executedPtr] {
+			vks::TaskGroup otherGroup;
+			vks::TaskGroup continuationGroup;
+			for (uint32_t j = 0; j < 16; j++) {
+				otherPtr->run(otherGroup, [executedPtr] { executedPtr->fetch_add(1); });
+			}
+			otherPtr->then(otherGroup, [executedPtr] { executedPtr->fetch_add(1); }, &continuationGroup);
+			otherPtr->wait(continuationGroup);
+			otherPtr->wait(otherGroup);
+		});
+	}
+	scheduler.wait(group);
+	CHECK(executed.load() == 64 * 17);
+}
+
+int main()
+{
+	vks::TaskScheduler scheduler(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+	testParallelFor(scheduler);
+	testContinuationRace(scheduler);
+	testContinuationFromJobs(scheduler);
+	testOtherScheduler(scheduler);
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All checks passed" << std::endl;
+	return 0;
+}